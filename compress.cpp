@@ -0,0 +1,137 @@
+// $Id: compress.cpp,v 1.1 2026-10-16 16:52:18-07 - - $
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+using namespace std;
+
+#include <unistd.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "compress.h"
+#include "debug.h"
+#include "protocol.h"
+#include "transfer.h"
+
+static void pack_frame_header (char* buffer, uint32_t raw_size,
+                               uint32_t wire_size) {
+   uint32_t sizes[2] {htonl (raw_size), htonl (wire_size)};
+   memcpy (buffer, sizes, sizeof sizes);
+}
+
+static size_t max_wire_size (size_t raw_size) {
+#ifdef HAVE_ZLIB
+   return compressBound (raw_size);
+#else
+   return raw_size;
+#endif
+}
+
+const string& frame_packer::pack (const char* chunk, size_t size) {
+   frame.resize (FRAME_HEADER_SIZE + max_wire_size (size));
+   size_t wire_size = size;
+#ifdef HAVE_ZLIB
+   if (skip > 0) {
+      --skip;
+   }else {
+      char* packed = frame.data() + FRAME_HEADER_SIZE;
+      uLongf packed_size = frame.size() - FRAME_HEADER_SIZE;
+      int rc = compress2 (reinterpret_cast<Bytef*> (packed),
+               &packed_size, reinterpret_cast<const Bytef*> (chunk),
+               size, Z_BEST_SPEED);
+      if (rc == Z_OK and packed_size < size - size / 16) {
+         wire_size = packed_size;
+         misses = 0;
+      }else if (++misses >= MAX_MISSES) {
+         misses = 0;
+         skip = SKIP_CHUNKS;
+      }
+   }
+#endif
+   if (wire_size == size) {
+      memcpy (frame.data() + FRAME_HEADER_SIZE, chunk, size);
+   }
+   DEBUGF ('z', "frame " << size << " as " << wire_size);
+   pack_frame_header (frame.data(), size, wire_size);
+   frame.resize (FRAME_HEADER_SIZE + wire_size);
+   return frame;
+}
+
+void send_file_compressed (base_socket& socket, int file_fd,
+                           uint64_t nbytes) {
+   frame_packer packer;
+   auto chunk = make_unique<char[]> (min<uint64_t> (
+                                     nbytes, transfer_chunk_size));
+   while (nbytes > 0) {
+      ssize_t nread = ::read (file_fd, chunk.get(), min<uint64_t> (
+                              nbytes, transfer_chunk_size));
+      if (nread < 0) {
+         if (errno == EINTR) continue;
+         throw socket_sys_error ("read");
+      }
+      if (nread == 0) throw socket_error ("read: file truncated");
+      const string& frame = packer.pack (chunk.get(), nread);
+      send_packet (socket, frame.data(), frame.size());
+      nbytes -= nread;
+   }
+}
+
+void send_buffer_compressed (base_socket& socket, const char* buffer,
+                             size_t size) {
+   frame_packer packer;
+   while (size > 0) {
+      size_t chunk_size = min (size, transfer_chunk_size);
+      const string& frame = packer.pack (buffer, chunk_size);
+      send_packet (socket, frame.data(), frame.size());
+      buffer += chunk_size;
+      size -= chunk_size;
+   }
+}
+
+int recv_file_compressed (base_socket& socket, int file_fd,
+                          uint64_t nbytes) {
+   string wire;
+   string raw;
+   int error = 0;
+   while (nbytes > 0) {
+      uint32_t sizes[2];
+      recv_packet (socket, sizes, sizeof sizes);
+      uint32_t raw_size = ntohl (sizes[0]);
+      uint32_t wire_size = ntohl (sizes[1]);
+      if (raw_size == 0 or raw_size > nbytes
+      or raw_size > MAX_CHUNK_SIZE
+      or wire_size > max_wire_size (raw_size)) {
+         throw socket_error ("compressed payload: bad frame");
+      }
+      wire.resize (wire_size);
+      recv_packet (socket, wire.data(), wire_size);
+      const string* data = &wire;
+      if (wire_size != raw_size) {
+#ifdef HAVE_ZLIB
+         raw.resize (raw_size);
+         uLongf unpacked_size = raw_size;
+         int rc = uncompress (reinterpret_cast<Bytef*> (raw.data()),
+                  &unpacked_size,
+                  reinterpret_cast<const Bytef*> (wire.data()),
+                  wire_size);
+         if (rc != Z_OK or unpacked_size != raw_size) {
+            throw socket_error ("compressed payload: bad data");
+         }
+         data = &raw;
+#else
+         throw socket_error ("compressed payload: no zlib");
+#endif
+      }
+      if (file_fd >= 0 and error == 0) {
+         error = write_all (file_fd, data->data(), raw_size);
+      }
+      nbytes -= raw_size;
+   }
+   return error;
+}
+
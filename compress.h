@@ -0,0 +1,61 @@
+// $Id: compress.h,v 1.1 2026-10-16 16:52:18-07 - - $
+
+//
+// compressed payloads
+// A payload sent with CXI_TAG_COMPRESSED is a series of frames, each
+// an 8-byte frame header, raw_size and wire_size in network byte
+// order, followed by wire_size bytes.  If wire_size equals raw_size
+// the bytes are stored as they are, otherwise they are one zlib
+// stream that inflates to raw_size bytes.  The header's nbytes is
+// still the raw size of the payload, so the receiver knows when the
+// last frame has arrived.  Each chunk is framed on its own, so
+// neither end holds more than a chunk at a time.
+//
+
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <cstdint>
+#include <string>
+using namespace std;
+
+#include "socket.h"
+
+constexpr size_t FRAME_HEADER_SIZE = 8;
+
+//
+// class frame_packer
+// Packs chunks into frames.  A chunk that does not shrink by at
+// least a sixteenth is stored.  After several such chunks in a row
+// the packer stops trying for a while, so incompressible data costs
+// little more than a copy.
+//
+
+class frame_packer {
+   private:
+      static constexpr int MAX_MISSES = 4;
+      static constexpr int SKIP_CHUNKS = 32;
+      int misses {0};
+      int skip {0};
+      string frame;
+   public:
+      const string& pack (const char* chunk, size_t size);
+};
+
+// Send nbytes from the file's current offset as frames.
+void send_file_compressed (base_socket& socket, int file_fd,
+                           uint64_t nbytes);
+
+// Send a buffer as frames.
+void send_buffer_compressed (base_socket& socket, const char* buffer,
+                             size_t size);
+
+// Receive frames holding nbytes of raw payload into the file, or
+// throw them away if file_fd is negative.  As with recv_file, the
+// whole payload is consumed.  Returns 0 or errno of a failed write.
+// Throws socket_error if a frame is malformed.
+int recv_file_compressed (base_socket& socket, int file_fd,
+                          uint64_t nbytes);
+
+#endif
+
@@ -0,0 +1,165 @@
+// $Id: crc32c.cpp,v 1.1 2026-10-16 21:07:45-07 - - $
+
+#include <cstring>
+using namespace std;
+
+#if defined (__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#include "crc32c.h"
+
+// The polynomial, bit-reflected.
+static constexpr uint32_t POLY = 0x82F63B78;
+
+static uint64_t load64 (const uint8_t* bytes) {
+   uint64_t word;
+   memcpy (&word, bytes, sizeof word);
+   return word;
+}
+
+// Product of two polynomials modulo POLY, in reflected form.
+static uint32_t multmodp (uint32_t a, uint32_t b) {
+   uint32_t product = 0;
+   for (uint32_t bit = uint32_t (1) << 31; bit != 0; bit >>= 1) {
+      if (a & bit) product ^= b;
+      b = b & 1 ? (b >> 1) ^ POLY : b >> 1;
+   }
+   return product;
+}
+
+// x to the power 8 * size modulo POLY, by repeated squaring.
+static uint32_t xpow8n (uint64_t size) {
+   uint32_t result = uint32_t (1) << 31;  // x^0
+   uint32_t square = uint32_t (1) << 23;  // x^8
+   for (; size != 0; size >>= 1) {
+      if (size & 1) result = multmodp (square, result);
+      square = multmodp (square, square);
+   }
+   return result;
+}
+
+uint32_t crc32c_combine (uint32_t crc1, uint32_t crc2, uint64_t size2) {
+   return multmodp (xpow8n (size2), crc1) ^ crc2;
+}
+
+
+//
+// slice-by-8
+// table[0] is the classic byte-at-a-time table.  table[k][byte] is
+// the remainder of byte followed by k zero bytes, so eight bytes can
+// be folded in with eight independent lookups.
+//
+
+struct slice8_tables {
+   uint32_t table[8][256];
+   slice8_tables() {
+      for (uint32_t byte = 0; byte < 256; ++byte) {
+         uint32_t crc = byte;
+         for (int bit = 0; bit < 8; ++bit) {
+            crc = crc & 1 ? (crc >> 1) ^ POLY : crc >> 1;
+         }
+         table[0][byte] = crc;
+      }
+      for (uint32_t byte = 0; byte < 256; ++byte) {
+         for (int slice = 1; slice < 8; ++slice) {
+            uint32_t prev = table[slice - 1][byte];
+            table[slice][byte] = (prev >> 8) ^ table[0][prev & 0xFF];
+         }
+      }
+   }
+};
+
+static const slice8_tables slice8;
+
+// Works on the raw register, without the inversions.
+static uint32_t slice8_update (uint32_t crc, const uint8_t* bytes,
+                               size_t size) {
+   const auto& table = slice8.table;
+   for (; size >= 8; bytes += 8, size -= 8) {
+      uint64_t word = load64 (bytes) ^ crc;
+      crc = table[7][word & 0xFF]
+          ^ table[6][(word >> 8) & 0xFF]
+          ^ table[5][(word >> 16) & 0xFF]
+          ^ table[4][(word >> 24) & 0xFF]
+          ^ table[3][(word >> 32) & 0xFF]
+          ^ table[2][(word >> 40) & 0xFF]
+          ^ table[1][(word >> 48) & 0xFF]
+          ^ table[0][word >> 56];
+   }
+   for (; size > 0; ++bytes, --size) {
+      crc = (crc >> 8) ^ table[0][(crc ^ *bytes) & 0xFF];
+   }
+   return crc;
+}
+
+uint32_t crc32c_portable (uint32_t crc, const void* data, size_t size) {
+   return ~slice8_update (~crc, static_cast<const uint8_t*> (data),
+                          size);
+}
+
+
+#if defined (__x86_64__)
+
+// Bytes each of the three streams covers before they are combined.
+static constexpr size_t LANE_SIZE = 0x2000;
+
+static const uint32_t lane_shift = xpow8n (LANE_SIZE);
+
+__attribute__ ((target ("sse4.2")))
+static uint32_t sse42_update (uint32_t crc, const uint8_t* bytes,
+                              size_t size) {
+   // The crc32 instruction has a latency of three cycles but can
+   // start one every cycle, so three independent streams keep it
+   // busy.  Each of the last two streams starts from zero and is
+   // folded in by shifting the running value past it.
+   for (; size >= 3 * LANE_SIZE; bytes += 3 * LANE_SIZE,
+                                 size -= 3 * LANE_SIZE) {
+      uint64_t crc0 = crc;
+      uint64_t crc1 = 0;
+      uint64_t crc2 = 0;
+      for (size_t offset = 0; offset < LANE_SIZE; offset += 8) {
+         crc0 = _mm_crc32_u64 (crc0, load64 (bytes + offset));
+         crc1 = _mm_crc32_u64 (crc1, load64 (bytes + LANE_SIZE
+                                             + offset));
+         crc2 = _mm_crc32_u64 (crc2, load64 (bytes + 2 * LANE_SIZE
+                                             + offset));
+      }
+      crc = multmodp (lane_shift, crc0) ^ crc1;
+      crc = multmodp (lane_shift, crc) ^ crc2;
+   }
+   uint64_t crc64 = crc;
+   for (; size >= 8; bytes += 8, size -= 8) {
+      crc64 = _mm_crc32_u64 (crc64, load64 (bytes));
+   }
+   crc = crc64;
+   for (; size > 0; ++bytes, --size) {
+      crc = _mm_crc32_u8 (crc, *bytes);
+   }
+   return crc;
+}
+
+static const bool have_sse42 = __builtin_cpu_supports ("sse4.2");
+
+bool crc32c_hardware() {
+   return have_sse42;
+}
+
+uint32_t crc32c (uint32_t crc, const void* data, size_t size) {
+   auto bytes = static_cast<const uint8_t*> (data);
+   if (have_sse42) return ~sse42_update (~crc, bytes, size);
+   return ~slice8_update (~crc, bytes, size);
+}
+
+#else
+
+bool crc32c_hardware() {
+   return false;
+}
+
+uint32_t crc32c (uint32_t crc, const void* data, size_t size) {
+   return crc32c_portable (crc, data, size);
+}
+
+#endif
+
@@ -0,0 +1,32 @@
+// $Id: crc32c.h,v 1.1 2026-10-16 21:07:45-07 - - $
+
+//
+// CRC32C (Castagnoli)
+// crc32c continues a checksum over more data, so a payload can be
+// checked a chunk at a time; start with 0.  It uses the SSE4.2
+// crc32 instruction when the processor has it, running three
+// streams at once to hide the instruction's latency, and otherwise
+// a portable slice-by-8 table lookup.
+//
+
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <cstddef>
+#include <cstdint>
+using namespace std;
+
+uint32_t crc32c (uint32_t crc, const void* data, size_t size);
+
+// The table lookup alone, whatever the processor supports.
+uint32_t crc32c_portable (uint32_t crc, const void* data, size_t size);
+
+// Whether crc32c uses the crc32 instruction.
+bool crc32c_hardware();
+
+// Checksum of two pieces of data joined, given the checksum of each
+// and the size of the second.
+uint32_t crc32c_combine (uint32_t crc1, uint32_t crc2, uint64_t size2);
+
+#endif
+
@@ -0,0 +1,81 @@
+// $Id: crcbench.cpp,v 1.1 2026-10-16 21:07:45-07 - - $
+// CRC32C throughput
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+using namespace std;
+
+#include <libgen.h>
+
+#include "crc32c.h"
+
+using crc_function = uint32_t (uint32_t, const void*, size_t);
+
+// Checksum about total bytes in buffers of the given size.
+// Returns gigabytes per second.
+double measure (crc_function* function, const char* buffer,
+                size_t size, size_t total) {
+   size_t rounds = total / size;
+   uint32_t crc = 0;
+   auto start = chrono::steady_clock::now();
+   for (size_t round = 0; round < rounds; ++round) {
+      crc = function (crc, buffer, size);
+   }
+   chrono::duration<double> elapsed = chrono::steady_clock::now()
+                                    - start;
+   // keep the result live so the loop is not optimized away
+   asm volatile ("" : : "r" (crc));
+   return double (rounds * size) / elapsed.count() / 1e9;
+}
+
+bool check (crc_function* function, const string& name) {
+   // the standard check value for CRC32C
+   static const char digits[] = "123456789";
+   uint32_t crc = function (0, digits, sizeof digits - 1);
+   if (crc == 0xE3069283) return true;
+   cerr << name << ": wrong check value " << hex << crc << endl;
+   return false;
+}
+
+int main (int argc, char** argv) {
+   string execname = basename (argv[0]);
+   size_t total = argc > 1 ? stoul (argv[1]) << 20 : 1 << 30;
+   if (not check (crc32c, "crc32c")
+   or not check (crc32c_portable, "portable")) return EXIT_FAILURE;
+
+   constexpr size_t MAX_SIZE = 1 << 20;
+   auto buffer = make_unique<char[]> (MAX_SIZE);
+   for (size_t index = 0; index < MAX_SIZE; ++index) {
+      buffer[index] = char (index * 2654435761u >> 24);
+   }
+
+   // the whole buffer must agree whichever way it is checksummed
+   uint32_t whole = crc32c (0, buffer.get(), MAX_SIZE);
+   uint32_t split = crc32c_combine (
+                    crc32c (0, buffer.get(), 12345),
+                    crc32c (0, buffer.get() + 12345, MAX_SIZE - 12345),
+                    MAX_SIZE - 12345);
+   if (whole != crc32c_portable (0, buffer.get(), MAX_SIZE)
+   or whole != split) {
+      cerr << execname << ": kernels disagree" << endl;
+      return EXIT_FAILURE;
+   }
+
+   cout << execname << ": crc32 instruction "
+        << (crc32c_hardware() ? "used" : "not available") << endl;
+   cout << setw (10) << "size" << setw (12) << "crc32c"
+        << setw (12) << "portable" << "  (GB/s)" << endl;
+   for (size_t size = 64; size <= MAX_SIZE; size *= 4) {
+      cout << setw (10) << size << fixed << setprecision (2)
+           << setw (12) << measure (crc32c, buffer.get(), size, total)
+           << setw (12) << measure (crc32c_portable, buffer.get(),
+                                    size, total)
+           << endl;
+   }
+   return EXIT_SUCCESS;
+}
+
@@ -1,55 +1,95 @@
 // $Id: cxi.cpp,v 1.6 2021-11-08 00:01:44-08 - - $
 // CLIENT
 
+#include <algorithm>
+#include <condition_variable>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 using namespace std;
 
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <glob.h>
 #include <libgen.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "compress.h"
 #include "debug.h"
+#include "delta.h"
 #include "logstream.h"
 #include "protocol.h"
+#include "sha256.h"
 #include "socket.h"
-
-#include <fstream>
-
-# define BUFFER_SIZE 0x1000
+#include "trace.h"
+#include "transfer.h"
 
 
 logstream outlog (cout);
 struct cxi_exit: public exception {};
 
+// Requests in flight at once.  With more than one, the client asks
+// the server for tagged headers and pipelines its requests.
+size_t cxi_window = 1;
 
+// Whether to ask the server to compress payloads both ways.
+bool cxi_compress = false;
 
+// Whether to ask for checksums on every file payload.
+bool cxi_checksum = false;
 
-ifstream read_file_into_buffer(const char* fn, char* buffer) {
-   ifstream ifs{ fn, istream::binary };
-   if (!ifs) {
-      return ifs;
-   }
+// Whether put first offers the hash of the file, so that the server
+// need not be sent contents its store already holds.
+bool cxi_dedup = false;
 
-   ifs.seekg(0, ifs.end);
-   int len = ifs.tellg();
-   ifs.seekg(0, ifs.beg);
+// Whether get and put pick up where an interrupted one left off.
+bool cxi_resume = false;
 
-   ifs.read(buffer, len);
-   return ifs;
+// Connections a large get or put is striped over, or 0 to choose
+// from the size of the file and the number of cores.
+size_t cxi_stripes = 1;
+
+// Send nbytes of a file from offset, its current offset, as a
+// payload, compressed and followed by its checksums if negotiated.
+void send_put_payload (cxi_channel& server, int file_fd,
+                       uint64_t offset, uint64_t nbytes) {
+   payload_crc crc;
+   if (server.checksummed()) crc = file_crc (file_fd, offset, nbytes);
+   if (server.send_compressed()) {
+      send_file_compressed (server.socket, file_fd, nbytes);
+   }else {
+      send_file (server.socket, file_fd, nbytes);
+   }
+   if (server.checksummed()) send_crc (server.socket, crc);
 }
 
-ofstream write_file_from_buffer(const char* fn, const char* buffer,
-      const uint32_t bytes) {
-   ofstream ofs{ fn, ostream::out | ostream::binary
-         | ostream::trunc };
-   if (ofs) {
-      ofs.write(buffer, bytes);
+// Receive the payload of a FILEOUT into the file at offset, its
+// current offset, or throw it away if file_fd is negative.  Returns
+// 0 or errno, EBADMSG if the checksums do not match.
+int recv_get_payload (cxi_channel& server, int file_fd,
+                      uint64_t offset, uint64_t nbytes) {
+   int error = 0;
+   if (server.recv_compressed()) {
+      error = recv_file_compressed (server.socket, file_fd, nbytes);
+   }else if (file_fd < 0) {
+      discard_payload (server.socket, nbytes);
+   }else {
+      error = recv_file (server.socket, file_fd, nbytes);
    }
-   return ofs;
+   if (server.checksummed()) {
+      payload_crc sent = recv_crc (server.socket, nbytes);
+      if (file_fd >= 0 and error == 0) {
+         error = verify_file_crc (sent, file_fd, offset, nbytes);
+      }
+   }
+   return error;
 }
 
 
@@ -62,15 +102,47 @@ unordered_map<string,cxi_command> command_map {
    {"get",  cxi_command::GET},
    {"rm",   cxi_command::RM},
    {"ls",   cxi_command::LS},
+   {"mget", cxi_command::MGET},
+   {"mput", cxi_command::MPUT},
+   {"mrm",  cxi_command::MRM},
+   {"dput", cxi_command::DPUT},
+   {"getrange", cxi_command::GETRANGE},
+   {"putat", cxi_command::PUTAT},
+   {"append", cxi_command::PUTAT},
+   {"size", cxi_command::SIZE},
+   {"sum", cxi_command::SUM},
+   {"stats", cxi_command::STATS},
+   {"trace", cxi_command::TRACE},
 };
 
 static const char help[] = R"||(
-exit         - Exit the program.  Equivalent to EOF.
-get filename - Copy remote file to local host.
-help         - Print help summary.
-ls           - List names of files on remote server.
-put filename - Copy local file to remote host.
-rm filename  - Remove file from remote server.
+append filename         - Append local file to remote file.
+dput filename           - Update a remote file, sending only what
+                          changed.
+exit                    - Exit the program.  Equivalent to EOF.
+get filename            - Copy remote file to local host.
+getrange filename offset [length]
+                        - Copy part of a remote file into the same
+                          place in the local file.
+help                    - Print help summary.
+ls [pattern]            - List files on remote server, or those
+                          matching.
+mget names              - Get several files, or those matching one
+                          pattern.
+mput names              - Put several local files; patterns match
+                          locally.
+mrm names               - Remove several files, or those matching
+                          one pattern.
+put filename            - Copy local file to remote host.
+putat filename [offset] - Copy local file from offset on to the same
+                          place in the remote file, or append it.
+rm filename             - Remove file from remote server.
+size filename           - Print the size of a remote file.
+stats [metrics]         - Print server statistics, or as metrics
+                          lines for scraping.
+sum filename            - Print the CRC32C of a remote file.
+trace                   - Save the server's request trace to a
+                          local cxid-trace.<pid>, for cxitrace.
 )||";
 
 void cxi_help() {
@@ -78,31 +150,30 @@ void cxi_help() {
 }
 
 
-void cxi_put(client_socket& server, string fn) {
+// Each command is split in two: request_x sends the request, and
+// finish_x handles the reply once its header has arrived.  In
+// lock-step mode one follows the other; when pipelining, replies are
+// handled by a reader thread while more requests are sent.
+
+void request_put(cxi_channel& server, const string& fn) {
    // fn is ready to go into the header
 
    cxi_header hdr;
    strncpy(hdr.filename, fn.c_str(), FILENAME_SIZE);
    hdr.command = cxi_command::PUT;
 
-   char payload[BUFFER_SIZE];
-   ifstream ifs = read_file_into_buffer(hdr.filename, payload);
-
-   if (!ifs) {
-      throw socket_sys_error("Err: cxi_put: ifstream fail");
+   open_file file (hdr.filename, O_RDONLY);
+   if (not file.is_open()) {
+      throw socket_sys_error("Err: cxi_put: open fail");
    }
-
-   ifs.seekg(0, ifs.end);
-   int len = ifs.tellg();
-   ifs.seekg(0, ifs.beg);
-   hdr.nbytes = htonl(len);
+   uint64_t len = file_size (file.get());
 
    // send packets
-   send_packet(server, &hdr, sizeof hdr);
-   send_packet(server, payload, len);
+   server.send_header (hdr, len);
+   send_put_payload (server, file.get(), 0, len);
+}
 
-   // recieve packet
-   recv_packet(server, &hdr, sizeof hdr);
+void finish_put(cxi_channel&, cxi_header& hdr, const string&) {
    if (hdr.command == cxi_command::NAK) {
       cout << "PUT: FAILURE: NAK: err:" << 
             strerror(ntohl(hdr.nbytes)) << endl;
@@ -113,7 +184,7 @@ void cxi_put(client_socket& server, string fn) {
    }
 }
 
-void cxi_get(client_socket& server, string fn) {
+void request_get(cxi_channel& server, const string& fn) {
    // fn is ready to go into the header
 
    // NOTE TO GRADER: COMMAND PARSING HAPPENS IN MAIN()
@@ -121,24 +192,31 @@ void cxi_get(client_socket& server, string fn) {
 
    cxi_header hdr;
    strncpy(hdr.filename, fn.c_str(), FILENAME_SIZE);
-   char fn_cstr_cpy[FILENAME_SIZE] {};
-   strncpy(fn_cstr_cpy, fn.c_str(), FILENAME_SIZE);
    hdr.command = cxi_command::GET;
-   hdr.nbytes = 0;
-   send_packet(server, &hdr, sizeof hdr);
+   server.send_header (hdr, 0);
+}
 
-   recv_packet(server, &hdr, sizeof hdr);
+void finish_get(cxi_channel& server, cxi_header& hdr,
+                const string& fn) {
+   char fn_cstr_cpy[FILENAME_SIZE] {};
+   strncpy(fn_cstr_cpy, fn.c_str(), FILENAME_SIZE);
    if (hdr.command == cxi_command::NAK) {
       cout << "GET: FAILURE: NAK: err:" << 
             strerror(ntohl(hdr.nbytes)) << endl;
    } else if (hdr.command == cxi_command::FILEOUT) {
-      int bytes = ntohl(hdr.nbytes);
-      char payload[BUFFER_SIZE];
-      recv_packet(server, &payload, bytes);
-      ofstream ofs = write_file_from_buffer(fn_cstr_cpy, payload, 
-            bytes);
-      if (!ofs) {
-         throw socket_sys_error("Err: cxi_get: ofstream fail");
+      uint64_t bytes = server.recv_payload_size (hdr);
+      open_file file (fn_cstr_cpy, O_RDWR | O_CREAT | O_TRUNC);
+      if (not file.is_open()) {
+         int error = errno;
+         recv_get_payload (server, -1, 0, bytes);
+         errno = error;
+         throw socket_sys_error("Err: cxi_get: open fail");
+      }
+      int error = recv_get_payload (server, file.get(), 0, bytes);
+      if (error == 0) error = file.close();
+      if (error != 0) {
+         errno = error;
+         throw socket_sys_error("Err: cxi_get: write fail");
       }
       cout << "GET: SUCCESS: FILEOUT" << endl;
    } else {
@@ -146,16 +224,16 @@ void cxi_get(client_socket& server, string fn) {
    }
 }
 
-void cxi_rm(client_socket& server, string fn) {
+void request_rm(cxi_channel& server, const string& fn) {
    // fn is ready to go into the header
 
    cxi_header hdr;
    strncpy(hdr.filename, fn.c_str(), FILENAME_SIZE);
    hdr.command = cxi_command::RM;
-   hdr.nbytes = 0;
-   send_packet(server, &hdr, sizeof hdr);
-   
-   recv_packet(server, &hdr, sizeof hdr);
+   server.send_header (hdr, 0);
+}
+
+void finish_rm(cxi_channel&, cxi_header& hdr, const string&) {
    if (hdr.command == cxi_command::NAK) {
       cout << "RM: FAILURE: NAK: err:" << 
             strerror(ntohl(hdr.nbytes)) << endl;
@@ -166,39 +244,1177 @@ void cxi_rm(client_socket& server, string fn) {
    }
 }
 
-void cxi_ls (client_socket& server) {
+// The server answers DPUT with the signatures of its copy, and the
+// delta goes back as a second request under the same tag.  Its ACK
+// is then the reply to both.
+void request_dput (cxi_channel& server, const string& fn) {
+   cxi_header hdr;
+   strncpy (hdr.filename, fn.c_str(), FILENAME_SIZE);
+   hdr.command = cxi_command::DPUT;
+   open_file file (hdr.filename, O_RDONLY);
+   if (not file.is_open()) {
+      throw socket_sys_error ("Err: cxi_dput: open fail");
+   }
+   server.send_header (hdr, 0);
+}
+
+void finish_dput (cxi_channel& server, cxi_header& hdr,
+                  const string& fn) {
+   delta_stats stats;
+   uint64_t len = 0;
+   if (hdr.command == cxi_command::SIGS) {
+      uint64_t size = server.recv_payload_size (hdr);
+      if (size > MAX_SIGNATURES_SIZE) {
+         throw socket_error ("DPUT: signatures too long");
+      }
+      string signatures (size, '\0');
+      recv_packet (server.socket, signatures.data(), size);
+      cxi_header delta;
+      strncpy (delta.filename, fn.c_str(), FILENAME_SIZE);
+      open_file file (delta.filename, O_RDONLY);
+      int error = file.is_open() ? 0 : errno;
+      if (error == 0) {
+         try {
+            len = file_size (file.get());
+         }catch (socket_sys_error& sys_error) {
+            error = sys_error.sys_errno;
+         }
+      }
+      if (error != 0) {
+         cout << "DPUT: " << fn << ": " << strerror (error) << endl;
+         delta.command = cxi_command::END; // cancels the update
+         server.send_header (delta, 0);
+      }else {
+         delta.command = cxi_command::DELTA;
+         server.send_header (delta, len);
+         stats = send_delta (server.socket, signatures, file.get(),
+                             len);
+      }
+      server.recv_header (hdr);
+   }
+   if (hdr.command == cxi_command::NAK) {
+      cout << "DPUT: FAILURE: NAK: err:"
+           << strerror (ntohl (hdr.nbytes)) << endl;
+   }else if (hdr.command == cxi_command::ACK) {
+      cout << "DPUT: SUCCESS: ACK: sent " << stats.literal_bytes
+           << " of " << len << " bytes" << endl;
+   }else {
+      cout << "DPUT: UNCERTAIN: recieved neither NAK nor ACK" << endl;
+   }
+}
+
+// The listing comes as binary records, which are filtered by the
+// pattern, if any, and shown sorted by name.
+void request_ls (cxi_channel& server, const string&) {
    cxi_header header;
    header.command = cxi_command::LS;
    DEBUGF ('h', "sending header " << header << endl);
-   send_packet (server, &header, sizeof header);
-   recv_packet (server, &header, sizeof header);
+   server.send_header (header, uint32_t (ls_format::BINARY));
+}
+
+void finish_ls (cxi_channel& server, cxi_header& header,
+                const string& pattern) {
    DEBUGF ('h', "received header " << header << endl);
    if (header.command != cxi_command::LSOUT) {
       outlog << "sent LS, server did not return LSOUT" << endl;
       outlog << "server returned " << header << endl;
-   }else {
-      size_t host_nbytes = ntohl (header.nbytes);
-      auto buffer = make_unique<char[]> (host_nbytes + 1);
-      recv_packet (server, buffer.get(), host_nbytes);
+      return;
+   }
+   vector<ls_record> records;
+   string chunk;
+   for (;;) {
+      size_t host_nbytes = server.recv_payload_size (header);
+      if (host_nbytes == 0) break;
+      chunk.resize (host_nbytes);
+      recv_packet (server.socket, chunk.data(), host_nbytes);
       DEBUGF ('h', "received " << host_nbytes << " bytes");
-      buffer[host_nbytes] = '\0';
-      cout << buffer.get();
+      size_t offset = 0;
+      ls_record record;
+      while (unpack_ls_record (chunk, offset, record)) {
+         if (pattern.empty()
+         or fnmatch (pattern.c_str(), record.name.c_str(), 0) == 0) {
+            records.push_back (move (record));
+         }
+      }
+      server.recv_header (header);
+      if (header.command == cxi_command::NAK) {
+         cout << "LS: FAILURE: NAK: err:"
+              << strerror (ntohl (header.nbytes)) << endl;
+         return;
+      }
+      if (header.command != cxi_command::LSOUT) {
+         throw socket_error ("LS: unexpected header "
+                             + to_string (header.command));
+      }
+   }
+   sort (records.begin(), records.end(),
+         [] (const ls_record& left, const ls_record& right) {
+            return left.name < right.name;
+         });
+   for (const auto& record: records) {
+      cout << format_ls_record (record) << "\n";
+   }
+   cout.flush();
+}
+
+
+// Batch commands take a list of names separated by spaces.  A single
+// name with wildcards in it is a pattern for the server to match.
+
+vector<string> split_names (const string& args) {
+   vector<string> names;
+   size_t begin = 0;
+   for (;;) {
+      begin = args.find_first_not_of (' ', begin);
+      if (begin == string::npos) break;
+      size_t end = args.find (' ', begin);
+      if (end == string::npos) end = args.size();
+      names.emplace_back (args, begin, end - begin);
+      begin = end;
+   }
+   return names;
+}
+
+bool is_pattern (const string& name) {
+   return name.find_first_of ("*?[") != string::npos;
+}
+
+// Complain and return false if args will not fit a batch request.
+bool check_batch (cxi_command command, const string& args) {
+   vector<string> names = split_names (args);
+   if (names.empty()) {
+      cout << "Err: " << to_string (command) << ": no names" << endl;
+      return false;
+   }
+   for (const auto& name: names) {
+      if (name.length() > 58) {  // too long
+         cout << "Err: fn:" << name << ", is >58 chars long" << endl;
+         return false;
+      }
+   }
+   if (args.size() > MAX_BATCH_NAMES) {
+      cout << "Err: " << to_string (command) << ": too many names"
+           << endl;
+      return false;
+   }
+   return true;
+}
+
+void request_batch (cxi_channel& server, cxi_command command,
+                    const string& args) {
+   cxi_header hdr;
+   hdr.command = command;
+   vector<string> names = split_names (args);
+   string payload;
+   if (names.size() == 1 and is_pattern (names[0])) {
+      strncpy(hdr.filename, names[0].c_str(), FILENAME_SIZE);
+   }else {
+      for (const auto& name: names) payload += name + "\n";
+   }
+   server.send_header (hdr, payload.size());
+   send_packet (server.socket, payload.data(), payload.size());
+}
+
+void request_mget (cxi_channel& server, const string& args) {
+   request_batch (server, cxi_command::MGET, args);
+}
+
+void request_mrm (cxi_channel& server, const string& args) {
+   request_batch (server, cxi_command::MRM, args);
+}
+
+// Each local file follows as a PUT, then END.  Files that cannot be
+// opened here are reported and left out.
+void request_mput (cxi_channel& server, const string& args) {
+   cxi_header mput;
+   mput.command = cxi_command::MPUT;
+   server.send_header (mput, 0);
+   for (const auto& arg: split_names (args)) {
+      glob_t matches {};
+      glob (arg.c_str(), GLOB_NOCHECK, nullptr, &matches);
+      vector<string> names (matches.gl_pathv,
+                            matches.gl_pathv + matches.gl_pathc);
+      globfree (&matches);
+      for (const auto& name: names) {
+         cxi_header hdr;
+         if (name.length() > 58) {
+            cout << "MPUT: " << name << ": FAILURE: name too long"
+                 << endl;
+            continue;
+         }
+         strncpy(hdr.filename, name.c_str(), FILENAME_SIZE);
+         hdr.command = cxi_command::PUT;
+         open_file file (hdr.filename, O_RDONLY);
+         uint64_t len = 0;
+         int error = file.is_open() ? 0 : errno;
+         if (error == 0) {
+            try {
+               len = file_size (file.get());
+            }catch (socket_sys_error& sys_error) {
+               error = sys_error.sys_errno;
+            }
+         }
+         if (error != 0) {
+            cout << "MPUT: " << name << ": FAILURE: err:"
+                 << strerror (error) << endl;
+            continue;
+         }
+         server.send_header (hdr, len);
+         send_put_payload (server, file.get(), 0, len);
+      }
+   }
+   cxi_header end;
+   end.command = cxi_command::END;
+   server.send_header (end, 0);
+}
+
+// The server names the files an MGET brings back, so only plain
+// names are written, which stay in this directory.
+bool local_name_ok (const string& name) {
+   return not name.empty() and name != "." and name != ".."
+      and name.find ('/') == string::npos;
+}
+
+// Handle the frames of a batch reply, the first of which is in
+// header, through to its END.
+void finish_batch (cxi_channel& server, cxi_header& header,
+                   const string& label) {
+   for (; header.command != cxi_command::END;
+          server.recv_header (header)) {
+      string name (header.filename,
+                   strnlen (header.filename, FILENAME_SIZE));
+      cout << label << ": " << name << ": ";
+      switch (header.command) {
+         case cxi_command::ACK:
+            cout << "SUCCESS: ACK" << endl;
+            break;
+         case cxi_command::NAK:
+            cout << "FAILURE: NAK: err:"
+                 << strerror (ntohl (header.nbytes)) << endl;
+            break;
+         case cxi_command::FILEOUT: {
+            uint64_t bytes = server.recv_payload_size (header);
+            if (not local_name_ok (name)) {
+               recv_get_payload (server, -1, 0, bytes);
+               cout << "FAILURE: not a local name" << endl;
+               break;
+            }
+            open_file file (name.c_str(), O_RDWR | O_CREAT | O_TRUNC);
+            int error = file.is_open() ? 0 : errno;
+            int write_error = recv_get_payload (server, file.get(),
+                                                0, bytes);
+            if (error == 0) error = write_error;
+            if (error == 0) error = file.close();
+            if (error != 0) cout << "FAILURE: err:" << strerror (error);
+                       else cout << "SUCCESS: FILEOUT";
+            cout << endl;
+            break;
+         }
+         default:
+            throw socket_error (label + ": unexpected header "
+                                + to_string (header.command));
+      }
+   }
+   cout << label << ": " << ntohl (header.nbytes) << " files" << endl;
+}
+
+void finish_mget (cxi_channel& server, cxi_header& header,
+                  const string&) {
+   finish_batch (server, header, "MGET");
+}
+
+void finish_mput (cxi_channel& server, cxi_header& header,
+                  const string&) {
+   finish_batch (server, header, "MPUT");
+}
+
+void finish_mrm (cxi_channel& server, cxi_header& header,
+                 const string&) {
+   finish_batch (server, header, "MRM");
+}
+
+
+// Ranged commands take a filename and then numbers: getrange an
+// offset and an optional length, putat an optional offset.  putat
+// without one, or append, adds to the end of the remote file.
+struct range_args {
+   string filename;
+   vector<uint64_t> numbers;
+};
+
+// Split up to max_numbers trailing numbers off args.
+range_args split_range (const string& args, size_t max_numbers) {
+   range_args range;
+   vector<string> words = split_names (args);
+   while (not words.empty() and range.numbers.size() < max_numbers
+          and words.back().find_first_not_of ("0123456789")
+              == string::npos) {
+      range.numbers.insert (range.numbers.begin(),
+                            stoull (words.back()));
+      words.pop_back();
+   }
+   for (const auto& word: words) {
+      if (not range.filename.empty()) range.filename += " ";
+      range.filename += word;
+   }
+   return range;
+}
+
+// Complain and return false if args will not fit a ranged request.
+bool check_range (cxi_command command, const string& args) {
+   try {
+      size_t max_numbers = command == cxi_command::GETRANGE ? 2 : 1;
+      range_args range = split_range (args, max_numbers);
+      if (range.filename.empty()) {
+         cout << "Err: " << to_string (command) << ": no filename"
+              << endl;
+         return false;
+      }
+      if (range.filename.length() > 58) {  // too long
+         cout << "Err: fn:" << range.filename << ", is >58 chars long"
+              << endl;
+         return false;
+      }
+      if (command == cxi_command::GETRANGE and range.numbers.empty()) {
+         cout << "Err: GETRANGE: no offset" << endl;
+         return false;
+      }
+   }catch (out_of_range&) { // thrown by stoull
+      cout << "Err: " << to_string (command) << ": number too large"
+           << endl;
+      return false;
+   }
+   return true;
+}
+
+void send_getrange (cxi_channel& server, const string& fn,
+                    uint64_t offset, uint64_t length) {
+   cxi_header hdr;
+   strncpy (hdr.filename, fn.c_str(), FILENAME_SIZE);
+   hdr.command = cxi_command::GETRANGE;
+   char prefix[RANGE_PREFIX_SIZE];
+   pack_range (prefix, offset, length);
+   server.send_header (hdr, sizeof prefix);
+   send_packet (server.socket, prefix, sizeof prefix);
+}
+
+// Send nbytes of the local file from offset to the remote one.
+void send_putat (cxi_channel& server, const string& fn, int file_fd,
+                 uint64_t offset, uint64_t nbytes, uint64_t flags) {
+   cxi_header hdr;
+   strncpy (hdr.filename, fn.c_str(), FILENAME_SIZE);
+   hdr.command = cxi_command::PUTAT;
+   if (::lseek (file_fd, offset, SEEK_SET) < 0) {
+      throw socket_sys_error ("Err: cxi_putat: lseek fail");
+   }
+   char prefix[RANGE_PREFIX_SIZE];
+   pack_range (prefix, offset, flags);
+   server.send_header (hdr, RANGE_PREFIX_SIZE + nbytes);
+   send_packet (server.socket, prefix, sizeof prefix);
+   send_put_payload (server, file_fd, offset, nbytes);
+}
+
+void request_getrange (cxi_channel& server, const string& args) {
+   range_args range = split_range (args, 2);
+   uint64_t length = range.numbers.size() > 1 ? range.numbers[1]
+                                              : RANGE_TO_END;
+   send_getrange (server, range.filename, range.numbers[0], length);
+}
+
+// The range lands at the same offset in the local file, which is
+// otherwise left alone.
+void finish_getrange (cxi_channel& server, cxi_header& hdr,
+                      const string& args) {
+   range_args range = split_range (args, 2);
+   uint64_t offset = range.numbers[0];
+   if (hdr.command == cxi_command::NAK) {
+      cout << "GETRANGE: FAILURE: NAK: err:"
+           << strerror (ntohl (hdr.nbytes)) << endl;
+   }else if (hdr.command == cxi_command::FILEOUT) {
+      uint64_t bytes = server.recv_payload_size (hdr);
+      open_file file (range.filename.c_str(), O_RDWR | O_CREAT);
+      int error = file.is_open() ? 0 : errno;
+      if (error == 0 and ::lseek (file.get(), offset, SEEK_SET) < 0) {
+         error = errno;
+      }
+      int write_error = recv_get_payload (
+                        server, error == 0 ? file.get() : -1,
+                        offset, bytes);
+      if (error == 0) error = write_error;
+      if (error == 0) error = file.close();
+      if (error != 0) {
+         cout << "GETRANGE: FAILURE: err:" << strerror (error) << endl;
+      }else {
+         cout << "GETRANGE: SUCCESS: FILEOUT " << bytes
+              << " bytes at " << offset << endl;
+      }
+   }else {
+      cout << "GETRANGE: UNCERTAIN: recieved neither NAK nor FILEOUT"
+           << endl;
+   }
+}
+
+// From an offset, the local file from there on is written there and
+// the remote file is cut off after it.  Without one, all of the
+// local file is appended.
+void request_putat (cxi_channel& server, const string& args) {
+   range_args range = split_range (args, 1);
+   open_file file (range.filename.c_str(), O_RDONLY);
+   if (not file.is_open()) {
+      throw socket_sys_error ("Err: cxi_putat: open fail");
+   }
+   uint64_t len = file_size (file.get());
+   if (range.numbers.empty()) {
+      send_putat (server, range.filename, file.get(), 0, len,
+                  PUTAT_APPEND);
+   }else {
+      uint64_t offset = min (range.numbers[0], len);
+      send_putat (server, range.filename, file.get(), offset,
+                  len - offset, PUTAT_TRUNCATE);
+   }
+}
+
+void finish_putat (cxi_channel&, cxi_header& hdr, const string&) {
+   if (hdr.command == cxi_command::NAK) {
+      cout << "PUTAT: FAILURE: NAK: err:"
+           << strerror (ntohl (hdr.nbytes)) << endl;
+   }else if (hdr.command == cxi_command::ACK) {
+      cout << "PUTAT: SUCCESS: ACK" << endl;
+   }else {
+      cout << "PUTAT: UNCERTAIN: recieved neither NAK nor ACK" << endl;
+   }
+}
+
+void request_size (cxi_channel& server, const string& fn) {
+   cxi_header hdr;
+   strncpy (hdr.filename, fn.c_str(), FILENAME_SIZE);
+   hdr.command = cxi_command::SIZE;
+   server.send_header (hdr, 0);
+}
+
+void finish_size (cxi_channel& server, cxi_header& hdr,
+                  const string& fn) {
+   if (hdr.command == cxi_command::NAK) {
+      cout << "SIZE: FAILURE: NAK: err:"
+           << strerror (ntohl (hdr.nbytes)) << endl;
+   }else if (hdr.command == cxi_command::ACK) {
+      cout << "SIZE: " << fn << ": " << server.recv_payload_size (hdr)
+           << " bytes" << endl;
+   }else {
+      cout << "SIZE: UNCERTAIN: recieved neither NAK nor ACK" << endl;
+   }
+}
+
+void request_sum (cxi_channel& server, const string& fn) {
+   cxi_header hdr;
+   strncpy (hdr.filename, fn.c_str(), FILENAME_SIZE);
+   hdr.command = cxi_command::SUM;
+   server.send_header (hdr, 0);
+}
+
+// Receive the checksum that is the payload of a SUM's ACK.  Returns
+// 0, or EPROTO if the payload is not a checksum.
+int recv_sum (cxi_channel& server, const cxi_header& hdr,
+              uint32_t& crc) {
+   uint64_t nbytes = server.recv_payload_size (hdr);
+   if (nbytes != SUM_SIZE) {
+      discard_payload (server.socket, nbytes);
+      return EPROTO;
+   }
+   uint32_t wire_crc = 0;
+   recv_packet (server.socket, &wire_crc, SUM_SIZE);
+   crc = ntohl (wire_crc);
+   return 0;
+}
+
+void finish_sum (cxi_channel& server, cxi_header& hdr,
+                 const string& fn) {
+   uint32_t crc = 0;
+   if (hdr.command == cxi_command::NAK) {
+      cout << "SUM: FAILURE: NAK: err:"
+           << strerror (ntohl (hdr.nbytes)) << endl;
+   }else if (hdr.command == cxi_command::ACK) {
+      int error = recv_sum (server, hdr, crc);
+      if (error != 0) {
+         cout << "SUM: FAILURE: err:" << strerror (error) << endl;
+         return;
+      }
+      char sum[16];
+      snprintf (sum, sizeof sum, "%08x", crc);
+      cout << "SUM: " << fn << ": crc32c " << sum << endl;
+   }else {
+      cout << "SUM: UNCERTAIN: recieved neither NAK nor ACK" << endl;
+   }
+}
+
+
+void request_stats (cxi_channel& server, const string& args) {
+   cxi_header hdr;
+   hdr.command = cxi_command::STATS;
+   stats_format format = args == "metrics" ? stats_format::METRICS
+                                           : stats_format::TEXT;
+   server.send_header (hdr, uint32_t (format));
+}
+
+void finish_stats (cxi_channel& server, cxi_header& hdr,
+                   const string&) {
+   if (hdr.command != cxi_command::STATS) {
+      cout << "STATS: UNCERTAIN: server returned " << hdr << endl;
+      return;
+   }
+   string report (server.recv_payload_size (hdr), '\0');
+   recv_packet (server.socket, report.data(), report.size());
+   cout << report;
+   cout.flush();
+}
+
+void request_trace (cxi_channel& server, const string&) {
+   cxi_header hdr;
+   hdr.command = cxi_command::TRACE;
+   server.send_header (hdr, 0);
+}
+
+void finish_trace (cxi_channel& server, cxi_header& hdr,
+                   const string&) {
+   if (hdr.command == cxi_command::NAK) {
+      cout << "TRACE: FAILURE: NAK: err:"
+           << strerror (ntohl (hdr.nbytes)) << endl;
+      return;
+   }
+   if (hdr.command != cxi_command::TRACE) {
+      cout << "TRACE: UNCERTAIN: server returned " << hdr << endl;
+      return;
+   }
+   uint64_t nbytes = server.recv_payload_size (hdr);
+   trace_dump_header dump_header;
+   if (nbytes < sizeof dump_header) {
+      discard_payload (server.socket, nbytes);
+      cout << "TRACE: FAILURE: " << strerror (EPROTO) << endl;
+      return;
+   }
+   recv_packet (server.socket, &dump_header, sizeof dump_header);
+   uint64_t events_size = nbytes - sizeof dump_header;
+   // named here, not by the server, which could name any file
+   string fn = "cxid-trace." + to_string (dump_header.pid);
+   open_file file (fn.c_str(), O_WRONLY | O_CREAT | O_TRUNC);
+   int error = file.is_open() ? 0 : errno;
+   if (error == 0) {
+      error = write_all (file.get(),
+                         reinterpret_cast<const char*> (&dump_header),
+                         sizeof dump_header);
+   }
+   if (error == 0) {
+      error = recv_file (server.socket, file.get(), events_size);
+   }else {
+      discard_payload (server.socket, events_size);
+   }
+   if (error != 0) {
+      cout << "TRACE: FAILURE: " << fn << ": " << strerror (error)
+           << endl;
+   }else {
+      cout << "TRACE: SUCCESS: " << nbytes << " bytes to " << fn
+           << endl;
+   }
+}
+
+
+// Resumable transfers go a segment at a time, and a sidecar file
+// next to the local one records how far they got.  Each segment's
+// reply is the proof of progress: the size of a partial file is not,
+// since receiving may allocate the whole file before filling it.
+constexpr uint64_t RESUME_SEGMENT = 0x1000000;
+
+string sidecar_name (const string& fn, const string& kind) {
+   size_t slash = fn.rfind ('/');
+   size_t base = slash == string::npos ? 0 : slash + 1;
+   return fn.substr (0, base) + "." + fn.substr (base) + ".cxi-" + kind;
+}
+
+// Read count numbers from the sidecar.  Returns false if there is
+// none or it does not hold them.
+bool read_sidecar (const string& sidecar, vector<uint64_t>& values,
+                   size_t count) {
+   open_file file (sidecar.c_str(), O_RDONLY);
+   if (not file.is_open()) return false;
+   char buffer[128];
+   ssize_t nread = ::read (file.get(), buffer, sizeof buffer - 1);
+   if (nread <= 0) return false;
+   buffer[nread] = '\0';
+   values.clear();
+   char* cursor = buffer;
+   while (values.size() < count) {
+      char* end = nullptr;
+      errno = 0;
+      uint64_t value = strtoull (cursor, &end, 10);
+      if (end == cursor or errno != 0) return false;
+      values.push_back (value);
+      cursor = end;
+   }
+   return true;
+}
+
+void write_sidecar (const string& sidecar,
+                    const vector<uint64_t>& values) {
+   string line;
+   for (uint64_t value: values) {
+      if (not line.empty()) line += " ";
+      line += to_string (value);
+   }
+   line += "\n";
+   open_file file (sidecar.c_str(), O_WRONLY | O_CREAT | O_TRUNC);
+   int error = file.is_open() ? 0 : errno;
+   if (error == 0) error = write_all (file.get(), line.data(),
+                                      line.size());
+   if (error == 0) error = file.close();
+   if (error != 0) {
+      errno = error;
+      throw socket_sys_error ("Err: " + sidecar + ": write fail");
+   }
+}
+
+// Size of the remote file, or with SUM its checksum, or 0 with errno
+// in error.
+uint64_t remote_size (cxi_channel& server, const string& fn,
+                      int& error,
+                      cxi_command command = cxi_command::SIZE) {
+   cxi_header hdr;
+   strncpy (hdr.filename, fn.c_str(), FILENAME_SIZE);
+   hdr.command = command;
+   server.send_header (hdr, 0);
+   server.recv_header (hdr);
+   error = 0;
+   if (hdr.command == cxi_command::ACK
+   and command == cxi_command::SUM) {
+      uint32_t crc = 0;
+      error = recv_sum (server, hdr, crc);
+      return crc;
+   }
+   if (hdr.command == cxi_command::ACK) {
+      return server.recv_payload_size (hdr);
+   }
+   error = hdr.command == cxi_command::NAK ? ntohl (hdr.nbytes)
+                                           : EPROTO;
+   return 0;
+}
+
+void print_resumed (const string& label, uint64_t start) {
+   cout << label;
+   if (start > 0) cout << " (resumed at " << start << ")";
+   cout << endl;
+}
+
+// The sidecar holds the remote size and checksum, so that a remote
+// file rewritten since starts over even if its size is the same, and
+// how much of it is here.  A server that will not checksum the file
+// gets it from the start every time.
+void resume_get (cxi_channel& server, const string& fn) {
+   int error = 0;
+   uint64_t size = remote_size (server, fn, error);
+   if (error != 0) {
+      cout << "GET: FAILURE: NAK: err:" << strerror (error) << endl;
+      return;
+   }
+   int sum_error = 0;
+   uint64_t crc = remote_size (server, fn, sum_error,
+                               cxi_command::SUM);
+   string sidecar = sidecar_name (fn, "get");
+   vector<uint64_t> progress;
+   uint64_t start = 0;
+   if (sum_error == 0 and read_sidecar (sidecar, progress, 3)
+   and progress[0] == size and progress[1] == crc
+   and progress[2] <= size and ::access (fn.c_str(), F_OK) == 0) {
+      start = progress[2];
+   }
+   open_file file (fn.c_str(),
+                   O_RDWR | O_CREAT | (start == 0 ? O_TRUNC : 0));
+   if (not file.is_open()) {
+      throw socket_sys_error ("Err: cxi_get: open fail");
+   }
+   write_sidecar (sidecar, {size, crc, start});
+   for (uint64_t offset = start; offset < size; ) {
+      send_getrange (server, fn, offset,
+                     min (size - offset, RESUME_SEGMENT));
+      cxi_header hdr;
+      server.recv_header (hdr);
+      if (hdr.command != cxi_command::FILEOUT) {
+         finish_get (server, hdr, fn);
+         return;
+      }
+      uint64_t bytes = server.recv_payload_size (hdr);
+      if (::lseek (file.get(), offset, SEEK_SET) < 0) error = errno;
+      int write_error = recv_get_payload (
+                        server, error == 0 ? file.get() : -1,
+                        offset, bytes);
+      if (error == 0) error = write_error;
+      if (error == 0 and bytes == 0) error = ESTALE; // it shrank
+      if (error != 0) {
+         cout << "GET: FAILURE: err:" << strerror (error) << endl;
+         return;
+      }
+      offset += bytes;
+      write_sidecar (sidecar, {size, crc, offset});
+   }
+   if (::ftruncate (file.get(), size) < 0) error = errno;
+   if (error == 0) error = file.close();
+   if (error != 0) {
+      errno = error;
+      throw socket_sys_error ("Err: cxi_get: write fail");
+   }
+   ::unlink (sidecar.c_str());
+   print_resumed ("GET: SUCCESS: FILEOUT", start);
+}
+
+// The sidecar holds the local size and modification time, so that a
+// changed file starts over, and how much of it has been sent.
+void resume_put (cxi_channel& server, const string& fn) {
+   open_file file (fn.c_str(), O_RDONLY);
+   if (not file.is_open()) {
+      throw socket_sys_error ("Err: cxi_put: open fail");
+   }
+   struct stat stat_buf;
+   if (::fstat (file.get(), &stat_buf) < 0) {
+      throw socket_sys_error ("Err: cxi_put: fstat fail");
+   }
+   uint64_t len = stat_buf.st_size;
+   uint64_t mtime = stat_buf.st_mtime;
+   string sidecar = sidecar_name (fn, "put");
+   vector<uint64_t> progress;
+   uint64_t start = 0;
+   if (read_sidecar (sidecar, progress, 3) and progress[0] == len
+   and progress[1] == mtime) {
+      int error = 0;
+      uint64_t size = remote_size (server, fn, error);
+      if (error == 0) start = min ({progress[2], size, len});
+   }
+   write_sidecar (sidecar, {len, mtime, start});
+   uint64_t offset = start;
+   do {
+      uint64_t nbytes = min (len - offset, RESUME_SEGMENT);
+      bool last = offset + nbytes == len;
+      send_putat (server, fn, file.get(), offset, nbytes,
+                  last ? PUTAT_TRUNCATE : 0);
+      cxi_header hdr;
+      server.recv_header (hdr);
+      if (hdr.command != cxi_command::ACK) {
+         finish_put (server, hdr, fn);
+         return;
+      }
+      offset += nbytes;
+      write_sidecar (sidecar, {len, mtime, offset});
+   }while (offset < len);
+   ::unlink (sidecar.c_str());
+   print_resumed ("PUT: SUCCESS: ACK", start);
+}
+
+// Offer the SHA-256 of a local file with HAVE.  Returns true if the
+// server had it, so the put is done.  Otherwise the put goes ahead
+// and reports any error itself.
+bool offer_hash (cxi_channel& server, const string& fn) {
+   cxi_header hdr;
+   strncpy (hdr.filename, fn.c_str(), FILENAME_SIZE);
+   hdr.command = cxi_command::HAVE;
+   sha256_digest digest;
+   open_file file (hdr.filename, O_RDONLY);
+   if (not file.is_open()) return false;
+   if (file_sha256 (file.get(), digest) != 0) return false;
+   server.send_header (hdr, digest.size());
+   send_packet (server.socket, digest.data(), digest.size());
+   server.recv_header (hdr);
+   DEBUGF ('h', "HAVE " << to_string (digest) << ": " << hdr);
+   if (hdr.command != cxi_command::ACK) return false;
+   cout << "PUT: SUCCESS: ACK (server had it)" << endl;
+   return true;
+}
+
+using request_fn = void (*) (cxi_channel&, const string&);
+using finish_fn = void (*) (cxi_channel&, cxi_header&, const string&);
+
+unordered_map<cxi_command,pair<request_fn,finish_fn>> request_map {
+   {cxi_command::PUT, {request_put, finish_put}},
+   {cxi_command::GET, {request_get, finish_get}},
+   {cxi_command::RM , {request_rm , finish_rm }},
+   {cxi_command::LS , {request_ls , finish_ls }},
+   {cxi_command::MGET, {request_mget, finish_mget}},
+   {cxi_command::MPUT, {request_mput, finish_mput}},
+   {cxi_command::MRM , {request_mrm , finish_mrm }},
+   {cxi_command::DPUT, {request_dput, finish_dput}},
+   {cxi_command::GETRANGE, {request_getrange, finish_getrange}},
+   {cxi_command::PUTAT, {request_putat, finish_putat}},
+   {cxi_command::SIZE, {request_size, finish_size}},
+   {cxi_command::SUM , {request_sum , finish_sum }},
+   {cxi_command::STATS, {request_stats, finish_stats}},
+   {cxi_command::TRACE, {request_trace, finish_trace}},
+};
+
+void lockstep_request (cxi_channel& server, cxi_command command,
+                       const string& fn) {
+   const auto& functions = request_map.at (command);
+   functions.first (server, fn);
+   cxi_header header;
+   server.recv_header (header);
+   functions.second (server, header, fn);
+}
+
+
+// Ask the server for features.  Returns those it granted.
+uint32_t cxi_hello (cxi_channel& server, uint32_t wanted) {
+   cxi_header header;
+   header.command = cxi_command::HELLO;
+   server.send_header (header, wanted);
+   server.recv_header (header);
+   if (header.command != cxi_command::ACK) {
+      outlog << "sent HELLO, server returned " << header << endl;
+      return 0;
+   }
+   server.features = ntohl (header.nbytes) & wanted;
+   return server.features;
+}
+
+//
+// class pipeline
+// Keeps up to window requests in flight on a tagged channel.  The
+// calling thread sends requests; a reader thread receives the
+// replies, matches each to its request by request_id and finishes
+// it.  Any error on the connection stops the pipeline.
+//
+
+class pipeline {
+   private:
+      struct request {
+         cxi_command command;
+         string filename;
+      };
+      cxi_channel& server;
+      size_t window;
+      uint32_t next_id {1};
+      unordered_map<uint32_t,request> pending;
+      mutex lock;
+      condition_variable changed;
+      bool stopped {false};
+      bool closing {false};
+      thread reader;
+      void read_replies();
+   public:
+      pipeline (cxi_channel& server, size_t window);
+      pipeline (const pipeline&) = delete;
+      pipeline& operator= (const pipeline&) = delete;
+      ~pipeline();
+      void submit (cxi_command command, const string& fn);
+      void drain(); // wait until nothing is in flight
+};
+
+pipeline::pipeline (cxi_channel& server_, size_t window_):
+          server (server_), window (window_),
+          reader (&pipeline::read_replies, this) {
+}
+
+pipeline::~pipeline() {
+   {
+      lock_guard<mutex> guard (lock);
+      closing = true;
+      changed.notify_all();
+   }
+   ::shutdown (server.socket.get_socket_fd(), SHUT_RD);
+   reader.join();
+}
+
+void pipeline::submit (cxi_command command, const string& fn) {
+   unique_lock<mutex> guard (lock);
+   changed.wait (guard, [this] {
+      return stopped or pending.size() < window;
+   });
+   if (stopped) throw socket_error ("pipeline stopped");
+   uint32_t id = next_id++;
+   pending[id] = {command, fn};
+   changed.notify_all();
+   guard.unlock();
+   server.send_tag.request_id = id;
+   try {
+      request_map.at (command).first (server, fn);
+   }catch (...) {
+      guard.lock();
+      pending.erase (id);
+      throw;
+   }
+}
+
+void pipeline::drain() {
+   unique_lock<mutex> guard (lock);
+   changed.wait (guard, [this] {
+      return stopped or pending.empty();
+   });
+}
+
+// The reader only reads while something is pending, so that after
+// drain() the calling thread may use the channel in lock step.
+void pipeline::read_replies() {
+   try {
+      for (;;) {
+         {
+            unique_lock<mutex> guard (lock);
+            changed.wait (guard, [this] {
+               return closing or not pending.empty();
+            });
+            if (closing) return;
+         }
+         cxi_header header;
+         server.recv_header (header);
+         uint32_t id = server.recv_tag.request_id;
+         request req;
+         {
+            lock_guard<mutex> guard (lock);
+            auto itor = pending.find (id);
+            if (itor == pending.end()) {
+               throw socket_error ("reply to unknown request "
+                                   + to_string (id));
+            }
+            req = move (itor->second);
+         }
+         request_map.at (req.command).second (server, header,
+                                              req.filename);
+         lock_guard<mutex> guard (lock);
+         pending.erase (id);
+         changed.notify_all();
+      }
+   }catch (socket_error& error) {
+      lock_guard<mutex> guard (lock);
+      if (not closing) outlog << error.what() << endl;
+      stopped = true;
+      changed.notify_all();
+   }
+}
+
+
+// Ask for the features the options call for, and have the channel
+// use them.  Returns those granted.
+uint32_t cxi_negotiate (cxi_channel& server) {
+   uint32_t wanted = CXI_FEATURE_TAGS;
+   if (cxi_compress) wanted |= CXI_FEATURE_COMPRESS;
+   if (cxi_checksum) wanted |= CXI_FEATURE_CRC32C;
+   if (cxi_dedup) wanted |= CXI_FEATURE_DEDUP;
+   uint32_t granted = cxi_hello (server, wanted);
+   if (granted & CXI_FEATURE_COMPRESS) {
+      server.send_tag.flags = CXI_TAG_COMPRESSED;
+   }
+   return granted;
+}
+
+
+// A striped get or put splits the file into adjacent ranges and
+// moves each over a connection of its own, with GETRANGE or PUTAT,
+// all at once.  Each end has its own descriptor for each range, so
+// they read and write at their own offsets.  SUM then checks the
+// whole file.  Stripes are whole megabytes of at least 16 MiB.  In
+// auto mode there is one per core, but enough to get past the window
+// of a single stream even on a small machine.
+constexpr uint64_t MIN_STRIPE_SIZE = 0x1000000;
+constexpr uint64_t STRIPE_ALIGN = 0x100000;
+constexpr size_t MIN_AUTO_STRIPES = 4;
+constexpr size_t MAX_AUTO_STRIPES = 8;
+
+struct stripe {
+   uint64_t offset {0};
+   uint64_t nbytes {0};
+   string error; // empty if it went through
+};
+
+vector<stripe> make_stripes (uint64_t size) {
+   size_t count = cxi_stripes;
+   if (count == 0) {
+      count = clamp<size_t> (thread::hardware_concurrency(),
+                             MIN_AUTO_STRIPES, MAX_AUTO_STRIPES);
+   }
+   count = clamp<uint64_t> (size / MIN_STRIPE_SIZE, 1, count);
+   uint64_t length = (size + count - 1) / count;
+   length = (length + STRIPE_ALIGN - 1) & ~(STRIPE_ALIGN - 1);
+   vector<stripe> stripes;
+   for (uint64_t offset = 0; offset < size; offset += length) {
+      stripes.push_back ({offset, min (length, size - offset), ""});
+   }
+   return stripes;
+}
+
+void run_stripe (const string& host, in_port_t port,
+                 cxi_command command, const string& fn, int flags,
+                 uint64_t size, stripe& part) {
+   try {
+      client_socket socket (host, port);
+      cxi_channel channel (socket);
+      if (cxi_compress or cxi_checksum) cxi_negotiate (channel);
+      open_file file (fn.c_str(), flags);
+      if (not file.is_open()) throw socket_sys_error (fn);
+      cxi_header hdr;
+      if (command == cxi_command::GET) {
+         send_getrange (channel, fn, part.offset, part.nbytes);
+      }else {
+         bool last = part.offset + part.nbytes == size;
+         send_putat (channel, fn, file.get(), part.offset, part.nbytes,
+                     last ? PUTAT_TRUNCATE : 0);
+      }
+      channel.recv_header (hdr);
+      if (hdr.command == cxi_command::NAK) {
+         part.error = strerror (ntohl (hdr.nbytes));
+      }else if (command == cxi_command::GET
+            and hdr.command == cxi_command::FILEOUT) {
+         uint64_t bytes = channel.recv_payload_size (hdr);
+         int error = 0;
+         if (::lseek (file.get(), part.offset, SEEK_SET) < 0) {
+            error = errno;
+         }
+         int write_error = recv_get_payload (
+                           channel, error == 0 ? file.get() : -1,
+                           part.offset, bytes);
+         if (error == 0) error = write_error;
+         if (error == 0 and bytes != part.nbytes) error = ESTALE;
+         if (error != 0) part.error = strerror (error);
+      }else if (hdr.command != cxi_command::ACK) {
+         part.error = "unexpected " + to_string (hdr.command);
+      }
+   }catch (socket_error& error) {
+      part.error = error.what();
+   }
+}
+
+// Run every stripe, then report any that failed.  Returns true if
+// they all went through.
+bool run_stripes (const string& host, in_port_t port,
+                  cxi_command command, const string& fn, int flags,
+                  uint64_t size, vector<stripe>& stripes) {
+   vector<thread> workers;
+   for (auto& part: stripes) {
+      workers.emplace_back (run_stripe, cref (host), port, command,
+                            cref (fn), flags, size, ref (part));
    }
+   for (auto& worker: workers) worker.join();
+   bool ok = true;
+   for (const auto& part: stripes) {
+      if (part.error.empty()) continue;
+      cout << to_string (command) << ": FAILURE: stripe at "
+           << part.offset << ": " << part.error << endl;
+      ok = false;
+   }
+   return ok;
+}
+
+// Compare the checksum of the whole local file with the server's.
+bool check_stripes (cxi_channel& server, cxi_command command,
+                    const string& fn, int file_fd, uint64_t size) {
+   int error = 0;
+   uint32_t remote = remote_size (server, fn, error,
+                                  cxi_command::SUM);
+   uint32_t local = 0;
+   if (error == 0) {
+      try {
+         local = file_crc (file_fd, 0, size).whole;
+      }catch (socket_sys_error& sys_error) {
+         error = sys_error.sys_errno;
+      }
+   }
+   if (error == 0 and local != remote) error = EBADMSG;
+   if (error != 0) {
+      cout << to_string (command) << ": FAILURE: SUM: err:"
+           << strerror (error) << endl;
+   }
+   return error == 0;
 }
 
-
+void striped_get (cxi_channel& server, const string& fn,
+                  const string& host, in_port_t port) {
+   int error = 0;
+   uint64_t size = remote_size (server, fn, error);
+   if (error != 0) {
+      cout << "GET: FAILURE: NAK: err:" << strerror (error) << endl;
+      return;
+   }
+   vector<stripe> stripes = make_stripes (size);
+   if (stripes.size() <= 1) {
+      lockstep_request (server, cxi_command::GET, fn);
+      return;
+   }
+   open_file file (fn.c_str(), O_RDWR | O_CREAT | O_TRUNC);
+   if (not file.is_open()) {
+      throw socket_sys_error ("Err: cxi_get: open fail");
+   }
+   if (::ftruncate (file.get(), size) < 0) {
+      throw socket_sys_error ("Err: cxi_get: ftruncate fail");
+   }
+   if (not run_stripes (host, port, cxi_command::GET, fn, O_RDWR,
+                        size, stripes)) return;
+   if (not check_stripes (server, cxi_command::GET, fn, file.get(),
+                          size)) return;
+   cout << "GET: SUCCESS: FILEOUT in " << stripes.size()
+        << " stripes" << endl;
+}
+
+void striped_put (cxi_channel& server, const string& fn,
+                  const string& host, in_port_t port) {
+   open_file file (fn.c_str(), O_RDONLY);
+   if (not file.is_open()) {
+      throw socket_sys_error ("Err: cxi_put: open fail");
+   }
+   uint64_t len = file_size (file.get());
+   vector<stripe> stripes = make_stripes (len);
+   if (stripes.size() <= 1) {
+      lockstep_request (server, cxi_command::PUT, fn);
+      return;
+   }
+   if (not run_stripes (host, port, cxi_command::PUT, fn, O_RDONLY,
+                        len, stripes)) return;
+   if (not check_stripes (server, cxi_command::PUT, fn, file.get(),
+                          len)) return;
+   cout << "PUT: SUCCESS: ACK in " << stripes.size() << " stripes"
+        << endl;
+}
+
+
 void usage() {
-   cerr << "Usage: " << outlog.execname() << " host port" << endl;
+   cerr << "Usage: " << outlog.execname()
+        << " [-dkRuZ] [-c chunksize] [-p window] [-S stripes|auto]"
+        << " host port" << endl;
    throw cxi_exit();
 }
 
+size_t get_window (const string& window_arg) {
+   auto error = socket_error (window_arg + ": invalid window");
+   try {
+      int window = stoi (window_arg);
+      if (window < 1) throw error;
+      return window;
+   }catch (invalid_argument&) { // thrown by stoi
+      throw error;
+   }catch (out_of_range&) { // thrown by stoi
+      throw error;
+   }
+}
+
+size_t get_stripes (const string& stripes_arg) {
+   if (stripes_arg == "auto") return 0;
+   return get_window (stripes_arg);
+}
+
 pair<string,in_port_t> scan_options (int argc, char** argv) {
    for (;;) {
-      int opt = getopt (argc, argv, "@:");
+      int opt = getopt (argc, argv, "@:c:dkp:RS:uZ");
       if (opt == EOF) break;
       switch (opt) {
          case '@': debugflags::setflags (optarg);
                    break;
+         case 'c': transfer_chunk_size = get_chunk_size (optarg);
+                   break;
+         case 'd': cxi_dedup = true;
+                   break;
+         case 'k': cxi_checksum = true;
+                   break;
+         case 'p': cxi_window = get_window (optarg);
+                   break;
+         case 'R': cxi_resume = true;
+                   break;
+         case 'S': cxi_stripes = get_stripes (optarg);
+                   break;
+         case 'u': transfer_io_uring = true;
+                   break;
+         case 'Z': cxi_compress = true;
+                   break;
       }
    }
    if (argc - optind != 2) usage();
@@ -217,10 +1433,33 @@ int main (int argc, char** argv) {
       outlog << "connecting to " << host << " port " << port << endl;
       client_socket server (host, port);
       outlog << "connected to " << to_string (server) << endl;
+      cxi_channel channel (server);
+      unique_ptr<pipeline> requests;
+      if (cxi_window > 1 or cxi_compress or cxi_checksum
+      or cxi_dedup) {
+         uint32_t granted = cxi_negotiate (channel);
+         if (cxi_compress and not (granted & CXI_FEATURE_COMPRESS)) {
+            outlog << "server does not support compression" << endl;
+         }
+         if (cxi_checksum and not (granted & CXI_FEATURE_CRC32C)) {
+            outlog << "server does not support checksums" << endl;
+         }
+         if (cxi_dedup and not (granted & CXI_FEATURE_DEDUP)) {
+            outlog << "server has no content store" << endl;
+         }
+         if (cxi_window > 1 and granted & CXI_FEATURE_TAGS) {
+            requests = make_unique<pipeline> (channel, cxi_window);
+         }else if (cxi_window > 1) {
+            outlog << "server does not support pipelining" << endl;
+         }
+      }
       for (;;) {
          string line;
          getline (cin, line);
-         if (cin.eof()) throw cxi_exit();
+         if (cin.eof()) {
+            if (requests) requests->drain();
+            throw cxi_exit();
+         }
 
          // get com and fn (DESTROYS line) (com means command)
          string com = line;
@@ -233,33 +1472,78 @@ int main (int argc, char** argv) {
             fn = line;
          }
 
+         const auto& itor = command_map.find (com);
+         cxi_command cmd = itor == command_map.end()
+                         ? cxi_command::ERROR : itor->second;
+
          // check fn length
-         if (fn.length() > 58) {  // too long
+         if (cmd == cxi_command::MGET or cmd == cxi_command::MPUT
+         or cmd == cxi_command::MRM) {
+            if (not check_batch (cmd, fn)) continue;
+         }else if (cmd == cxi_command::GETRANGE
+               or cmd == cxi_command::PUTAT) {
+            if (not check_range (cmd, fn)) continue;
+         }else if (fn.length() > 58) {  // too long
             cout << "Err: fn:" << fn << ", is >58 chars long" << endl;
             continue;
          }
-
-         const auto& itor = command_map.find (com);
-         cxi_command cmd = itor == command_map.end()
-                         ? cxi_command::ERROR : itor->second;
          switch (cmd) {
             case cxi_command::EXIT:
+               if (requests) requests->drain();
                throw cxi_exit();
                break;
             case cxi_command::HELP:
                cxi_help();
                break;
             case cxi_command::PUT:
-               cxi_put(server, fn);
-               break;
             case cxi_command::GET:
-               cxi_get(server, fn);
-               break;
+               if (cmd == cxi_command::PUT
+               and channel.features & CXI_FEATURE_DEDUP) {
+                  // the offer goes in lock step
+                  if (requests) requests->drain();
+                  if (offer_hash (channel, fn)) break;
+               }
+               if (cxi_resume) {
+                  // segments go one at a time in lock step
+                  if (requests) requests->drain();
+                  if (cmd == cxi_command::GET) resume_get (channel, fn);
+                                          else resume_put (channel, fn);
+                  break;
+               }
+               if (cxi_stripes != 1) {
+                  if (requests) requests->drain();
+                  if (cmd == cxi_command::GET) {
+                     striped_get (channel, fn, host, port);
+                  }else {
+                     striped_put (channel, fn, host, port);
+                  }
+                  break;
+               }
+               [[fallthrough]];
             case cxi_command::RM:
-               cxi_rm(server, fn);
-               break;
             case cxi_command::LS:
-               cxi_ls (server);
+            case cxi_command::MGET:
+            case cxi_command::MPUT:
+            case cxi_command::MRM:
+            case cxi_command::GETRANGE:
+            case cxi_command::PUTAT:
+            case cxi_command::SIZE:
+            case cxi_command::SUM:
+            case cxi_command::STATS:
+            case cxi_command::TRACE:
+               if (requests) requests->submit (cmd, fn);
+                        else lockstep_request (channel, cmd, fn);
+               break;
+            case cxi_command::DPUT:
+               // the reader thread sends the delta, so nothing else
+               // may be sent while it is in flight
+               if (requests) {
+                  requests->drain();
+                  requests->submit (cmd, fn);
+                  requests->drain();
+               }else {
+                  lockstep_request (channel, cmd, fn);
+               }
                break;
             default:
                outlog << com << ": invalid command" << endl;
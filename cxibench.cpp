@@ -0,0 +1,467 @@
+// $Id: cxibench.cpp,v 1.1 2026-10-17 01:12:36-07 - - $
+// cxid load generator
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#include <libgen.h>
+#include <unistd.h>
+
+#include "protocol.h"
+#include "socket.h"
+#include "transfer.h"
+
+string execname;
+
+enum class bench_op { PUT, GET, LS, RM };
+constexpr size_t NOPS = 4;
+const char* const op_names[NOPS] {"PUT", "GET", "LS", "RM"};
+
+struct bench_options {
+   size_t clients {4};
+   double seconds {10};
+   double rate {0};          // requests per second in all; 0 is closed
+   unsigned mix[NOPS] {4, 4, 1, 1};
+   uint64_t min_size {4096};
+   uint64_t max_size {4096};
+   size_t files {16};        // per client
+};
+
+bench_options options;
+
+struct client_result {
+   vector<uint64_t> latency[NOPS];  // usec
+   uint64_t errors[NOPS] {};
+   uint64_t bytes {0};
+   chrono::steady_clock::time_point start {};  // of measuring
+   chrono::steady_clock::time_point stop {};
+   string failure;
+};
+
+
+// Each request is sent in lock step on an untagged channel, as cxi
+// sends it.  Returns false if the server answered NAK.
+bool run_op (cxi_channel& server, bench_op op, const string& name,
+             const char* data, uint64_t size, uint64_t& bytes) {
+   cxi_header header;
+   strncpy (header.filename, name.c_str(), FILENAME_SIZE - 1);
+   switch (op) {
+      case bench_op::PUT:
+         header.command = cxi_command::PUT;
+         server.send_header (header, size);
+         send_packet (server.socket, data, size);
+         bytes += size;
+         break;
+      case bench_op::GET:
+         header.command = cxi_command::GET;
+         server.send_header (header, 0);
+         break;
+      case bench_op::LS:
+         header.command = cxi_command::LS;
+         server.send_header (header, uint32_t (ls_format::TEXT));
+         break;
+      case bench_op::RM:
+         header.command = cxi_command::RM;
+         server.send_header (header, 0);
+         break;
+   }
+   server.recv_header (header);
+   while (header.command == cxi_command::FILEOUT
+          or header.command == cxi_command::LSOUT) {
+      uint64_t nbytes = server.recv_payload_size (header);
+      discard_payload (server.socket, nbytes);
+      bytes += nbytes;
+      if (header.command == cxi_command::FILEOUT or nbytes == 0) {
+         return true;
+      }
+      server.recv_header (header);
+   }
+   if (header.command == cxi_command::NAK) return false;
+   if (header.command != cxi_command::ACK) {
+      throw socket_error (string (op_names[size_t (op)])
+                          + ": unexpected "
+                          + to_string (header.command));
+   }
+   return true;
+}
+
+//
+// class start_gate
+// holds clients that have put their files until all have, so that
+// the clock starts for all at once.  A server that takes one
+// connection at a time never lets the rest get that far, so after
+// PREFILL_WAIT the clock starts without them.
+//
+
+class start_gate {
+   private:
+      static constexpr chrono::seconds PREFILL_WAIT {10};
+      mutex lock;
+      condition_variable opened;
+      size_t waiting;
+      bool open {false};
+   public:
+      explicit start_gate (size_t clients): waiting (clients) {}
+      // Wait for the clock to start.  Returns false if it already
+      // started without this client.
+      bool arrive();
+      // A client that failed before it was ready.
+      void leave();
+};
+
+bool start_gate::arrive() {
+   unique_lock<mutex> guard (lock);
+   if (open) return false;
+   if (--waiting > 0) {
+      opened.wait_for (guard, PREFILL_WAIT, [this] { return open; });
+   }
+   open = true;
+   opened.notify_all();
+   return true;
+}
+
+void start_gate::leave() {
+   lock_guard<mutex> guard (lock);
+   if (open or --waiting > 0) return;
+   open = true;
+   opened.notify_all();
+}
+
+//
+// class bench_client
+// one connection and the files it owns.  GET and RM pick a file it
+// has put; when it has none, they put one instead.
+//
+
+class bench_client {
+   private:
+      size_t index;
+      const char* data;
+      client_result& result;
+      mt19937_64 random;
+      vector<bool> present;
+      string file_name (size_t slot) const;
+      bench_op pick_op();
+      size_t pick_file (bool want_present);
+      uint64_t pick_size();
+      void run_cleanup (cxi_channel& server);
+   public:
+      bench_client (size_t index, const char* data,
+                    client_result& result);
+      void run (const string& host, in_port_t port, start_gate& gate);
+};
+
+bench_client::bench_client (size_t index_, const char* data_,
+                            client_result& result_):
+              index (index_), data (data_), result (result_),
+              random (index_ + 1), present (options.files) {
+}
+
+string bench_client::file_name (size_t slot) const {
+   return "cxibench-" + to_string (getpid()) + "-" + to_string (index)
+        + "-" + to_string (slot);
+}
+
+bench_op bench_client::pick_op() {
+   discrete_distribution<size_t> pick (begin (options.mix),
+                                       end (options.mix));
+   return bench_op (pick (random));
+}
+
+// A random file that is, or is not, present.  Returns files if there
+// is none.
+size_t bench_client::pick_file (bool want_present) {
+   vector<size_t> slots;
+   for (size_t slot = 0; slot < present.size(); ++slot) {
+      if (present[slot] == want_present) slots.push_back (slot);
+   }
+   if (slots.empty()) return present.size();
+   uniform_int_distribution<size_t> pick (0, slots.size() - 1);
+   return slots[pick (random)];
+}
+
+// Sizes are spread evenly over their logarithms, so that small files
+// are as common in each power of two as large ones.
+uint64_t bench_client::pick_size() {
+   if (options.min_size == options.max_size) return options.min_size;
+   uniform_real_distribution<double> pick (
+            log (double (options.min_size)),
+            log (double (options.max_size)));
+   return clamp<uint64_t> (llround (exp (pick (random))),
+                           options.min_size, options.max_size);
+}
+
+// Every file is put once, and the clock starts when every client
+// has done so.  All are removed once it stops.  In open loop,
+// requests are due at a fixed rate and latency runs from when each
+// was due, so a slow reply is charged for the requests it held up.
+// Requests still due when the clock stops are not sent.
+void bench_client::run (const string& host, in_port_t port,
+                        start_gate& gate) {
+   using clock = chrono::steady_clock;
+   client_socket socket (host, port);
+   cxi_channel server (socket);
+   uint64_t bytes = 0;
+   for (size_t slot = 0; slot < present.size(); ++slot) {
+      present[slot] = run_op (server, bench_op::PUT, file_name (slot),
+                              data, pick_size(), bytes);
+   }
+   if (not gate.arrive()) {
+      result.failure = "client " + to_string (index)
+                     + ": not ready when the clock started";
+      run_cleanup (server);
+      return;
+   }
+   auto start = clock::now();
+   result.start = start;
+   auto stop = start + chrono::duration_cast<clock::duration> (
+                       chrono::duration<double> (options.seconds));
+   auto interval = chrono::duration_cast<clock::duration> (
+                   chrono::duration<double> (options.rate > 0
+                   ? options.clients / options.rate : 0));
+   auto due = start;
+   result.bytes = 0;
+   for (;;) {
+      if (options.rate > 0) {
+         due += interval;
+         this_thread::sleep_until (due);
+      }else {
+         due = clock::now();
+      }
+      if (due >= stop or clock::now() >= stop) break;
+      bench_op op = pick_op();
+      size_t slot = present.size();
+      if (op == bench_op::GET or op == bench_op::RM) {
+         slot = pick_file (true);
+         if (slot == present.size()) op = bench_op::PUT;
+      }
+      if (op == bench_op::PUT) slot = pick_file (false);
+      if (op == bench_op::PUT and slot == present.size()) {
+         slot = pick_file (true);
+      }
+      bool ok = run_op (server, op, file_name (slot), data,
+                        pick_size(), result.bytes);
+      auto usec = chrono::duration_cast<chrono::microseconds> (
+                  clock::now() - due).count();
+      result.latency[size_t (op)].push_back (usec);
+      if (not ok) ++result.errors[size_t (op)];
+      if (op == bench_op::PUT) present[slot] = present[slot] or ok;
+      if (op == bench_op::RM and ok) present[slot] = false;
+   }
+   result.stop = clock::now();
+   run_cleanup (server);
+}
+
+void bench_client::run_cleanup (cxi_channel& server) {
+   uint64_t bytes = 0;
+   for (size_t slot = 0; slot < present.size(); ++slot) {
+      if (present[slot]) {
+         run_op (server, bench_op::RM, file_name (slot), data, 0,
+                 bytes);
+      }
+   }
+}
+
+// A client that fails before it is ready must not hold up the rest,
+// and one that fails while measuring stops there.
+void run_client (const string& host, in_port_t port, size_t index,
+                 const char* data, start_gate& gate,
+                 client_result& result) {
+   try {
+      bench_client client (index, data, result);
+      client.run (host, port, gate);
+   }catch (socket_error& error) {
+      result.failure = error.what();
+      using time_point = chrono::steady_clock::time_point;
+      if (result.start == time_point()) gate.leave();
+      else if (result.stop == time_point()) {
+         result.stop = chrono::steady_clock::now();
+      }
+   }
+}
+
+
+// Value at the given fraction of sorted latencies.
+uint64_t percentile (const vector<uint64_t>& sorted, double fraction) {
+   if (sorted.empty()) return 0;
+   size_t rank = ceil (fraction * sorted.size());
+   return sorted[clamp<size_t> (rank, 1, sorted.size()) - 1];
+}
+
+void print_row (const string& label, vector<uint64_t>& latency,
+                uint64_t errors) {
+   sort (latency.begin(), latency.end());
+   cout << setw (6) << label << setw (10) << latency.size()
+        << setw (8) << errors;
+   for (double fraction: {0.5, 0.99, 0.999}) {
+      cout << setw (9) << percentile (latency, fraction);
+   }
+   cout << setw (9) << (latency.empty() ? 0 : latency.back()) << endl;
+}
+
+// Seconds from when the first client started measuring to when the
+// last one stopped, or 0 if none did.
+double measured_seconds (const vector<client_result>& results) {
+   using time_point = chrono::steady_clock::time_point;
+   time_point start = time_point::max();
+   time_point stop = time_point::min();
+   for (const auto& result: results) {
+      if (result.start == time_point()) continue;
+      start = min (start, result.start);
+      stop = max (stop, result.stop);
+   }
+   if (stop <= start) return 0;
+   return chrono::duration<double> (stop - start).count();
+}
+
+void report (vector<client_result>& results) {
+   vector<uint64_t> all;
+   uint64_t all_errors = 0;
+   uint64_t bytes = 0;
+   cout << setw (6) << "op" << setw (10) << "count" << setw (8)
+        << "errors" << setw (9) << "p50" << setw (9) << "p99"
+        << setw (9) << "p999" << setw (9) << "max" << "  (usec)"
+        << endl;
+   for (size_t op = 0; op < NOPS; ++op) {
+      vector<uint64_t> latency;
+      uint64_t errors = 0;
+      for (auto& result: results) {
+         latency.insert (latency.end(), result.latency[op].begin(),
+                         result.latency[op].end());
+         errors += result.errors[op];
+      }
+      all.insert (all.end(), latency.begin(), latency.end());
+      all_errors += errors;
+      if (not latency.empty()) {
+         print_row (op_names[op], latency, errors);
+      }
+   }
+   print_row ("all", all, all_errors);
+   for (const auto& result: results) bytes += result.bytes;
+   double seconds = measured_seconds (results);
+   double per_second = seconds > 0 ? 1 / seconds : 0;
+   cout << fixed << setprecision (1) << "throughput "
+        << all.size() * per_second << " requests/s, "
+        << bytes * per_second / 1e6 << " MB/s over "
+        << setprecision (3) << seconds << " s" << endl;
+}
+
+
+void usage() {
+   cerr << "Usage: " << execname
+        << " [-c clients] [-d seconds] [-f files] [-m put:get:ls:rm]"
+        << " [-r rate] [-s size|min-max] host port" << endl;
+   exit (EXIT_FAILURE);
+}
+
+uint64_t get_size (const string& size_arg) {
+   uint64_t size = 0;
+   if (not parse_size (size_arg, size)) {
+      throw invalid_argument (size_arg);
+   }
+   return size;
+}
+
+void get_sizes (const string& sizes_arg) {
+   size_t dash = sizes_arg.find ('-');
+   options.min_size = get_size (sizes_arg.substr (0, dash));
+   options.max_size = dash == string::npos ? options.min_size
+                    : get_size (sizes_arg.substr (dash + 1));
+   if (options.min_size == 0 or options.max_size < options.min_size) {
+      throw invalid_argument (sizes_arg);
+   }
+}
+
+void get_mix (const string& mix_arg) {
+   size_t begin = 0;
+   unsigned total = 0;
+   for (size_t op = 0; op < NOPS; ++op) {
+      size_t end = mix_arg.find (':', begin);
+      if ((end == string::npos) != (op == NOPS - 1)) {
+         throw invalid_argument (mix_arg);
+      }
+      options.mix[op] = stoul (mix_arg.substr (begin, end - begin));
+      total += options.mix[op];
+      begin = end + 1;
+   }
+   if (total == 0) throw invalid_argument (mix_arg);
+}
+
+pair<string,in_port_t> scan_options (int argc, char** argv) {
+   try {
+      for (;;) {
+         int opt = getopt (argc, argv, "c:d:f:m:r:s:");
+         if (opt == EOF) break;
+         switch (opt) {
+            case 'c': options.clients = max (stoul (optarg), 1ul);
+                      break;
+            case 'd': options.seconds = stod (optarg);
+                      break;
+            case 'f': options.files = max (stoul (optarg), 1ul);
+                      break;
+            case 'm': get_mix (optarg);
+                      break;
+            case 'r': options.rate = stod (optarg);
+                      break;
+            case 's': get_sizes (optarg);
+                      break;
+            default:  usage();
+         }
+      }
+   }catch (logic_error&) { // invalid_argument and out_of_range
+      usage();
+   }
+   if (argc - optind != 2 or options.seconds <= 0) usage();
+   return {argv[optind], get_cxi_server_port (argv[optind + 1])};
+}
+
+int main (int argc, char** argv) {
+   execname = basename (argv[0]);
+   try {
+      auto [host, port] = scan_options (argc, argv);
+      auto data = make_unique<char[]> (options.max_size);
+      for (size_t index = 0; index < options.max_size; ++index) {
+         data[index] = char (index * 2654435761u >> 24);
+      }
+      cout << execname << ": " << options.clients << " clients, "
+           << (options.rate > 0 ? to_string (lround (options.rate))
+                                + "/s open"
+                                : string ("closed"))
+           << " loop, " << options.seconds << " s, sizes "
+           << options.min_size << "-" << options.max_size << endl;
+
+      start_gate gate (options.clients);
+      vector<client_result> results (options.clients);
+      vector<thread> clients;
+      for (size_t index = 0; index < options.clients; ++index) {
+         clients.emplace_back (run_client, cref (host), port, index,
+                               data.get(), ref (gate),
+                               ref (results[index]));
+      }
+      for (auto& client: clients) client.join();
+      for (const auto& result: results) {
+         if (not result.failure.empty()) {
+            cerr << execname << ": " << result.failure << endl;
+         }
+      }
+      report (results);
+   }catch (socket_error& error) {
+      cerr << execname << ": " << error.what() << endl;
+      return EXIT_FAILURE;
+   }
+   return EXIT_SUCCESS;
+}
+
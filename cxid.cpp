@@ -1,194 +1,680 @@
 // $Id: cxid.cpp,v 1.10 2021-11-16 16:11:40-08 - - $
 // SERVER
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 using namespace std;
 
+#include <fcntl.h>
 #include <libgen.h>
+#include <sys/epoll.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "compress.h"
 #include "debug.h"
+#include "delta.h"
+#include "durable.h"
+#include "eventloop.h"
+#include "filecache.h"
+#include "listing.h"
 #include "logstream.h"
 #include "protocol.h"
+#include "resolver.h"
 #include "socket.h"
-
-#include <fstream>
-
-# define BUFFER_SIZE 0x1000
+#include "stats.h"
+#include "store.h"
+#include "threadpool.h"
+#include "trace.h"
+#include "transfer.h"
 
 
 logstream outlog (cout);
 struct cxi_exit: public exception {};
 
+enum class server_mode { FORK, EPOLL, PREFORK, THREADS };
+server_mode cxid_mode = server_mode::FORK;
+int cxid_workers = 0; // 0 means one per core for prefork and threads
+size_t cxid_trace_events = 0; // 0 means not tracing
 
 
 
-ifstream read_file_into_buffer(const char* fn, char* buffer) {
-   ifstream ifs{ fn, istream::binary };
-   if (!ifs) {
-      return ifs;
-   }
 
-   ifs.seekg(0, ifs.end);
-   int len = ifs.tellg();
-   ifs.seekg(0, ifs.beg);
-   
-   ifs.read(buffer, len);
-   return ifs;
+// Receive nbytes of file data, and its checksums if negotiated,
+// into the file at offset, which must be its current offset.  With a
+// file_fd of -1 the data is thrown away.  Returns 0 or errno.
+int recv_file_payload (cxi_channel& client, int file_fd,
+                       uint64_t offset, uint64_t nbytes) {
+   bool compressed = client.recv_compressed();
+   trace_span span (trace_point::RECV_PAYLOAD, nbytes);
+   int error = 0;
+   if (file_fd < 0) {
+      if (compressed) recv_file_compressed (client.socket, -1, nbytes);
+                 else discard_payload (client.socket, nbytes);
+   }else {
+      error = compressed
+            ? recv_file_compressed (client.socket, file_fd, nbytes)
+            : recv_file (client.socket, file_fd, nbytes);
+   }
+   if (client.checksummed()) {
+      payload_crc sent = recv_crc (client.socket, nbytes);
+      if (file_fd >= 0 and error == 0) {
+         error = verify_file_crc (sent, file_fd, offset, nbytes);
+      }
+   }
+   return error;
 }
 
-ofstream write_file_from_buffer(const char* fn, const char* buffer, 
-      const uint32_t bytes) {
-   ofstream ofs{ fn, ostream::out | ostream::binary
-         | ostream::trunc };
-   if (ofs) {
-      ofs.write(buffer, bytes);
+// Receive the payload of a PUT into its file.  Returns 0 or errno.
+// The payload goes to a temporary file that replaces the old one, or
+// joins the store, only once it has all arrived intact.
+int recv_put (cxi_channel& client, cxi_header& header) {
+   uint64_t nbytes = client.recv_payload_size (header);
+   string filename (header.filename,
+                    strnlen (header.filename, FILENAME_SIZE));
+   string temp = temp_name (filename);
+   uint64_t open_start = trace_now();
+   open_file file (temp.c_str(), O_RDWR | O_CREAT | O_TRUNC);
+   int error = file.is_open() ? 0 : errno;
+   trace_record (trace_point::FILE_OPEN, open_start);
+   int payload_error = recv_file_payload (client, file.get(), 0,
+                                          nbytes);
+   if (error == 0) error = payload_error;
+   if (file.is_open()) {
+      if (error == 0) {
+         error = durable_commit (filename, temp, file);
+      }else {
+         file.close();
+         unlink (temp.c_str());
+      }
    }
-   return ofs;
+   touch_listing (filename);
+   cache_forget (filename.c_str());
+   return error;
 }
 
+// HAVE is answered from the store alone.  The PUT that follows a
+// NAK carries the payload.
+void reply_have (cxi_channel& client, cxi_header& header) {
+   uint64_t nbytes = client.recv_payload_size (header);
+   if (nbytes != sizeof (sha256_digest)) {
+      throw socket_error ("HAVE: payload is not a SHA-256");
+   }
+   sha256_digest digest;
+   recv_packet (client.socket, digest.data(), digest.size());
+   string filename (header.filename,
+                    strnlen (header.filename, FILENAME_SIZE));
+   int error = store_link (filename, digest);
+   DEBUGF ('a', "HAVE " << filename << " " << to_string (digest)
+           << ": " << strerror (error));
+   if (error == 0) {
+      touch_listing (filename);
+      cache_forget (filename.c_str());
+   }
+   memset (header.filename, 0, FILENAME_SIZE);
+   header.command = error != 0 ? cxi_command::NAK : cxi_command::ACK;
+   client.send_header (header, error);
+}
 
-
-
-void reply_put(accepted_socket& client_sock, cxi_header& header) {
-   // ASSUMING FILE FITS IN ONE BUFFER
-
-   uint32_t bytes = ntohl(header.nbytes);
-
-   char payload[BUFFER_SIZE];
-   recv_packet(client_sock, &payload, bytes);
-
-   ofstream ofs = write_file_from_buffer(header.filename, payload, 
-         bytes);
+void reply_put (cxi_channel& client, cxi_header& header) {
+   int error = recv_put (client, header);
 
    // send back
-   if (!ofs) {
+   memset(header.filename, 0, FILENAME_SIZE);
+   if (error != 0) {
       header.command = cxi_command::NAK;
-      header.nbytes = htonl(errno);
+      client.send_header (header, error);
    } else {
       header.command = cxi_command::ACK;
-      header.nbytes = htonl(0);
+      client.send_header (header, 0);
    }
-   memset(header.filename, 0, FILENAME_SIZE);
-   send_packet(client_sock, &header, sizeof header);
 }
 
-void reply_get(accepted_socket& client_sock, cxi_header& header) {
-   // ASSUMING FILE FITS IN ONE BUFFER
+void send_contents (cxi_channel& client, cxi_header& header,
+                    const string& contents) {
+   header.command = cxi_command::FILEOUT;
+   client.send_header (header, contents.size());
+   if (client.send_compressed()) {
+      send_buffer_compressed (client.socket, contents.data(),
+                              contents.size());
+   }else {
+      send_packet (client.socket, contents.data(), contents.size());
+   }
+   if (client.checksummed()) {
+      send_crc (client.socket,
+                buffer_crc (contents.data(), contents.size()));
+   }
+}
 
-   char payload[BUFFER_SIZE];
-   ifstream ifs = read_file_into_buffer(header.filename, payload);
+// Send FILEOUT and nbytes of the file from offset.  The checksum is
+// taken before the header goes out, so a file that cannot be read is
+// still answered with NAK.
+void send_file_payload (cxi_channel& client, cxi_header& header,
+                        int file_fd, uint64_t offset, uint64_t nbytes) {
+   payload_crc crc;
+   try {
+      if (offset != 0 and ::lseek (file_fd, offset, SEEK_SET) < 0) {
+         throw socket_sys_error ("lseek");
+      }
+      if (client.checksummed()) {
+         crc = file_crc (file_fd, offset, nbytes);
+      }
+   }catch (socket_sys_error& error) {
+      header.command = cxi_command::NAK;
+      client.send_header (header, error.sys_errno);
+      return;
+   }
+   header.command = cxi_command::FILEOUT;
+   trace_span span (trace_point::SEND_PAYLOAD, nbytes);
+   client.send_header (header, nbytes);
+   if (client.send_compressed()) {
+      send_file_compressed (client.socket, file_fd, nbytes);
+   }else {
+      send_file (client.socket, file_fd, nbytes);
+   }
+   if (client.checksummed()) send_crc (client.socket, crc);
+}
 
-   // send ACK header
-   if (!ifs) {
+// Send NAK, or a FILEOUT header followed by the file, from the
+// hot-file cache if it has the file or admits it now.
+void send_get (cxi_channel& client, cxi_header& header,
+               const char* filename) {
+   shared_ptr<const string> contents = cache_lookup (filename);
+   if (file_cache_budget > 0) stats_cache (contents != nullptr);
+   if (contents != nullptr) {
+      send_contents (client, header, *contents);
+      return;
+   }
+   uint64_t open_start = trace_now();
+   open_file file (filename, O_RDONLY);
+   uint64_t nbytes = 0;
+   int error = file.is_open() ? 0 : errno;
+   trace_record (trace_point::FILE_OPEN, open_start);
+   if (error == 0) {
+      try {
+         nbytes = file_size (file.get());
+      }catch (socket_sys_error& sys_error) {
+         error = sys_error.sys_errno;
+      }
+   }
+   if (error != 0) {
       header.command = cxi_command::NAK;
-      header.nbytes = htonl(errno);
+      client.send_header (header, error);
+   } else if ((contents = cache_admit (filename, file.get()))) {
+      send_contents (client, header, *contents);
    } else {
-      ifs.seekg(0, ifs.end);
-      int len = ifs.tellg();
-      ifs.seekg(0, ifs.beg);
-
-      header.command = cxi_command::FILEOUT;
-      header.nbytes = htonl(len);
+      send_file_payload (client, header, file.get(), 0, nbytes);
    }
+}
+
+void reply_get (cxi_channel& client, cxi_header& header) {
+   char filename[FILENAME_SIZE];
+   memcpy (filename, header.filename, FILENAME_SIZE);
    memset(header.filename, 0, FILENAME_SIZE);
-   send_packet(client_sock, &header, sizeof header);
+   send_get (client, header, filename);
+}
 
-   // send payload
-   if (!ifs) {
-      // don't send a payload
-   } else {
-      ifs.seekg(0, ifs.end);
-      int len = ifs.tellg(); 
-      ifs.seekg(0, ifs.beg);
+// Receive the range prefix of a GETRANGE or PUTAT.  Returns the
+// payload bytes that follow it.
+uint64_t recv_range (cxi_channel& client, cxi_header& header,
+                     uint64_t& offset, uint64_t& extent) {
+   uint64_t nbytes = client.recv_payload_size (header);
+   if (nbytes < RANGE_PREFIX_SIZE) {
+      throw socket_error (to_string (header.command)
+                          + ": payload too short for a range");
+   }
+   char prefix[RANGE_PREFIX_SIZE];
+   recv_packet (client.socket, prefix, sizeof prefix);
+   unpack_range (prefix, offset, extent);
+   return nbytes - RANGE_PREFIX_SIZE;
+}
+
+// Ranges go to the file rather than the hot-file cache, which only
+// helps whole-file GETs.
+void reply_getrange (cxi_channel& client, cxi_header& header) {
+   uint64_t offset = 0;
+   uint64_t length = 0;
+   if (recv_range (client, header, offset, length) != 0) {
+      throw socket_error ("GETRANGE: payload after the range");
+   }
+   string filename (header.filename,
+                    strnlen (header.filename, FILENAME_SIZE));
+   memset (header.filename, 0, FILENAME_SIZE);
+   open_file file (filename.c_str(), O_RDONLY);
+   uint64_t size = 0;
+   int error = file.is_open() ? 0 : errno;
+   if (error == 0) {
+      try {
+         size = file_size (file.get());
+      }catch (socket_sys_error& sys_error) {
+         error = sys_error.sys_errno;
+      }
+   }
+   if (error != 0) {
+      header.command = cxi_command::NAK;
+      client.send_header (header, error);
+      return;
+   }
+   offset = min (offset, size);
+   length = min (length, size - offset);
+   DEBUGF ('h', "GETRANGE " << filename << " " << offset << " "
+           << length);
+   send_file_payload (client, header, file.get(), offset, length);
+}
+
+void reply_putat (cxi_channel& client, cxi_header& header) {
+   uint64_t offset = 0;
+   uint64_t flags = 0;
+   uint64_t nbytes = recv_range (client, header, offset, flags);
+   int error = store_detach (header.filename);
+   open_file file (header.filename, O_RDWR | O_CREAT);
+   if (error == 0 and not file.is_open()) error = errno;
+   if (error == 0 and flags & PUTAT_APPEND) {
+      off_t end = ::lseek (file.get(), 0, SEEK_END);
+      if (end < 0) error = errno;
+              else offset = end;
+   }
+   if (error == 0 and ::lseek (file.get(), offset, SEEK_SET) < 0) {
+      error = errno;
+   }
+   int payload_error = recv_file_payload (
+                       client, error == 0 ? file.get() : -1,
+                       offset, nbytes);
+   if (error == 0) error = payload_error;
+   if (error == 0 and flags & PUTAT_TRUNCATE
+   and ::ftruncate (file.get(), offset + nbytes) < 0) {
+      error = errno;
+   }
+   if (error == 0) error = durable_data (file.get());
+   if (file.is_open()) {
+      int close_error = file.close();
+      if (error == 0) error = close_error;
+   }
+   if (error == 0) error = durable_name (header.filename);
+   touch_listing (header.filename);
+   cache_forget (header.filename);
+   memset (header.filename, 0, FILENAME_SIZE);
+   header.command = error != 0 ? cxi_command::NAK : cxi_command::ACK;
+   client.send_header (header, error);
+}
 
-      send_packet(client_sock, payload, len);
+// Answers SUM as well, with the checksum of the file as payload.
+void reply_size (cxi_channel& client, cxi_header& header) {
+   open_file file (header.filename, O_RDONLY);
+   bool sum = header.command == cxi_command::SUM;
+   memset (header.filename, 0, FILENAME_SIZE);
+   uint64_t size = 0;
+   uint32_t crc = 0;
+   int error = file.is_open() ? 0 : errno;
+   if (error == 0) {
+      try {
+         size = file_size (file.get());
+         if (sum) crc = file_crc (file.get(), 0, size).whole;
+      }catch (socket_sys_error& sys_error) {
+         error = sys_error.sys_errno;
+      }
+   }
+   if (error != 0) {
+      header.command = cxi_command::NAK;
+      client.send_header (header, error);
+   }else if (sum) {
+      header.command = cxi_command::ACK;
+      client.send_header (header, SUM_SIZE);
+      uint32_t wire_crc = htonl (crc);
+      send_packet (client.socket, &wire_crc, SUM_SIZE);
+   }else {
+      header.command = cxi_command::ACK;
+      client.send_header (header, size);
    }
 }
 
-void reply_rm(accepted_socket& client_sock, cxi_header& header) {
-   if (unlink(header.filename) != 0) {  // fail
+void reply_rm(cxi_channel& client, cxi_header& header) {
+   int error = unlink(header.filename) != 0 ? errno : 0;
+   touch_listing (header.filename);
+   cache_forget (header.filename);
+   memset(header.filename, 0, FILENAME_SIZE);
+   if (error != 0) {  // fail
       header.command = cxi_command::NAK;
-      header.nbytes = htonl(errno);
+      client.send_header (header, error);
    } else {  // success
       header.command = cxi_command::ACK;
-      header.nbytes = htonl(0);
+      client.send_header (header, 0);
    }
-   memset(header.filename, 0, FILENAME_SIZE);
-   send_packet(client_sock, &header, sizeof header);
 }
 
-void reply_ls (accepted_socket& client_sock, cxi_header& header) {
-   static const char ls_cmd[] = "ls -l 2>&1";
-   FILE* ls_pipe = popen (ls_cmd, "r");
-   if (ls_pipe == nullptr) { 
-      outlog << ls_cmd << ": " << strerror (errno) << endl;
+// A cached listing goes out in one send unless it needs tags.
+void reply_cached_ls (cxi_channel& client, cxi_header& header) {
+   int error = 0;
+   auto snapshot = cached_listing (ls_format (ntohl (header.nbytes)),
+                                   error);
+   memset (header.filename, 0, FILENAME_SIZE);
+   if (snapshot == nullptr) {
+      outlog << "ls: " << strerror (error) << endl;
       header.command = cxi_command::NAK;
-      header.nbytes = htonl (errno);
-      send_packet (client_sock, &header, sizeof header);
+      client.send_header (header, error);
       return;
    }
+   const string& frames = snapshot->frames;
+   if (not client.tagged()) {
+      send_packet (client.socket, frames.data(), frames.size());
+      return;
+   }
+   header.command = cxi_command::LSOUT;
+   for (const auto& [offset, nbytes]: snapshot->chunks) {
+      client.send_header (header, nbytes);
+      send_packet (client.socket, frames.data() + offset, nbytes);
+   }
+   client.send_header (header, 0);
+}
 
-   string ls_output;
-   char buffer[BUFFER_SIZE];
-   for (;;) {
-      char* rc = fgets (buffer, sizeof buffer, ls_pipe);
-      if (rc == nullptr) break;
-      ls_output.append (buffer);
+void reply_ls (cxi_channel& client, cxi_header& header) {
+   if (listing_cache) {
+      reply_cached_ls (client, header);
+      return;
+   }
+   listing dir (ls_format (ntohl (header.nbytes)));
+   memset (header.filename, 0, FILENAME_SIZE);
+   if (dir.get_error() != 0) { 
+      outlog << "ls: " << strerror (dir.get_error()) << endl;
+      header.command = cxi_command::NAK;
+      client.send_header (header, dir.get_error());
+      return;
    }
-   pclose (ls_pipe);
    
    header.command = cxi_command::LSOUT;
-   header.nbytes = htonl (ls_output.size());
+   string chunk;
+   for (bool more = true; more; ) {
+      chunk.clear();
+      more = dir.next_chunk (chunk, transfer_chunk_size);
+      if (chunk.empty()) continue;
+      DEBUGF ('h', "sending header " << header);
+      client.send_header (header, chunk.size());
+      send_packet (client.socket, chunk.data(), chunk.size());
+      DEBUGF ('h', "sent " << chunk.size() << " bytes");
+   }
+   if (dir.get_error() != 0) {
+      outlog << "ls: " << strerror (dir.get_error()) << endl;
+      header.command = cxi_command::NAK;
+      client.send_header (header, dir.get_error());
+      return;
+   }
+   client.send_header (header, 0);
+}
+
+
+// Batch replies.  Each frame names its file; names too long for a
+// header are refused with ENAMETOOLONG.
+
+bool set_batch_name (cxi_header& header, const string& name) {
    memset (header.filename, 0, FILENAME_SIZE);
-   DEBUGF ('h', "sending header " << header);
-   send_packet (client_sock, &header, sizeof header);
-   send_packet (client_sock, ls_output.c_str(), ls_output.size());
-   DEBUGF ('h', "sent " << ls_output.size() << " bytes");
+   strncpy (header.filename, name.c_str(), FILENAME_SIZE - 1);
+   return name.size() < FILENAME_SIZE;
 }
 
-
-void run_server (accepted_socket& client_sock) {
-   outlog.execname (outlog.execname() + "*");
-   outlog << "connected to " << to_string (client_sock) << endl;
+void send_batch_end (cxi_channel& client, cxi_header& header,
+                     size_t nfiles) {
+   memset (header.filename, 0, FILENAME_SIZE);
+   header.command = cxi_command::END;
+   client.send_header (header, nfiles);
+}
+
+vector<string> recv_batch_names (cxi_channel& client,
+                                 cxi_header& header) {
+   uint64_t nbytes = client.recv_payload_size (header);
+   if (nbytes > MAX_BATCH_NAMES) {
+      throw socket_error (to_string (client.socket)
+                          + ": batch name list too long");
+   }
+   string names (nbytes, '\0');
+   recv_packet (client.socket, names.data(), nbytes);
+   header.filename[FILENAME_SIZE - 1] = '\0';
+   return batch_names (header.filename, names);
+}
+
+void reply_mget (cxi_channel& client, cxi_header& header) {
+   vector<string> names = recv_batch_names (client, header);
+   for (const auto& name: names) {
+      if (set_batch_name (header, name)) {
+         send_get (client, header, header.filename);
+      }else {
+         header.command = cxi_command::NAK;
+         client.send_header (header, ENAMETOOLONG);
+      }
+   }
+   send_batch_end (client, header, names.size());
+}
+
+void reply_mrm (cxi_channel& client, cxi_header& header) {
+   vector<string> names = recv_batch_names (client, header);
+   for (const auto& name: names) {
+      int error = ENAMETOOLONG;
+      if (set_batch_name (header, name)) {
+         error = unlink (header.filename) != 0 ? errno : 0;
+         touch_listing (header.filename);
+         cache_forget (header.filename);
+      }
+      header.command = error != 0 ? cxi_command::NAK
+                                  : cxi_command::ACK;
+      client.send_header (header, error);
+   }
+   send_batch_end (client, header, names.size());
+}
+
+// All files are received before any result is sent, so a client
+// busy sending cannot fill the socket with results it is not yet
+// reading.
+void reply_mput (cxi_channel& client, cxi_header& header) {
+   vector<pair<string,int>> results;
+   for (;;) {
+      client.recv_header (header);
+      if (header.command == cxi_command::END) break;
+      if (header.command != cxi_command::PUT) {
+         throw socket_error ("MPUT: unexpected header "
+                             + to_string (header.command));
+      }
+      header.filename[FILENAME_SIZE - 1] = '\0';
+      results.emplace_back (header.filename, recv_put (client, header));
+   }
+   for (const auto& [name, error]: results) {
+      set_batch_name (header, name);
+      header.command = error != 0 ? cxi_command::NAK
+                                  : cxi_command::ACK;
+      client.send_header (header, error);
+   }
+   send_batch_end (client, header, results.size());
+}
+
+// Send the signatures of the file as it is now, then rebuild it from
+// the client's DELTA into a temporary file that replaces it only if
+// the result is intact.  A missing file has no blocks, so the delta
+// is all literal.
+void reply_dput (cxi_channel& client, cxi_header& header) {
+   string filename (header.filename,
+                    strnlen (header.filename, FILENAME_SIZE));
+   memset (header.filename, 0, FILENAME_SIZE);
+   open_file base (filename.c_str(), O_RDONLY);
+   uint64_t base_size = 0;
+   string signatures;
    try {
-      for (;;) {
-         cxi_header header; 
-         recv_packet (client_sock, &header, sizeof header);
-         DEBUGF ('h', "received header " << header);
-         switch (header.command) {
-            case cxi_command::PUT:
-               reply_put (client_sock, header);
-               break;
-            case cxi_command::RM:
-               reply_rm(client_sock, header);
-               break;
-            case cxi_command::GET:
-               reply_get(client_sock, header);
-               break;
-            case cxi_command::LS:
-               reply_ls(client_sock, header);
-               break;
-            default:
-               outlog << "invalid client header:" << header << endl;
-               break;
-         }
+      if (base.is_open()) base_size = file_size (base.get());
+      signatures = delta_signatures (base.get(), base_size);
+   }catch (socket_sys_error& error) {
+      header.command = cxi_command::NAK;
+      client.send_header (header, error.sys_errno);
+      return;
+   }
+   header.command = cxi_command::SIGS;
+   client.send_header (header, signatures.size());
+   send_packet (client.socket, signatures.data(), signatures.size());
+
+   client.recv_header (header);
+   if (header.command != cxi_command::DELTA) {
+      // the client gave up, e.g. it could no longer read its file
+      header.command = cxi_command::NAK;
+      client.send_header (header, ECANCELED);
+      return;
+   }
+   uint64_t nbytes = client.recv_payload_size (header);
+   string temp = temp_name (filename);
+   open_file out (temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC);
+   int error = out.is_open() ? 0 : errno;
+   int delta_error = recv_delta (client.socket, base.get(), base_size,
+                                 out.get(), nbytes);
+   if (error == 0) error = delta_error;
+   if (out.is_open()) {
+      if (error == 0) {
+         error = durable_commit (filename, temp, out);
+      }else {
+         out.close();
+         unlink (temp.c_str());
       }
+   }
+   touch_listing (filename);
+   cache_forget (filename.c_str());
+   memset (header.filename, 0, FILENAME_SIZE);
+   header.command = error != 0 ? cxi_command::NAK : cxi_command::ACK;
+   client.send_header (header, error);
+}
+
+void reply_stats (cxi_channel& client, cxi_header& header) {
+   string report = stats_report (stats_format (ntohl (header.nbytes)));
+   memset (header.filename, 0, FILENAME_SIZE);
+   client.send_header (header, report.size());
+   send_packet (client.socket, report.data(), report.size());
+}
+
+void reply_trace (cxi_channel& client, cxi_header& header) {
+   memset (header.filename, 0, FILENAME_SIZE);
+   if (not trace_enabled) {
+      header.command = cxi_command::NAK;
+      client.send_header (header, EOPNOTSUPP);
+      return;
+   }
+   string dump = trace_dump();
+   snprintf (header.filename, FILENAME_SIZE, "cxid-trace.%d",
+             int (getpid()));
+   client.send_header (header, dump.size());
+   send_packet (client.socket, dump.data(), dump.size());
+}
+
+// The ACK still uses the framing the client sent the HELLO with.
+// Replies to later requests use the features granted here.
+void reply_hello (cxi_channel& client, cxi_header& header) {
+   uint32_t granted = ntohl (header.nbytes) & CXI_FEATURES;
+   if (not (granted & CXI_FEATURE_TAGS)) granted = 0;
+   if (not store_enabled()) granted &= ~CXI_FEATURE_DEDUP;
+   memset (header.filename, 0, FILENAME_SIZE);
+   header.command = cxi_command::ACK;
+   client.send_header (header, granted);
+   client.features = granted;
+   DEBUGF ('h', "granted features " << granted);
+}
+
+
+// Serve one request.  Throws socket_error when the client leaves.
+// Requests are answered in the order they arrive, each reply tagged
+// with the request_id of its request.  A request counts as failed
+// in the statistics if any NAK is sent in reply.
+void serve_request (cxi_channel& client, byte_meter& meter) {
+   cxi_header header; 
+   {
+      trace_span span (trace_point::RECV_HEADER);
+      client.recv_header (header);
+   }
+   auto start = chrono::steady_clock::now();
+   cxi_command command = header.command;
+   trace_span request (trace_point::REQUEST);
+   request.command = command;
+   uint64_t naks_sent = client.naks_sent;
+   client.send_tag = client.recv_tag;
+   DEBUGF ('h', "received header " << header);
+   switch (header.command) {
+      case cxi_command::PUT:
+         reply_put (client, header);
+         break;
+      case cxi_command::RM:
+         reply_rm(client, header);
+         break;
+      case cxi_command::GET:
+         reply_get(client, header);
+         break;
+      case cxi_command::LS:
+         reply_ls(client, header);
+         break;
+      case cxi_command::HELLO:
+         reply_hello (client, header);
+         break;
+      case cxi_command::MGET:
+         reply_mget (client, header);
+         break;
+      case cxi_command::MPUT:
+         reply_mput (client, header);
+         break;
+      case cxi_command::MRM:
+         reply_mrm (client, header);
+         break;
+      case cxi_command::DPUT:
+         reply_dput (client, header);
+         break;
+      case cxi_command::GETRANGE:
+         reply_getrange (client, header);
+         break;
+      case cxi_command::PUTAT:
+         reply_putat (client, header);
+         break;
+      case cxi_command::SIZE:
+      case cxi_command::SUM:
+         reply_size (client, header);
+         break;
+      case cxi_command::HAVE:
+         reply_have (client, header);
+         break;
+      case cxi_command::STATS:
+         reply_stats (client, header);
+         break;
+      case cxi_command::TRACE:
+         reply_trace (client, header);
+         break;
+      default:
+         outlog << "invalid client header:" << header << endl;
+         break;
+   }
+   auto elapsed = chrono::steady_clock::now() - start;
+   stats_request (command, chrono::duration_cast<chrono::microseconds>
+                           (elapsed).count(),
+                  client.naks_sent != naks_sent);
+   meter.update (client.socket.get_socket_fd());
+}
+
+void run_server (accepted_socket& client_sock) {
+   LOGF (INFO, "connected to " << to_string (client_sock));
+   cxi_channel client (client_sock);
+   byte_meter meter;
+   stats_session_begin();
+   try {
+      for (;;) serve_request (client, meter);
    }catch (socket_error& error) {
       outlog << error.what() << endl;
    }catch (cxi_exit& error) {
       DEBUGF ('x', "caught cxi_exit");
    }
-   throw cxi_exit();
+   meter.update (client_sock.get_socket_fd());
+   stats_session_end();
 }
 
 void fork_cxiserver (server_socket& server, accepted_socket& accept) {
    pid_t pid = fork();
    if (pid == 0) { // child
       server.close();
+      background_lookup = false;
+      outlog.execname (outlog.execname() + "*");
       run_server (accept);
       throw cxi_exit();
    }else {
@@ -196,7 +682,7 @@ void fork_cxiserver (server_socket& server, accepted_socket& accept) {
       if (pid < 0) {
          outlog << "fork failed: " << strerror (errno) << endl;
       }else {
-         outlog << "forked cxiserver pid " << pid << endl;
+         LOGF (INFO, "forked cxiserver pid " << pid);
       }
    }
 }
@@ -216,16 +702,25 @@ void reap_zombies() {
    }
 }
 
-void signal_handler (int signal) {
-   DEBUGF ('s', "signal_handler: caught " << strsignal (signal));
-   reap_zombies();
+// Logging takes a lock the interrupted code may hold, so the handler
+// only notes that children have exited, and the accept loop, which
+// the signal interrupts, reaps and logs them.
+volatile sig_atomic_t children_exited = 0;
+
+void signal_handler (int) {
+   children_exited = 1;
+}
+
+// SIGUSR2 dumps the trace of the process that gets it.
+void trace_signal (int) {
+   trace_dump_file ("cxid-trace");
 }
 
-void signal_action (int signal, void (*handler) (int)) {
+void signal_action (int signal, void (*handler) (int), int flags = 0) {
    struct sigaction action;
    action.sa_handler = handler;
    sigfillset (&action.sa_mask);
-   action.sa_flags = 0;
+   action.sa_flags = flags;
    int rc = sigaction (signal, &action, nullptr);
    if (rc < 0) outlog << "sigaction " << strsignal (signal)
                       << " failed: " << strerror (errno) << endl;
@@ -234,54 +729,342 @@ void signal_action (int signal, void (*handler) (int)) {
 
 
 void usage() {
-   cerr << "Usage: " << outlog.execname() << " port" << endl;
+   cerr << "Usage: " << outlog.execname()
+        << " [-Lnuz] [-c chunksize] [-r copy|splice|mmap]"
+        << " [-C cachebytes] [-A always|second] [-D storedir]"
+        << " [-s none|fsync|group] [-G groupusec] [-T traceevents]"
+        << " [-m fork|epoll|prefork|threads] [-w workers] port"
+        << endl;
    throw cxi_exit();
 }
 
+server_mode get_server_mode (const string& mode_arg) {
+   if (mode_arg == "fork") return server_mode::FORK;
+   if (mode_arg == "epoll") return server_mode::EPOLL;
+   if (mode_arg == "prefork") return server_mode::PREFORK;
+   if (mode_arg == "threads") return server_mode::THREADS;
+   throw socket_error (mode_arg + ": invalid server mode");
+}
+
+int get_workers (const string& workers_arg) {
+   auto error = socket_error (workers_arg + ": invalid worker count");
+   try {
+      int workers = stoi (workers_arg);
+      if (workers < 1) throw error;
+      return workers;
+   }catch (invalid_argument&) { // thrown by stoi
+      throw error;
+   }catch (out_of_range&) { // thrown by stoi
+      throw error;
+   }
+}
+
 in_port_t scan_options (int argc, char** argv) {
    for (;;) {
-      int opt = getopt (argc, argv, "@:");
+      int opt = getopt (argc, argv, "@:A:C:D:G:LT:c:m:nr:s:uw:z");
       if (opt == EOF) break;
       switch (opt) {
          case '@': debugflags::setflags (optarg);
+                   outlog.buffered (false); // keep order with traces
+                   break;
+         case 'A': file_cache_admit = get_admit_policy (optarg);
+                   break;
+         case 'C': file_cache_budget = get_cache_budget (optarg);
+                   break;
+         case 'D': store_dir = optarg;
+                   break;
+         case 'G': group_commit_usec = get_group_usec (optarg);
+                   break;
+         case 'L': listing_cache = false;
+                   break;
+         case 'T': cxid_trace_events = get_trace_events (optarg);
+                   break;
+         case 'c': transfer_chunk_size = get_chunk_size (optarg);
+                   break;
+         case 'm': cxid_mode = get_server_mode (optarg);
+                   break;
+         case 'n': reverse_lookup = false;
+                   break;
+         case 'r': transfer_recv_mode = get_recv_mode (optarg);
+                   break;
+         case 's': put_durability = get_durability (optarg);
+                   break;
+         case 'u': transfer_io_uring = true;
+                   break;
+         case 'w': cxid_workers = get_workers (optarg);
+                   break;
+         case 'z': transfer_sendfile = true;
                    break;
       }
    }
    if (argc - optind != 1) usage();
+   // a child that serves one connection would build the caches, and
+   // set up inotify, only to throw them away
+   if (cxid_mode == server_mode::FORK) {
+      listing_cache = false;
+      file_cache_budget = 0;
+   }
+   // the store copies and hashes whole files, which an event loop
+   // cannot do without stalling every connection it serves
+   if (cxid_mode == server_mode::EPOLL and store_enabled()) {
+      throw socket_error ("-D storedir is not supported with -m epoll");
+   }
+   // nor can it read a file whole into the hot-file cache
+   if (cxid_mode == server_mode::EPOLL and file_cache_budget > 0) {
+      throw socket_error ("-C cachebytes is not supported with "
+                          "-m epoll");
+   }
+   // nor can it wait for a file to be synced, alone or in a group
+   if (cxid_mode == server_mode::EPOLL
+   and put_durability != durability::NONE) {
+      throw socket_error ("-s fsync|group is not supported with "
+                          "-m epoll");
+   }
    return get_cxi_server_port (argv[optind]);
 }
 
+// The server's own name is looked up once, so that accepting never
+// waits on the resolver.
+void fork_server (server_socket& listener, in_port_t port) {
+   string server_name = to_string (hostinfo());
+   for (;;) {
+      outlog << server_name << " accepting port "
+          << to_string (port) << endl;
+      accepted_socket client_sock;
+      for (;;) {
+         try {
+            listener.accept (client_sock);
+            break;
+         }catch (socket_sys_error& error) {
+            switch (error.sys_errno) {
+               case EINTR:
+                  outlog << "listener.accept caught "
+                      << strerror (EINTR) << endl;
+                  if (children_exited) {
+                     children_exited = 0;
+                     reap_zombies();
+                  }
+                  break;
+               default:
+                  throw;
+            }
+         }
+      }
+      // named here, so the lookup it starts outlives the child
+      string client_name = to_string (client_sock);
+      LOGF (INFO, "accepted " << client_name);
+      try {
+         fork_cxiserver (listener, client_sock);
+         reap_zombies();
+      }catch (socket_error& error) {
+         outlog << error.what() << endl;
+      }
+   }
+}
+
+
+// Pre-forked workers each bind their own listener with SO_REUSEPORT,
+// so the kernel spreads incoming connections across them, and each
+// worker serves its clients one after another.  The supervisor only
+// waits for workers to die and replaces them.
+
+void prefork_worker (in_port_t port) {
+   outlog.execname (outlog.execname() + "*");
+   server_socket listener (port, true);
+   for (;;) {
+      accepted_socket client_sock;
+      try {
+         listener.accept (client_sock);
+      }catch (socket_sys_error& error) {
+         if (error.sys_errno == EINTR) continue;
+         if (error.sys_errno == ECONNABORTED) continue;
+         throw;
+      }
+      run_server (client_sock);
+   }
+}
+
+pid_t spawn_worker (in_port_t port) {
+   pid_t pid = fork();
+   if (pid == 0) { // child
+      try {
+         prefork_worker (port);
+      }catch (socket_error& error) {
+         outlog << error.what() << endl;
+      }
+      throw cxi_exit();
+   }
+   if (pid < 0) {
+      outlog << "fork failed: " << strerror (errno) << endl;
+   }else {
+      outlog << "forked worker pid " << pid << endl;
+   }
+   return pid;
+}
+
+void prefork_server (in_port_t port, int nworkers) {
+   constexpr time_t MIN_LIFETIME = 1; // seconds before a respawn
+   signal_action (SIGCHLD, SIG_DFL);
+   outlog << to_string (hostinfo()) << " " << nworkers
+          << " workers on port " << to_string (port) << endl;
+   unordered_map<pid_t,time_t> workers;
+   while (workers.size() < size_t (nworkers)) {
+      pid_t pid = spawn_worker (port);
+      if (pid < 0) sleep (MIN_LIFETIME);
+              else workers[pid] = time (nullptr);
+   }
+   for (;;) {
+      int status;
+      pid_t child = waitpid (-1, &status, 0);
+      if (child < 0) {
+         if (errno == EINTR) continue;
+         throw socket_sys_error ("waitpid");
+      }
+      auto itor = workers.find (child);
+      if (itor == workers.end()) continue;
+      outlog << "worker " << child
+             << " exit " << (status >> 8 & 0xFF)
+             << " signal " << (status & 0x7F)
+             << " core " << (status >> 7 & 1) << endl;
+      // a worker that dies at once probably cannot bind or accept
+      if (time (nullptr) - itor->second < MIN_LIFETIME) {
+         sleep (MIN_LIFETIME);
+      }
+      workers.erase (itor);
+      pid_t pid;
+      while ((pid = spawn_worker (port)) < 0) sleep (MIN_LIFETIME);
+      workers[pid] = time (nullptr);
+   }
+}
+
+// In threads mode, sessions share one process.  The main thread
+// waits with epoll for a client to send a request, then hands that
+// session to the thread pool to serve one request.  EPOLLONESHOT
+// keeps the socket out of epoll until the request is done, so only
+// one worker at a time serves a session, and an idle client ties up
+// no thread.
+
+struct session {
+   accepted_socket socket;
+   cxi_channel channel {socket};
+   byte_meter meter;
+};
+
+atomic<int> active_sessions {0};
+
+void rearm_session (int epoll_fd, session* sess) {
+   epoll_event event {};
+   event.events = EPOLLIN | EPOLLONESHOT;
+   event.data.ptr = sess;
+   int status = ::epoll_ctl (epoll_fd, EPOLL_CTL_MOD,
+                             sess->socket.get_socket_fd(), &event);
+   if (status < 0) throw socket_sys_error ("epoll_ctl");
+}
+
+// Whatever a request throws, such as bad_alloc for a size a client
+// sent, ends only its own session, not the pool's worker.
+void serve_session (int epoll_fd, session* sess) {
+   try {
+      serve_request (sess->channel, sess->meter);
+      rearm_session (epoll_fd, sess);
+   }catch (exception& error) {
+      outlog << error.what() << endl;
+      delete sess;
+      --active_sessions;
+      stats_session_end();
+   }
+}
+
+void thread_server (server_socket& listener, int nthreads) {
+   signal_action (SIGCHLD, SIG_DFL);
+   int epoll_fd = ::epoll_create1 (EPOLL_CLOEXEC);
+   if (epoll_fd < 0) throw socket_sys_error ("epoll_create1");
+   epoll_event event {};
+   event.events = EPOLLIN;
+   event.data.ptr = &listener;
+   int status = ::epoll_ctl (epoll_fd, EPOLL_CTL_ADD,
+                             listener.get_socket_fd(), &event);
+   if (status < 0) throw socket_sys_error ("epoll_ctl");
+   thread_pool pool (nthreads);
+   outlog << "session pool of " << pool.size() << " threads" << endl;
+   constexpr int MAX_EVENTS = 256;
+   epoll_event events[MAX_EVENTS];
+   for (;;) {
+      int nready = ::epoll_wait (epoll_fd, events, MAX_EVENTS, -1);
+      if (nready < 0) {
+         if (errno == EINTR) continue;
+         throw socket_sys_error ("epoll_wait");
+      }
+      for (int index = 0; index < nready; ++index) {
+         if (events[index].data.ptr != &listener) {
+            auto sess = static_cast<session*> (events[index].data.ptr);
+            pool.submit ([epoll_fd, sess] {
+               serve_session (epoll_fd, sess);
+            });
+            continue;
+         }
+         auto sess = make_unique<session>();
+         try {
+            listener.accept (sess->socket);
+         }catch (socket_sys_error& error) {
+            outlog << "listener.accept: " << error.what() << endl;
+            continue;
+         }
+         event.events = EPOLLIN | EPOLLONESHOT;
+         event.data.ptr = sess.get();
+         status = ::epoll_ctl (epoll_fd, EPOLL_CTL_ADD,
+                               sess->socket.get_socket_fd(), &event);
+         if (status < 0) throw socket_sys_error ("epoll_ctl");
+         int sessions = ++active_sessions;
+         LOGF (INFO, "accepted " << to_string (sess->socket)
+                     << ", " << sessions << " sessions");
+         stats_session_begin();
+         sess.release();
+      }
+   }
+}
+
 int main (int argc, char** argv) {
    outlog.execname (basename (argv[0]));
+   outlog.buffered (true);
    signal_action (SIGCHLD, signal_handler);
+   signal_action (SIGPIPE, SIG_IGN); // sendfile has no MSG_NOSIGNAL
    try {
       in_port_t port = scan_options (argc, argv);
-      server_socket listener (port);
-      for (;;) {
-         outlog << to_string (hostinfo()) << " accepting port "
-             << to_string (port) << endl;
-         accepted_socket client_sock;
-         for (;;) {
-            try {
-               listener.accept (client_sock);
-               break;
-            }catch (socket_sys_error& error) {
-               switch (error.sys_errno) {
-                  case EINTR:
-                     outlog << "listener.accept caught "
-                         << strerror (EINTR) << endl;
-                     break;
-                  default:
-                     throw;
-               }
-            }
+      if (store_enabled()) {
+         size_t removed = store_open (store_dir);
+         outlog << "store " << store_dir << ": removed " << removed
+                << " unused copies" << endl;
+      }
+      if (put_durability == durability::GROUP) durable_init();
+      stats_init();
+      if (cxid_trace_events > 0) {
+         trace_init (cxid_trace_events);
+         // a dump must not cut short a transfer in progress
+         signal_action (SIGUSR2, trace_signal, SA_RESTART);
+      }
+      switch (cxid_mode) {
+         case server_mode::FORK: {
+            server_socket listener (port);
+            fork_server (listener, port);
+            break;
          }
-         outlog << "accepted " << to_string (client_sock) << endl;
-         try {
-            fork_cxiserver (listener, client_sock);
-            reap_zombies();
-         }catch (socket_error& error) {
-            outlog << error.what() << endl;
+         case server_mode::EPOLL: {
+            server_socket listener (port);
+            outlog << to_string (hostinfo()) << " event loops on port "
+                   << to_string (port) << endl;
+            run_event_loops (listener, max (cxid_workers, 1));
+            break;
+         }
+         case server_mode::PREFORK:
+            prefork_server (port, cxid_workers > 0 ? cxid_workers
+                                  : sysconf (_SC_NPROCESSORS_ONLN));
+            break;
+         case server_mode::THREADS: {
+            server_socket listener (port);
+            thread_server (listener, cxid_workers > 0 ? cxid_workers
+                                     : sysconf (_SC_NPROCESSORS_ONLN));
+            break;
          }
       }
    }catch (socket_error& error) {
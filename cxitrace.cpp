@@ -0,0 +1,97 @@
+// $Id: cxitrace.cpp,v 1.1 2026-10-17 03:20:17-07 - - $
+// convert cxid trace dumps to Chrome trace JSON
+
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <libgen.h>
+
+#include "protocol.h"
+#include "trace.h"
+
+string execname;
+
+//
+// struct tick_scale
+// ticks to microseconds of CLOCK_MONOTONIC, from the two points in
+// a dump where both were read
+//
+
+struct tick_scale {
+   double ns_per_tick {1};
+   uint64_t base_ticks {0};
+   uint64_t base_ns {0};
+   explicit tick_scale (const trace_dump_header& header):
+            base_ticks (header.base_ticks), base_ns (header.base_ns) {
+      if (header.dump_ticks > header.base_ticks) {
+         ns_per_tick = double (header.dump_ns - header.base_ns)
+                     / (header.dump_ticks - header.base_ticks);
+      }
+   }
+   double usec (uint64_t ticks) const {
+      return (base_ns + (double (ticks) - base_ticks)
+                        * ns_per_tick) / 1000;
+   }
+   double span_usec (uint64_t ticks) const {
+      return ticks * ns_per_tick / 1000;
+   }
+};
+
+// A request is named for its command, and the spans within it for
+// what they did.
+string event_name (const trace_event& event) {
+   if (event.point == trace_point::REQUEST) {
+      return to_string (event.command);
+   }
+   return to_string (event.point);
+}
+
+void print_event (ostream& out, const trace_event& event,
+                  const tick_scale& scale, uint32_t pid) {
+   out << "{\"name\":\"" << event_name (event) << "\",\"cat\":\""
+       << (event.point == trace_point::REQUEST ? "request" : "span")
+       << "\",\"ph\":\"X\",\"ts\":" << scale.usec (event.start)
+       << ",\"dur\":" << scale.span_usec (event.ticks)
+       << ",\"pid\":" << pid << ",\"tid\":" << event.tid
+       << ",\"args\":{\"arg\":" << event.arg << "}}";
+}
+
+int main (int argc, char** argv) {
+   execname = basename (argv[0]);
+   if (argc < 2) {
+      cerr << "Usage: " << execname << " dumpfile..." << endl;
+      return EXIT_FAILURE;
+   }
+   int status = EXIT_SUCCESS;
+   bool first = true;
+   cout << fixed << setprecision (3) << "{\"traceEvents\":[" << endl;
+   for (int argi = 1; argi < argc; ++argi) {
+      ifstream file (argv[argi], ios::binary);
+      ostringstream contents;
+      contents << file.rdbuf();
+      trace_dump_header header;
+      vector<trace_event> events;
+      if (not file.is_open()
+      or not trace_parse (contents.str(), header, events)) {
+         cerr << execname << ": " << argv[argi]
+              << ": not a trace dump" << endl;
+         status = EXIT_FAILURE;
+         continue;
+      }
+      tick_scale scale (header);
+      for (const auto& event: events) {
+         if (not first) cout << "," << endl;
+         print_event (cout, event, scale, header.pid);
+         first = false;
+      }
+   }
+   cout << endl << "],\"displayTimeUnit\":\"ns\"}" << endl;
+   return status;
+}
+
@@ -0,0 +1,438 @@
+// $Id: delta.cpp,v 1.1 2026-10-16 21:41:03-07 - - $
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "debug.h"
+#include "delta.h"
+#include "protocol.h"
+#include "sha256.h"
+#include "transfer.h"
+
+// Blocks are the power of two nearest above the square root of the
+// size, as with rsync, so the signatures grow only with its root.
+static constexpr uint32_t MIN_BLOCK_SIZE = 0x400;
+static constexpr uint32_t MAX_BLOCK_SIZE = 0x100000;
+
+static constexpr size_t SIGNATURE_HEADER_SIZE = 16;
+static constexpr size_t SIGNATURE_SIZE = 4 + sizeof (sha256_digest);
+static constexpr size_t DELTA_HEADER_SIZE = 16;
+static constexpr size_t OP_SIZE = 12;
+
+enum class delta_op : uint32_t { LITERAL, COPY };
+
+static uint32_t block_size_for (uint64_t size) {
+   uint64_t block_size = MIN_BLOCK_SIZE;
+   while (block_size * block_size < size
+          and block_size < MAX_BLOCK_SIZE) block_size <<= 1;
+   return block_size;
+}
+
+static uint64_t block_count (uint64_t size, uint32_t block_size) {
+   return (size + block_size - 1) / block_size;
+}
+
+static void append_u32 (string& buffer, uint32_t value) {
+   value = htonl (value);
+   buffer.append (reinterpret_cast<const char*> (&value),
+                  sizeof value);
+}
+
+static void append_u64 (string& buffer, uint64_t value) {
+   append_u32 (buffer, value >> 32);
+   append_u32 (buffer, value);
+}
+
+static uint32_t load_u32 (const char* bytes) {
+   uint32_t value;
+   memcpy (&value, bytes, sizeof value);
+   return ntohl (value);
+}
+
+static uint64_t load_u64 (const char* bytes) {
+   return uint64_t (load_u32 (bytes)) << 32 | load_u32 (bytes + 4);
+}
+
+//
+// class rolling_checksum
+// The rsync weak checksum of a window, which can slide along by one
+// byte at a time without looking at the rest of the window.
+//
+
+class rolling_checksum {
+   private:
+      uint32_t sum {0};
+      uint32_t weighted {0};
+      uint32_t length {0};
+   public:
+      void reset (const uint8_t* data, size_t size) {
+         sum = weighted = 0;
+         length = size;
+         for (size_t index = 0; index < size; ++index) {
+            sum += data[index];
+            weighted += (size - index) * data[index];
+         }
+      }
+      void roll (uint8_t out, uint8_t in) {
+         sum += in - out;
+         weighted += sum - length * out;
+      }
+      uint32_t value() const {
+         return (sum & 0xFFFF) | weighted << 16;
+      }
+};
+
+string delta_signatures (int file_fd, uint64_t base_size) {
+   uint32_t block_size = block_size_for (base_size);
+   uint64_t count = block_count (base_size, block_size);
+   string signatures;
+   signatures.reserve (SIGNATURE_HEADER_SIZE + count * SIGNATURE_SIZE);
+   append_u32 (signatures, block_size);
+   append_u32 (signatures, count);
+   append_u64 (signatures, base_size);
+   auto block = make_unique<uint8_t[]> (block_size);
+   for (uint64_t offset = 0; offset < base_size; offset += block_size) {
+      size_t size = min<uint64_t> (block_size, base_size - offset);
+      for (size_t done = 0; done < size; ) {
+         ssize_t nread = ::pread (file_fd, block.get() + done,
+                                  size - done, offset + done);
+         if (nread < 0 and errno == EINTR) continue;
+         if (nread < 0) throw socket_sys_error ("pread");
+         if (nread == 0) {
+            errno = ESTALE;
+            throw socket_sys_error ("pread: file truncated");
+         }
+         done += nread;
+      }
+      rolling_checksum weak;
+      weak.reset (block.get(), size);
+      append_u32 (signatures, weak.value());
+      sha256_digest strong = sha256_of (block.get(), size);
+      signatures.append (reinterpret_cast<const char*> (strong.data()),
+                         strong.size());
+   }
+   DEBUGF ('d', "signatures of " << base_size << " bytes in "
+           << count << " blocks of " << block_size);
+   return signatures;
+}
+
+
+//
+// class signature_set
+// Signatures received from the server, looked up by weak checksum.
+//
+
+class signature_set {
+   private:
+      vector<sha256_digest> strong;
+      unordered_multimap<uint32_t,uint32_t> by_weak;
+   public:
+      uint32_t block_size {0};
+      uint64_t base_size {0};
+      explicit signature_set (const string& signatures);
+      size_t block_length (uint32_t index) const {
+         uint64_t offset = uint64_t (index) * block_size;
+         return min<uint64_t> (block_size, base_size - offset);
+      }
+      // Index of a block with these contents, or -1.
+      int64_t find (uint32_t weak, const uint8_t* data,
+                    size_t size) const;
+};
+
+signature_set::signature_set (const string& signatures) {
+   auto error = socket_error ("DPUT: malformed signatures");
+   if (signatures.size() < SIGNATURE_HEADER_SIZE) throw error;
+   block_size = load_u32 (signatures.data());
+   uint32_t count = load_u32 (signatures.data() + 4);
+   base_size = load_u64 (signatures.data() + 8);
+   if (block_size < MIN_BLOCK_SIZE or block_size > MAX_BLOCK_SIZE
+   or count != block_count (base_size, block_size)
+   or signatures.size() != SIGNATURE_HEADER_SIZE
+                           + uint64_t (count) * SIGNATURE_SIZE) {
+      throw error;
+   }
+   strong.resize (count);
+   by_weak.reserve (count);
+   const char* record = signatures.data() + SIGNATURE_HEADER_SIZE;
+   for (uint32_t index = 0; index < count; ++index) {
+      by_weak.emplace (load_u32 (record), index);
+      memcpy (strong[index].data(), record + 4, strong[index].size());
+      record += SIGNATURE_SIZE;
+   }
+}
+
+int64_t signature_set::find (uint32_t weak, const uint8_t* data,
+                             size_t size) const {
+   auto range = by_weak.equal_range (weak);
+   if (range.first == range.second) return -1;
+   sha256_digest digest = sha256_of (data, size);
+   for (auto itor = range.first; itor != range.second; ++itor) {
+      uint32_t index = itor->second;
+      if (block_length (index) == size and strong[index] == digest) {
+         return index;
+      }
+   }
+   return -1;
+}
+
+//
+// class delta_writer
+// Buffers ops and sends them a transfer chunk at a time.  Copies of
+// consecutive blocks are merged into one op.
+//
+
+class delta_writer {
+   private:
+      base_socket& socket;
+      const signature_set& base;
+      string buffer;
+      uint32_t copy_first {0};
+      uint32_t copy_count {0};
+      void append_op (delta_op kind, uint32_t first, uint32_t count);
+      void flush_copy();
+      void send_full();
+   public:
+      delta_stats stats;
+      delta_writer (base_socket& socket, const signature_set& base);
+      void literal (const uint8_t* data, size_t size);
+      void copy (uint32_t index);
+      void finish (const sha256_digest& digest);
+};
+
+delta_writer::delta_writer (base_socket& socket_,
+                            const signature_set& base_):
+              socket (socket_), base (base_) {
+   append_u32 (buffer, base.block_size);
+   append_u32 (buffer, 0);
+   append_u64 (buffer, base.base_size);
+}
+
+void delta_writer::append_op (delta_op kind, uint32_t first,
+                              uint32_t count) {
+   append_u32 (buffer, uint32_t (kind));
+   append_u32 (buffer, first);
+   append_u32 (buffer, count);
+}
+
+void delta_writer::flush_copy() {
+   if (copy_count == 0) return;
+   append_op (delta_op::COPY, copy_first, copy_count);
+   copy_count = 0;
+   send_full();
+}
+
+void delta_writer::send_full() {
+   if (buffer.size() < transfer_chunk_size) return;
+   send_packet (socket, buffer.data(), buffer.size());
+   buffer.clear();
+}
+
+void delta_writer::literal (const uint8_t* data, size_t size) {
+   flush_copy();
+   stats.literal_bytes += size;
+   while (size > 0) {
+      size_t piece = min (size, transfer_chunk_size);
+      append_op (delta_op::LITERAL, 0, piece);
+      buffer.append (reinterpret_cast<const char*> (data), piece);
+      send_full();
+      data += piece;
+      size -= piece;
+   }
+}
+
+void delta_writer::copy (uint32_t index) {
+   stats.copied_bytes += base.block_length (index);
+   if (copy_count > 0 and copy_first + copy_count == index) {
+      ++copy_count;
+      return;
+   }
+   flush_copy();
+   copy_first = index;
+   copy_count = 1;
+}
+
+void delta_writer::finish (const sha256_digest& digest) {
+   flush_copy();
+   buffer.append (reinterpret_cast<const char*> (digest.data()),
+                  digest.size());
+   send_packet (socket, buffer.data(), buffer.size());
+   buffer.clear();
+}
+
+//
+// class file_mapping
+// A read-only mapping of a whole file, unmapped when it goes out of
+// scope.
+//
+
+class file_mapping {
+   private:
+      void* address {nullptr};
+      size_t size {0};
+   public:
+      file_mapping (int file_fd, size_t size);
+      file_mapping (const file_mapping&) = delete;
+      file_mapping& operator= (const file_mapping&) = delete;
+      ~file_mapping() { if (address) ::munmap (address, size); }
+      const uint8_t* data() const {
+         return static_cast<const uint8_t*> (address);
+      }
+};
+
+file_mapping::file_mapping (int file_fd, size_t size_): size (size_) {
+   if (size == 0) return;
+   address = ::mmap (nullptr, size, PROT_READ, MAP_PRIVATE, file_fd, 0);
+   if (address == MAP_FAILED) {
+      address = nullptr;
+      throw socket_sys_error ("mmap");
+   }
+   ::madvise (address, size, MADV_SEQUENTIAL);
+}
+
+delta_stats send_delta (base_socket& socket, const string& signatures,
+                        int file_fd, uint64_t nbytes) {
+   signature_set base (signatures);
+   file_mapping mapping (file_fd, nbytes);
+   const uint8_t* data = mapping.data();
+   delta_writer writer (socket, base);
+   size_t block_size = base.block_size;
+   uint64_t literal_start = 0;
+   uint64_t position = 0;
+   rolling_checksum weak;
+   bool rolling = false;
+   if (base.base_size > 0) {
+      while (position + block_size <= nbytes) {
+         if (not rolling) weak.reset (data + position, block_size);
+         rolling = true;
+         int64_t index = base.find (weak.value(), data + position,
+                                    block_size);
+         if (index >= 0) {
+            writer.literal (data + literal_start,
+                            position - literal_start);
+            writer.copy (index);
+            position += block_size;
+            literal_start = position;
+            rolling = false;
+            continue;
+         }
+         if (position + block_size < nbytes) {
+            weak.roll (data[position], data[position + block_size]);
+         }
+         ++position;
+      }
+      // the copy's last block may be short, so try the same tail
+      uint32_t last = block_count (base.base_size, block_size) - 1;
+      size_t last_size = base.block_length (last);
+      if (last_size < block_size and nbytes >= last_size
+      and nbytes - last_size >= literal_start) {
+         uint64_t tail = nbytes - last_size;
+         weak.reset (data + tail, last_size);
+         if (base.find (weak.value(), data + tail, last_size) == last) {
+            writer.literal (data + literal_start, tail - literal_start);
+            writer.copy (last);
+            literal_start = nbytes;
+         }
+      }
+   }
+   writer.literal (data + literal_start, nbytes - literal_start);
+   writer.finish (sha256_of (data, nbytes));
+   DEBUGF ('d', "delta of " << nbytes << " bytes: "
+           << writer.stats.literal_bytes << " literal, "
+           << writer.stats.copied_bytes << " copied");
+   return writer.stats;
+}
+
+
+//
+// Receiving side.
+//
+
+static int pread_all (int file_fd, char* buffer, size_t size,
+                      uint64_t offset) {
+   while (size > 0) {
+      ssize_t nread = ::pread (file_fd, buffer, size, offset);
+      if (nread < 0 and errno == EINTR) continue;
+      if (nread < 0) return errno;
+      if (nread == 0) return ESTALE; // truncated since
+      buffer += nread;
+      size -= nread;
+      offset += nread;
+   }
+   return 0;
+}
+
+int recv_delta (base_socket& socket, int base_fd, uint64_t base_size,
+                int out_fd, uint64_t nbytes) {
+   auto malformed = socket_error ("DELTA: malformed delta");
+   char prefix[DELTA_HEADER_SIZE];
+   recv_packet (socket, prefix, sizeof prefix);
+   uint32_t block_size = load_u32 (prefix);
+   uint64_t sent_base_size = load_u64 (prefix + 8);
+   if (block_size < MIN_BLOCK_SIZE or block_size > MAX_BLOCK_SIZE) {
+      throw malformed;
+   }
+   // check copies against the copy the client saw, so that a stale
+   // delta is still consumed in step
+   uint64_t count = block_count (sent_base_size, block_size);
+   int error = out_fd < 0 ? EBADF : 0;
+   if (error == 0 and (sent_base_size != base_size
+                       or block_size != block_size_for (base_size))) {
+      error = ESTALE;
+   }
+   sha256 hash;
+   vector<char> buffer (min<uint64_t> (nbytes, transfer_chunk_size));
+   while (nbytes > 0) {
+      char op[OP_SIZE];
+      recv_packet (socket, op, sizeof op);
+      delta_op kind = delta_op (load_u32 (op));
+      uint32_t first = load_u32 (op + 4);
+      uint32_t op_count = load_u32 (op + 8);
+      if (kind == delta_op::LITERAL) {
+         if (op_count == 0 or op_count > MAX_CHUNK_SIZE
+         or op_count > nbytes) throw malformed;
+         if (buffer.size() < op_count) buffer.resize (op_count);
+         recv_packet (socket, buffer.data(), op_count);
+         if (error == 0) {
+            error = write_all (out_fd, buffer.data(), op_count);
+            hash.update (buffer.data(), op_count);
+         }
+         nbytes -= op_count;
+      }else if (kind == delta_op::COPY) {
+         if (op_count == 0 or first >= count
+         or op_count > count - first) throw malformed;
+         uint64_t offset = uint64_t (first) * block_size;
+         uint64_t size = min<uint64_t> (uint64_t (op_count)
+                                        * block_size,
+                                        sent_base_size - offset);
+         if (size > nbytes) throw malformed;
+         nbytes -= size;
+         while (error == 0 and size > 0) {
+            size_t piece = min<uint64_t> (size, buffer.size());
+            error = pread_all (base_fd, buffer.data(), piece, offset);
+            if (error == 0) error = write_all (out_fd, buffer.data(),
+                                               piece);
+            hash.update (buffer.data(), piece);
+            offset += piece;
+            size -= piece;
+         }
+      }else {
+         throw malformed;
+      }
+   }
+   sha256_digest sent_digest;
+   recv_packet (socket, sent_digest.data(), sent_digest.size());
+   if (error == 0 and hash.digest() != sent_digest) error = EBADMSG;
+   DEBUGF ('d', "recv_delta: error " << error);
+   return error;
+}
+
@@ -0,0 +1,59 @@
+// $Id: delta.h,v 1.1 2026-10-16 21:41:03-07 - - $
+
+//
+// delta transfer
+// DPUT updates a file the server already has by sending only what
+// changed, in the manner of rsync.
+//
+//    client: DPUT filename
+//    server: SIGS, payload the signatures of its copy
+//    client: DELTA filename, nbytes the new size, payload the delta
+//    server: ACK, or NAK with errno
+//
+// The signatures begin with {block_size, count, base_size} and hold
+// a weak rolling checksum and a SHA-256 for each block of the copy;
+// only the last block may be short.  The delta begins with the
+// block_size and base_size it was made against, then a series of
+// ops that rebuild the new file in order, each {kind, first, count}:
+// a LITERAL of count bytes that follow the op, or a COPY of count
+// blocks of the copy starting with block first.  The ops end when
+// nbytes have been rebuilt, and a SHA-256 of the whole new file
+// follows them.  All numbers are in network byte order.
+//
+
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <cstdint>
+#include <string>
+using namespace std;
+
+#include "socket.h"
+
+// Signatures of the first base_size bytes of the file, to be sent
+// as the payload of SIGS.  Throws socket_sys_error if it cannot be
+// read.  A file_fd of -1 and a base_size of 0 describe no copy.
+string delta_signatures (int file_fd, uint64_t base_size);
+
+struct delta_stats {
+   uint64_t literal_bytes {0};
+   uint64_t copied_bytes {0};
+};
+
+// Send the delta that turns the copy described by signatures into
+// the nbytes of the file.  Throws socket_error if the signatures are
+// malformed.
+delta_stats send_delta (base_socket& socket, const string& signatures,
+                        int file_fd, uint64_t nbytes);
+
+// Rebuild the file from a delta against the first base_size bytes
+// of base_fd, writing nbytes to out_fd.  As with recv_file, the whole
+// delta is consumed even if the file cannot be written, or if out_fd
+// is -1.  Returns 0 or errno: ESTALE if the copy changed since its
+// signatures were sent, EBADMSG if the result does not hash right.
+// Throws socket_error if the delta is malformed.
+int recv_delta (base_socket& socket, int base_fd, uint64_t base_size,
+                int out_fd, uint64_t nbytes);
+
+#endif
+
@@ -0,0 +1,203 @@
+// $Id: durable.cpp,v 1.1 2026-10-16 23:52:08-07 - - $
+
+#include <cerrno>
+#include <ctime>
+#include <iostream>
+#include <new>
+#include <string>
+using namespace std;
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "debug.h"
+#include "durable.h"
+#include "socket.h"
+#include "store.h"
+#include "trace.h"
+
+durability put_durability = durability::NONE;
+unsigned group_commit_usec = DEFAULT_GROUP_USEC;
+
+//
+// struct commit_group
+// Lives in shared memory, so every server process forked after
+// durable_init takes part.  The first PUT to need a sync becomes the
+// leader: it waits out the window while others join, then runs one
+// syncfs for them all.  Each member waits for a sync that began
+// after it joined.  Syncs are numbered, and finished is the highest
+// that has completed.
+//
+
+struct commit_group {
+   pthread_mutex_t lock;
+   pthread_cond_t synced;
+   uint64_t started;
+   uint64_t finished;
+   int error;          // of the latest sync to finish
+   bool gathering;     // a leader is waiting out the window
+   timespec gather_start;
+};
+
+static commit_group* group = nullptr;
+
+// A member waits this long past the window before it gives up on a
+// leader that may have died, and syncs for itself.
+static constexpr time_t STALE_SEC = 5;
+
+static timespec monotonic_now() {
+   timespec now;
+   clock_gettime (CLOCK_MONOTONIC, &now);
+   return now;
+}
+
+static timespec add_usec (timespec time, uint64_t usec) {
+   time.tv_sec += usec / 1000000;
+   time.tv_nsec += usec % 1000000 * 1000;
+   if (time.tv_nsec >= 1000000000) {
+      time.tv_nsec -= 1000000000;
+      ++time.tv_sec;
+   }
+   return time;
+}
+
+static bool later (const timespec& left, const timespec& right) {
+   return left.tv_sec != right.tv_sec ? left.tv_sec > right.tv_sec
+                                      : left.tv_nsec > right.tv_nsec;
+}
+
+// A process that died holding the lock may have been the leader.
+static void recover (int status) {
+   if (status != EOWNERDEAD) return;
+   group->gathering = false;
+   pthread_mutex_consistent (&group->lock);
+}
+
+static int sync_fs (int file_fd) {
+   return ::syncfs (file_fd) < 0 ? errno : 0;
+}
+
+void durable_init() {
+   void* memory = ::mmap (nullptr, sizeof (commit_group),
+                          PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+   if (memory == MAP_FAILED) throw socket_sys_error ("mmap");
+   group = new (memory) commit_group {};
+   pthread_mutexattr_t mutex_attr;
+   pthread_mutexattr_init (&mutex_attr);
+   pthread_mutexattr_setpshared (&mutex_attr, PTHREAD_PROCESS_SHARED);
+   pthread_mutexattr_setrobust (&mutex_attr, PTHREAD_MUTEX_ROBUST);
+   pthread_mutex_init (&group->lock, &mutex_attr);
+   pthread_mutexattr_destroy (&mutex_attr);
+   pthread_condattr_t cond_attr;
+   pthread_condattr_init (&cond_attr);
+   pthread_condattr_setpshared (&cond_attr, PTHREAD_PROCESS_SHARED);
+   pthread_condattr_setclock (&cond_attr, CLOCK_MONOTONIC);
+   pthread_cond_init (&group->synced, &cond_attr);
+   pthread_condattr_destroy (&cond_attr);
+}
+
+static int group_sync (int file_fd) {
+   if (group == nullptr) return sync_fs (file_fd);
+   recover (pthread_mutex_lock (&group->lock));
+   uint64_t wanted = group->started + 1;
+   timespec stale = add_usec (group->gather_start, group_commit_usec
+                              + STALE_SEC * 1000000);
+   if (group->gathering and later (monotonic_now(), stale)) {
+      group->gathering = false;
+   }
+   if (not group->gathering) {
+      group->gathering = true;
+      group->gather_start = monotonic_now();
+      pthread_mutex_unlock (&group->lock);
+      ::usleep (group_commit_usec);
+      recover (pthread_mutex_lock (&group->lock));
+      group->gathering = false;
+      uint64_t number = ++group->started;
+      pthread_mutex_unlock (&group->lock);
+      int error = sync_fs (file_fd);
+      recover (pthread_mutex_lock (&group->lock));
+      if (number > group->finished) {
+         group->finished = number;
+         group->error = error;
+      }
+      pthread_cond_broadcast (&group->synced);
+      pthread_mutex_unlock (&group->lock);
+      DEBUGF ('y', "group sync " << number << ": " << strerror (error));
+      return error;
+   }
+   timespec deadline = add_usec (monotonic_now(), group_commit_usec
+                                 + STALE_SEC * 1000000);
+   while (group->finished < wanted) {
+      int status = pthread_cond_timedwait (&group->synced,
+                                           &group->lock, &deadline);
+      recover (status);
+      if (status == ETIMEDOUT) {
+         pthread_mutex_unlock (&group->lock);
+         return sync_fs (file_fd);
+      }
+   }
+   int error = group->error;
+   pthread_mutex_unlock (&group->lock);
+   return error;
+}
+
+int durable_data (int file_fd) {
+   if (put_durability == durability::NONE) return 0;
+   trace_span span (trace_point::SYNC);
+   switch (put_durability) {
+      case durability::NONE: return 0;
+      case durability::FSYNC: return ::fsync (file_fd) < 0 ? errno : 0;
+      case durability::GROUP: return group_sync (file_fd);
+   }
+   return 0;
+}
+
+int durable_name (const string& filename) {
+   if (put_durability == durability::NONE) return 0;
+   size_t slash = filename.rfind ('/');
+   string dir = slash == string::npos ? "."
+              : filename.substr (0, slash + 1);
+   open_file dir_file (dir.c_str(), O_RDONLY | O_DIRECTORY);
+   if (not dir_file.is_open()) return errno;
+   return durable_data (dir_file.get());
+}
+
+int durable_commit (const string& filename, const string& temp,
+                    open_file& file) {
+   int error = durable_data (file.get());
+   int close_error = file.close();
+   if (error == 0) error = close_error;
+   if (error != 0) {
+      ::unlink (temp.c_str());
+      return error;
+   }
+   error = store_commit (filename, temp);
+   if (error == 0) error = durable_name (filename);
+   return error;
+}
+
+durability get_durability (const string& durability_arg) {
+   if (durability_arg == "none") return durability::NONE;
+   if (durability_arg == "fsync") return durability::FSYNC;
+   if (durability_arg == "group") return durability::GROUP;
+   throw socket_error (durability_arg + ": invalid durability");
+}
+
+unsigned get_group_usec (const string& usec_arg) {
+   constexpr unsigned long MAX_GROUP_USEC = 1000000;
+   auto error = socket_error (usec_arg + ": invalid group window");
+   try {
+      size_t end = 0;
+      unsigned long usec = stoul (usec_arg, &end);
+      if (end != usec_arg.size() or usec > MAX_GROUP_USEC) throw error;
+      return usec;
+   }catch (invalid_argument&) { // thrown by stoul
+      throw error;
+   }catch (out_of_range&) { // thrown by stoul
+      throw error;
+   }
+}
+
@@ -0,0 +1,60 @@
+// $Id: durable.h,v 1.1 2026-10-16 23:52:08-07 - - $
+
+//
+// durable PUT
+// A PUT is received into a temporary file that is renamed over its
+// name only once it is whole, so a crash or a failed transfer never
+// leaves a torn file behind.  How durable the file is when cxid
+// sends the ACK depends on put_durability:
+//
+//    NONE   the rename is atomic, but the data may still be in the
+//           page cache when the ACK goes out
+//    FSYNC  the file is fsynced before the rename, and its directory
+//           after it, for each PUT
+//    GROUP  PUTs that finish within group_commit_usec of each other
+//           share one syncfs before the rename and one after it
+//
+// Group commit works across server processes as well as threads, as
+// long as durable_init is called before they are forked.
+//
+
+#ifndef DURABLE_H
+#define DURABLE_H
+
+#include <string>
+using namespace std;
+
+#include "transfer.h"
+
+enum class durability { NONE, FSYNC, GROUP };
+extern durability put_durability;
+
+// How long the first PUT of a group waits for others to join it.
+constexpr unsigned DEFAULT_GROUP_USEC = 2000;
+extern unsigned group_commit_usec;
+
+// Set up the group shared by this process and its children.  Throws
+// socket_sys_error.
+void durable_init();
+
+// Make the data written to file_fd durable.  Returns 0 or errno.
+int durable_data (int file_fd);
+
+// Make the directory entry of filename durable.  Returns 0 or errno.
+int durable_name (const string& filename);
+
+// Finish a file received as temp, still open as file, and put it in
+// place as filename through the store (see store.h), durably as
+// put_durability asks.  Returns 0 or errno.  Temp is gone and file
+// is closed either way.
+int durable_commit (const string& filename, const string& temp,
+                    open_file& file);
+
+// Parse a durability argument: none, fsync or group.
+durability get_durability (const string& durability_arg);
+
+// Parse a group commit window in microseconds.
+unsigned get_group_usec (const string& usec_arg);
+
+#endif
+
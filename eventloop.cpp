@@ -0,0 +1,841 @@
+// $Id: eventloop.cpp,v 1.1 2026-10-16 11:02:17-07 - - $
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+using namespace std;
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+
+#include "debug.h"
+#include "durable.h"
+#include "eventloop.h"
+#include "listing.h"
+#include "logstream.h"
+#include "protocol.h"
+#include "stats.h"
+#include "store.h"
+#include "trace.h"
+#include "transfer.h"
+
+extern logstream outlog;
+
+//
+// struct connection
+// one client of an event loop and how far its current request or
+// reply has got.  Buffers are only held while a transfer is in
+// progress, so an idle connection costs little more than its socket.
+//
+
+enum class conn_state {
+   HEADER, TAG, EXTENDED, RANGE, PAYLOAD, NAMES, REPLY,
+};
+
+struct connection {
+   accepted_socket socket;
+   conn_state state {conn_state::HEADER};
+   uint32_t interest {EPOLLIN};
+   cxi_header header;
+   size_t header_bytes {0};
+   uint32_t features {0};
+   cxi_tag tag;
+   uint32_t wire_tag[2] {};
+   size_t tag_bytes {0};
+   uint32_t extended[2] {};
+   size_t extended_bytes {0};
+   char range[RANGE_PREFIX_SIZE] {};
+   size_t range_bytes {0};
+
+   // PUT or PUTAT payload being received, the temporary file a PUT
+   // goes to until it is whole, and where a PUTAT with
+   // PUTAT_TRUNCATE cuts the file off
+   unique_ptr<open_file> in_file;
+   string in_temp;
+   uint64_t in_left {0};
+   int in_error {0};
+   unique_ptr<char[]> chunk;
+   bool in_truncate {false};
+   uint64_t in_end {0};
+
+   // batch in progress: the name list of an MGET or MRM being
+   // received, MGET files still to send, and MPUT results held
+   // until its END arrives
+   string names;
+   size_t names_bytes {0};
+   deque<string> batch;
+   cxi_command batch_command {cxi_command::ERROR};
+   size_t batch_count {0};
+   string batch_output;
+
+   // listing whose remaining chunks are still to be sent
+   unique_ptr<listing> lister;
+
+   // reply being sent: output, then cached bytes in out_shared,
+   // then out_left bytes of out_file
+   string output;
+   size_t output_sent {0};
+   shared_ptr<const string> out_shared;
+   size_t out_shared_sent {0};
+   unique_ptr<open_file> out_file;
+   uint64_t out_left {0};
+   bool out_sendfile {transfer_sendfile};
+
+   // the request being served, for the statistics: an MPUT counts
+   // as one request from its header to the reply to its END
+   cxi_command request_command {cxi_command::ERROR};
+   chrono::steady_clock::time_point request_start;
+   uint64_t trace_start {0};
+   bool request_failed {false};
+   byte_meter meter;
+};
+
+//
+// class event_loop
+// one epoll instance, the listener and the connections it accepted
+//
+
+class event_loop {
+   private:
+      static constexpr int MAX_EVENTS = 256;
+      static constexpr int MAX_REQUESTS = 16; // per wakeup
+      int epoll_fd;
+      server_socket& listener;
+      unordered_map<int,unique_ptr<connection>> connections;
+      void accept_clients();
+      void handle (connection& conn);
+      bool recv_request (connection& conn);
+      void header_done (connection& conn);
+      void range_done (connection& conn);
+      bool recv_payload (connection& conn);
+      bool send_reply (connection& conn);
+      void dispatch (connection& conn);
+      void start_batch (connection& conn);
+      void next_batch_file (connection& conn);
+      void next_ls_chunk (connection& conn);
+      void queue_cached_ls (connection& conn);
+      void update_interest (connection& conn);
+      void close (connection& conn);
+   public:
+      event_loop (server_socket& listener);
+      event_loop (const event_loop&) = delete;
+      event_loop& operator= (const event_loop&) = delete;
+      ~event_loop();
+      void run();
+};
+
+
+// Receive into buffer until have == size.  Returns false if the
+// socket has no more data for now.
+static bool recv_some (accepted_socket& socket, void* buffer,
+                       size_t size, size_t& have) {
+   while (have < size) {
+      ssize_t nbytes = socket.recv (static_cast<char*> (buffer) + have,
+                                    size - have);
+      if (nbytes < 0) return false;
+      if (nbytes == 0) {
+         throw socket_error (to_string (socket) + " is closed");
+      }
+      have += nbytes;
+   }
+   return true;
+}
+
+// Append a reply header to output.  Batch frames name their file.
+static void append_header (connection& conn, string& output,
+                           cxi_command command, uint64_t nbytes,
+                           const string& filename = "") {
+   cxi_header& header = conn.header;
+   header.command = command;
+   if (command == cxi_command::NAK) conn.request_failed = true;
+   memset (header.filename, 0, FILENAME_SIZE);
+   strncpy (header.filename, filename.c_str(), FILENAME_SIZE - 1);
+   char buffer[MAX_HEADER_WIRE];
+   bool tagged = conn.features & CXI_FEATURE_TAGS;
+   size_t length = pack_header (buffer, header,
+                                tagged ? &conn.tag : nullptr, nbytes);
+   DEBUGF ('h', "sending header " << header);
+   output.append (buffer, length);
+}
+
+static void queue_reply (connection& conn, cxi_command command,
+                         uint64_t nbytes, const string& filename = "") {
+   append_header (conn, conn.output, command, nbytes, filename);
+   conn.state = conn_state::REPLY;
+}
+
+// Queue a FILEOUT and the file, or a NAK.  frame_name is the name a
+// batch frame carries.  There is no hot-file cache here, since
+// admitting a file reads it whole on the loop.
+static void queue_get (connection& conn, const string& filename,
+                       const string& frame_name) {
+   uint64_t open_start = trace_now();
+   auto file = make_unique<open_file> (filename.c_str(), O_RDONLY);
+   int error = file->is_open() ? 0 : errno;
+   trace_record (trace_point::FILE_OPEN, open_start);
+   uint64_t nbytes = 0;
+   if (error == 0) {
+      try {
+         nbytes = file_size (file->get());
+      }catch (socket_sys_error& sys_error) {
+         error = sys_error.sys_errno;
+      }
+   }
+   if (error != 0) {
+      queue_reply (conn, cxi_command::NAK, error, frame_name);
+      return;
+   }
+   queue_reply (conn, cxi_command::FILEOUT, nbytes, frame_name);
+   conn.out_file = move (file);
+   conn.out_left = nbytes;
+}
+
+// Queue a FILEOUT of as much of the range as the file holds, or a
+// NAK.
+static void queue_range (connection& conn, const string& filename,
+                         uint64_t offset, uint64_t length) {
+   auto file = make_unique<open_file> (filename.c_str(), O_RDONLY);
+   int error = file->is_open() ? 0 : errno;
+   uint64_t size = 0;
+   if (error == 0) {
+      try {
+         size = file_size (file->get());
+      }catch (socket_sys_error& sys_error) {
+         error = sys_error.sys_errno;
+      }
+   }
+   offset = min (offset, size);
+   length = min (length, size - offset);
+   if (error == 0 and ::lseek (file->get(), offset, SEEK_SET) < 0) {
+      error = errno;
+   }
+   if (error != 0) {
+      queue_reply (conn, cxi_command::NAK, error);
+      return;
+   }
+   queue_reply (conn, cxi_command::FILEOUT, length);
+   conn.out_file = move (file);
+   conn.out_left = length;
+}
+
+static uint64_t payload_size (const connection& conn) {
+   uint32_t nbytes = ntohl (conn.header.nbytes);
+   if (nbytes != NBYTES_EXTENDED) return nbytes;
+   return uint64_t (ntohl (conn.extended[0])) << 32
+        | ntohl (conn.extended[1]);
+}
+
+
+event_loop::event_loop (server_socket& listener_):
+            epoll_fd (::epoll_create1 (EPOLL_CLOEXEC)),
+            listener (listener_) {
+   if (epoll_fd < 0) throw socket_sys_error ("epoll_create1");
+   epoll_event event {};
+   event.events = EPOLLIN | EPOLLEXCLUSIVE;
+   event.data.fd = listener.get_socket_fd();
+   int status = ::epoll_ctl (epoll_fd, EPOLL_CTL_ADD,
+                             listener.get_socket_fd(), &event);
+   if (status < 0) throw socket_sys_error ("epoll_ctl");
+}
+
+event_loop::~event_loop() {
+   ::close (epoll_fd);
+}
+
+void event_loop::run() {
+   epoll_event events[MAX_EVENTS];
+   for (;;) {
+      int nready = ::epoll_wait (epoll_fd, events, MAX_EVENTS, -1);
+      if (nready < 0) {
+         if (errno == EINTR) continue;
+         throw socket_sys_error ("epoll_wait");
+      }
+      for (int index = 0; index < nready; ++index) {
+         int fd = events[index].data.fd;
+         if (fd == listener.get_socket_fd()) {
+            accept_clients();
+            continue;
+         }
+         auto itor = connections.find (fd);
+         if (itor == connections.end()) continue;
+         connection& conn = *itor->second;
+         try {
+            handle (conn);
+         }catch (socket_error& error) {
+            outlog << error.what() << endl;
+            close (conn);
+         }
+      }
+   }
+}
+
+void event_loop::accept_clients() {
+   for (;;) {
+      auto conn = make_unique<connection>();
+      try {
+         listener.accept (conn->socket);
+      }catch (socket_sys_error& error) {
+         switch (error.sys_errno) {
+            case EINTR: continue;
+            case EAGAIN: case ECONNABORTED: return;
+            default:
+               outlog << "accept: " << error.what() << endl;
+               return;
+         }
+      }
+      conn->socket.set_non_blocking (true);
+      int fd = conn->socket.get_socket_fd();
+      epoll_event event {};
+      event.events = conn->interest;
+      event.data.fd = fd;
+      int status = ::epoll_ctl (epoll_fd, EPOLL_CTL_ADD, fd, &event);
+      if (status < 0) {
+         outlog << "epoll_ctl: " << strerror (errno) << endl;
+         continue;
+      }
+      LOGF (INFO, "accepted " << to_string (conn->socket));
+      stats_session_begin();
+      connections.emplace (fd, move (conn));
+   }
+}
+
+void event_loop::close (connection& conn) {
+   conn.meter.update (conn.socket.get_socket_fd());
+   stats_session_end();
+   connections.erase (conn.socket.get_socket_fd());
+}
+
+void event_loop::update_interest (connection& conn) {
+   uint32_t interest = conn.state == conn_state::REPLY
+                     ? EPOLLOUT : EPOLLIN;
+   if (interest == conn.interest) return;
+   epoll_event event {};
+   event.events = interest;
+   event.data.fd = conn.socket.get_socket_fd();
+   int status = ::epoll_ctl (epoll_fd, EPOLL_CTL_MOD,
+                             event.data.fd, &event);
+   if (status < 0) throw socket_sys_error ("epoll_ctl");
+   conn.interest = interest;
+}
+
+// Make as much progress as the socket allows, then wait for the
+// event that lets the connection continue.  A client that keeps
+// sending requests is served at most MAX_REQUESTS at a time, so it
+// cannot starve the other connections.
+void event_loop::handle (connection& conn) {
+   for (int requests = 0; requests < MAX_REQUESTS; ++requests) {
+      if (conn.state != conn_state::REPLY) {
+         if (not recv_request (conn)) break;
+      }
+      if (not send_reply (conn)) break;
+   }
+   update_interest (conn);
+}
+
+
+// Returns true once a reply has been queued, false if the socket
+// has no more data for now.
+bool event_loop::recv_request (connection& conn) {
+   for (;;) {
+      switch (conn.state) {
+         case conn_state::HEADER:
+            if (not recv_some (conn.socket, &conn.header,
+                               sizeof conn.header, conn.header_bytes)) {
+               return false;
+            }
+            conn.header_bytes = 0;
+            if (conn.features & CXI_FEATURE_TAGS) {
+               conn.state = conn_state::TAG;
+            }else {
+               header_done (conn);
+            }
+            break;
+         case conn_state::TAG:
+            if (not recv_some (conn.socket, conn.wire_tag,
+                               sizeof conn.wire_tag, conn.tag_bytes)) {
+               return false;
+            }
+            conn.tag_bytes = 0;
+            conn.tag.request_id = ntohl (conn.wire_tag[0]);
+            // compression is not offered, so no payload has it
+            conn.tag.flags = ntohl (conn.wire_tag[1])
+                           & ~CXI_TAG_COMPRESSED;
+            header_done (conn);
+            break;
+         case conn_state::EXTENDED:
+            if (not recv_some (conn.socket, conn.extended,
+                               sizeof conn.extended,
+                               conn.extended_bytes)) {
+               return false;
+            }
+            conn.extended_bytes = 0;
+            dispatch (conn);
+            break;
+         case conn_state::RANGE:
+            if (not recv_some (conn.socket, conn.range,
+                               sizeof conn.range, conn.range_bytes)) {
+               return false;
+            }
+            conn.range_bytes = 0;
+            range_done (conn);
+            break;
+         case conn_state::PAYLOAD:
+            if (not recv_payload (conn)) return false;
+            break;
+         case conn_state::NAMES:
+            if (not recv_some (conn.socket, conn.names.data(),
+                               conn.names.size(), conn.names_bytes)) {
+               return false;
+            }
+            conn.names_bytes = 0;
+            start_batch (conn);
+            break;
+         case conn_state::REPLY:
+            return true;
+      }
+   }
+}
+
+// The header and its tag are in.  Read the extended size next if
+// the request has one, otherwise act on the request.
+void event_loop::header_done (connection& conn) {
+   cxi_command command = conn.header.command;
+   if ((command == cxi_command::PUT or command == cxi_command::PUTAT
+        or command == cxi_command::GETRANGE)
+   and ntohl (conn.header.nbytes) == NBYTES_EXTENDED) {
+      conn.state = conn_state::EXTENDED;
+   }else {
+      dispatch (conn);
+   }
+}
+
+void event_loop::dispatch (connection& conn) {
+   cxi_header& header = conn.header;
+   DEBUGF ('h', "received header " << header);
+   if (conn.batch_command != cxi_command::MPUT) {
+      conn.request_command = header.command;
+      conn.request_start = chrono::steady_clock::now();
+      conn.trace_start = trace_now();
+      conn.request_failed = false;
+   }
+   conn.state = conn_state::HEADER; // unless there is more to do
+   switch (header.command) {
+      case cxi_command::PUT: {
+         conn.in_left = payload_size (conn);
+         conn.in_temp = temp_name (string (header.filename,
+                        strnlen (header.filename, FILENAME_SIZE)));
+         conn.in_file = make_unique<open_file> (conn.in_temp.c_str(),
+                        O_WRONLY | O_CREAT | O_TRUNC);
+         conn.in_error = conn.in_file->is_open() ? 0 : errno;
+         conn.chunk = make_unique<char[]> (transfer_chunk_size);
+         conn.state = conn_state::PAYLOAD;
+         break;
+      }
+      case cxi_command::GET: {
+         string filename (header.filename,
+                          strnlen (header.filename, FILENAME_SIZE));
+         queue_get (conn, filename, "");
+         break;
+      }
+      case cxi_command::RM: {
+         int error = unlink (header.filename) != 0 ? errno : 0;
+         touch_listing (header.filename);
+         if (error != 0) {
+            queue_reply (conn, cxi_command::NAK, error);
+         }else {
+            queue_reply (conn, cxi_command::ACK, 0);
+         }
+         break;
+      }
+      case cxi_command::LS: {
+         if (listing_cache) {
+            queue_cached_ls (conn);
+            break;
+         }
+         auto lister = make_unique<listing> (
+                       ls_format (ntohl (header.nbytes)));
+         if (lister->get_error() != 0) {
+            queue_reply (conn, cxi_command::NAK, lister->get_error());
+         }else {
+            conn.lister = move (lister);
+            conn.state = conn_state::REPLY;
+         }
+         break;
+      }
+      case cxi_command::MGET:
+      case cxi_command::MRM: {
+         uint32_t nbytes = ntohl (header.nbytes);
+         if (nbytes > MAX_BATCH_NAMES) {
+            throw socket_error (to_string (conn.socket)
+                                + ": batch name list too long");
+         }
+         conn.names.assign (nbytes, '\0');
+         if (nbytes > 0) conn.state = conn_state::NAMES;
+                    else start_batch (conn);
+         break;
+      }
+      case cxi_command::MPUT:
+         conn.batch_command = cxi_command::MPUT;
+         conn.batch_count = 0;
+         break;
+      case cxi_command::END:
+         if (conn.batch_command != cxi_command::MPUT) {
+            outlog << "invalid client header:" << header << endl;
+            break;
+         }
+         conn.output = move (conn.batch_output);
+         conn.batch_output.clear();
+         conn.batch_command = cxi_command::ERROR;
+         queue_reply (conn, cxi_command::END, conn.batch_count);
+         break;
+      case cxi_command::HELLO: {
+         uint32_t granted = ntohl (header.nbytes) & CXI_FEATURES
+                          & CXI_FEATURE_TAGS;
+         queue_reply (conn, cxi_command::ACK, granted);
+         conn.features = granted;
+         break;
+      }
+      case cxi_command::GETRANGE:
+      case cxi_command::PUTAT:
+         conn.in_left = payload_size (conn);
+         if (conn.in_left < RANGE_PREFIX_SIZE) {
+            throw socket_error (to_string (conn.socket)
+                                + ": payload too short for a range");
+         }
+         conn.in_left -= RANGE_PREFIX_SIZE;
+         conn.state = conn_state::RANGE;
+         break;
+      case cxi_command::SIZE: {
+         open_file file (header.filename, O_RDONLY);
+         int error = file.is_open() ? 0 : errno;
+         uint64_t size = 0;
+         if (error == 0) {
+            try {
+               size = file_size (file.get());
+            }catch (socket_sys_error& sys_error) {
+               error = sys_error.sys_errno;
+            }
+         }
+         if (error != 0) queue_reply (conn, cxi_command::NAK, error);
+                    else queue_reply (conn, cxi_command::ACK, size);
+         break;
+      }
+      case cxi_command::SUM:
+         // reading the whole file would stall every connection
+         queue_reply (conn, cxi_command::NAK, EOPNOTSUPP);
+         break;
+      case cxi_command::DPUT:
+         // the exchange needs a second request mid-reply
+         queue_reply (conn, cxi_command::NAK, EOPNOTSUPP);
+         break;
+      case cxi_command::STATS: {
+         string report = stats_report (stats_format (
+                         ntohl (header.nbytes)));
+         queue_reply (conn, cxi_command::STATS, report.size());
+         conn.output.append (report);
+         break;
+      }
+      case cxi_command::TRACE: {
+         if (not trace_enabled) {
+            queue_reply (conn, cxi_command::NAK, EOPNOTSUPP);
+            break;
+         }
+         string dump = trace_dump();
+         queue_reply (conn, cxi_command::TRACE, dump.size(),
+                      "cxid-trace." + to_string (getpid()));
+         conn.output.append (dump);
+         break;
+      }
+      default:
+         outlog << "invalid client header:" << header << endl;
+         break;
+   }
+}
+
+// The range prefix of a GETRANGE or PUTAT is in.
+void event_loop::range_done (connection& conn) {
+   cxi_header& header = conn.header;
+   uint64_t offset = 0;
+   uint64_t extent = 0;
+   unpack_range (conn.range, offset, extent);
+   conn.state = conn_state::HEADER;
+   if (header.command == cxi_command::GETRANGE) {
+      if (conn.in_left != 0) {
+         throw socket_error (to_string (conn.socket)
+                             + ": GETRANGE payload after the range");
+      }
+      string filename (header.filename,
+                       strnlen (header.filename, FILENAME_SIZE));
+      queue_range (conn, filename, offset, extent);
+      return;
+   }
+   conn.in_temp.clear();
+   int detach_error = store_detach (header.filename);
+   conn.in_file = make_unique<open_file> (header.filename,
+                                          O_WRONLY | O_CREAT);
+   int file_fd = conn.in_file->get();
+   conn.in_error = conn.in_file->is_open() ? detach_error : errno;
+   if (conn.in_error == 0 and extent & PUTAT_APPEND) {
+      off_t end = ::lseek (file_fd, 0, SEEK_END);
+      if (end < 0) conn.in_error = errno;
+              else offset = end;
+   }
+   if (conn.in_error == 0 and ::lseek (file_fd, offset, SEEK_SET) < 0) {
+      conn.in_error = errno;
+   }
+   conn.in_truncate = extent & PUTAT_TRUNCATE;
+   conn.in_end = offset + conn.in_left;
+   conn.chunk = make_unique<char[]> (transfer_chunk_size);
+   conn.state = conn_state::PAYLOAD;
+}
+
+bool event_loop::recv_payload (connection& conn) {
+   while (conn.in_left > 0) {
+      size_t chunk_size = min<uint64_t> (conn.in_left,
+                                         transfer_chunk_size);
+      ssize_t nbytes = conn.socket.recv (conn.chunk.get(), chunk_size);
+      if (nbytes < 0) return false;
+      if (nbytes == 0) {
+         throw socket_error (to_string (conn.socket) + " is closed");
+      }
+      if (conn.in_error == 0) {
+         conn.in_error = write_all (conn.in_file->get(),
+                                    conn.chunk.get(), nbytes);
+      }
+      conn.in_left -= nbytes;
+   }
+   int error = conn.in_error;
+   if (error == 0 and conn.in_truncate
+   and ::ftruncate (conn.in_file->get(), conn.in_end) < 0) {
+      error = errno;
+   }
+   conn.in_truncate = false;
+   string filename (conn.header.filename,
+                    strnlen (conn.header.filename, FILENAME_SIZE));
+   if (conn.in_file->is_open() and not conn.in_temp.empty()) {
+      if (error == 0) {
+         error = durable_commit (filename, conn.in_temp, *conn.in_file);
+      }else {
+         conn.in_file->close();
+         unlink (conn.in_temp.c_str());
+      }
+   }else if (conn.in_file->is_open()) {
+      if (error == 0) error = durable_data (conn.in_file->get());
+      int close_error = conn.in_file->close();
+      if (error == 0) error = close_error;
+      if (error == 0) error = durable_name (filename);
+   }
+   conn.in_temp.clear();
+   conn.in_file.reset();
+   conn.chunk.reset();
+   touch_listing (conn.header.filename);
+   cxi_command reply = error != 0 ? cxi_command::NAK
+                                  : cxi_command::ACK;
+   if (conn.batch_command == cxi_command::MPUT) {
+      string name (conn.header.filename,
+                   strnlen (conn.header.filename, FILENAME_SIZE));
+      append_header (conn, conn.batch_output, reply, error, name);
+      ++conn.batch_count;
+      conn.state = conn_state::HEADER;
+   }else {
+      queue_reply (conn, reply, error);
+   }
+   return true;
+}
+
+
+// Returns true once the whole reply is sent, false if the socket
+// cannot take any more for now.
+bool event_loop::send_reply (connection& conn) {
+   for (;;) {
+      if (conn.output_sent < conn.output.size()) {
+         ssize_t nbytes = conn.socket.send (
+                          conn.output.data() + conn.output_sent,
+                          conn.output.size() - conn.output_sent);
+         if (nbytes < 0) return false;
+         conn.output_sent += nbytes;
+         continue;
+      }
+      if (conn.out_shared) {
+         const string& shared = *conn.out_shared;
+         if (conn.out_shared_sent < shared.size()) {
+            ssize_t nbytes = conn.socket.send (
+                             shared.data() + conn.out_shared_sent,
+                             shared.size() - conn.out_shared_sent);
+            if (nbytes < 0) return false;
+            conn.out_shared_sent += nbytes;
+            continue;
+         }
+         conn.out_shared.reset();
+      }
+      if (conn.out_left == 0) {
+         if (conn.batch_command == cxi_command::MGET) {
+            next_batch_file (conn);
+         }else if (conn.lister) {
+            next_ls_chunk (conn);
+         }else {
+            break;
+         }
+         continue;
+      }
+      if (conn.out_sendfile) {
+         ssize_t nbytes = ::sendfile (conn.socket.get_socket_fd(),
+                                      conn.out_file->get(), nullptr,
+                                      conn.out_left);
+         if (nbytes < 0) {
+            switch (errno) {
+               case EAGAIN: return false;
+               case EINTR: continue;
+               case EINVAL: case ENOSYS: case EOPNOTSUPP:
+                  conn.out_sendfile = false;
+                  continue;
+               default: throw socket_sys_error ("sendfile");
+            }
+         }
+         if (nbytes == 0) {
+            throw socket_error ("sendfile: file truncated");
+         }
+         conn.out_left -= nbytes;
+         continue;
+      }
+      conn.output.resize (min<uint64_t> (conn.out_left,
+                                         transfer_chunk_size));
+      ssize_t nread = ::read (conn.out_file->get(), conn.output.data(),
+                              conn.output.size());
+      if (nread < 0) {
+         if (errno == EINTR) continue;
+         throw socket_sys_error ("read");
+      }
+      if (nread == 0) throw socket_error ("read: file truncated");
+      conn.output.resize (nread);
+      conn.output_sent = 0;
+      conn.out_left -= nread;
+   }
+   string().swap (conn.output);
+   conn.output_sent = 0;
+   conn.out_file.reset();
+   conn.state = conn_state::HEADER;
+   auto elapsed = chrono::steady_clock::now() - conn.request_start;
+   stats_request (conn.request_command,
+                  chrono::duration_cast<chrono::microseconds>
+                  (elapsed).count(), conn.request_failed);
+   trace_record (trace_point::REQUEST, conn.trace_start, 0,
+                 conn.request_command);
+   conn.meter.update (conn.socket.get_socket_fd());
+   return true;
+}
+
+
+// MRM is answered at once.  MGET frames are queued one file at a
+// time as send_reply gets to them, so only one file is open.
+void event_loop::start_batch (connection& conn) {
+   conn.header.filename[FILENAME_SIZE - 1] = '\0';
+   vector<string> names = batch_names (conn.header.filename,
+                                       conn.names);
+   string().swap (conn.names);
+   conn.batch_count = names.size();
+   if (conn.header.command == cxi_command::MGET) {
+      conn.batch.assign (names.begin(), names.end());
+      conn.batch_command = cxi_command::MGET;
+      conn.state = conn_state::REPLY;
+      return;
+   }
+   for (const auto& name: names) {
+      int error = ENAMETOOLONG;
+      if (name.size() < FILENAME_SIZE) {
+         error = unlink (name.c_str()) != 0 ? errno : 0;
+         touch_listing (name);
+      }
+      append_header (conn, conn.output, error != 0 ? cxi_command::NAK
+                     : cxi_command::ACK, error, name);
+   }
+   queue_reply (conn, cxi_command::END, conn.batch_count);
+}
+
+// Queue the frame for the next MGET file, or the END.
+void event_loop::next_batch_file (connection& conn) {
+   conn.output.clear();
+   conn.output_sent = 0;
+   if (conn.batch.empty()) {
+      conn.batch_command = cxi_command::ERROR;
+      queue_reply (conn, cxi_command::END, conn.batch_count);
+      return;
+   }
+   string name = move (conn.batch.front());
+   conn.batch.pop_front();
+   if (name.size() >= FILENAME_SIZE) {
+      queue_reply (conn, cxi_command::NAK, ENAMETOOLONG, name);
+      return;
+   }
+   queue_get (conn, name, name);
+}
+
+// Untagged, the cached frames are sent as they are.  Tagged, each
+// chunk is copied behind a header with the tag.
+void event_loop::queue_cached_ls (connection& conn) {
+   int error = 0;
+   auto snapshot = cached_listing (ls_format (ntohl (
+                                   conn.header.nbytes)), error);
+   if (snapshot == nullptr) {
+      queue_reply (conn, cxi_command::NAK, error);
+   }else if (conn.features & CXI_FEATURE_TAGS) {
+      for (const auto& [offset, nbytes]: snapshot->chunks) {
+         queue_reply (conn, cxi_command::LSOUT, nbytes);
+         conn.output.append (snapshot->frames, offset, nbytes);
+      }
+      queue_reply (conn, cxi_command::LSOUT, 0);
+   }else {
+      conn.out_shared = shared_ptr<const string> (snapshot,
+                                                  &snapshot->frames);
+      conn.out_shared_sent = 0;
+      conn.state = conn_state::REPLY;
+   }
+}
+
+// Queue the next LSOUT chunk, and the empty LSOUT once the listing
+// is done, or NAK if it could not be read to the end.
+void event_loop::next_ls_chunk (connection& conn) {
+   conn.output.clear();
+   conn.output_sent = 0;
+   string chunk;
+   bool more = conn.lister->next_chunk (chunk, transfer_chunk_size);
+   if (not chunk.empty()) {
+      queue_reply (conn, cxi_command::LSOUT, chunk.size());
+      conn.output.append (chunk);
+   }
+   if (not more) {
+      int error = conn.lister->get_error();
+      if (error != 0) {
+         outlog << "ls: " << strerror (error) << endl;
+         queue_reply (conn, cxi_command::NAK, error);
+      }else {
+         queue_reply (conn, cxi_command::LSOUT, 0);
+      }
+      conn.lister.reset();
+   }
+}
+
+
+void run_event_loops (server_socket& listener, int nloops) {
+   listener.set_non_blocking (true);
+   for (int loop = 1; loop < nloops; ++loop) {
+      pid_t pid = fork();
+      if (pid == 0) break;
+      if (pid < 0) {
+         outlog << "fork failed: " << strerror (errno) << endl;
+      }else {
+         outlog << "forked event loop pid " << pid << endl;
+      }
+   }
+   event_loop loop (listener);
+   loop.run();
+}
+
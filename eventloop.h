@@ -0,0 +1,28 @@
+// $Id: eventloop.h,v 1.1 2026-10-16 11:02:17-07 - - $
+
+//
+// epoll server mode
+// Instead of a process per client, each event loop multiplexes many
+// non-blocking client sockets with epoll.  A connection moves
+// through a small state machine: read a header, read the PUT
+// payload if there is one, write the reply.  While a reply is being
+// written no further requests are read from that client, so a
+// client that does not drain its socket only holds one chunk of
+// server memory.  SUM, which reads a whole file, and DPUT, which
+// needs a second request mid-reply, are refused with EOPNOTSUPP.
+// cxid refuses to start event loops that would sync files, keep a
+// store or cache hot files, since each would block the loop for
+// every connection.
+//
+
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#include "socket.h"
+
+// Runs nloops event loops, each in its own process, all accepting
+// from the same listener.  Does not return unless a loop fails.
+void run_event_loops (server_socket& listener, int nloops);
+
+#endif
+
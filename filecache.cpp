@@ -0,0 +1,200 @@
+// $Id: filecache.cpp,v 1.1 2026-10-16 16:10:42-07 - - $
+
+#include <cerrno>
+#include <iostream>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+using namespace std;
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#include "debug.h"
+#include "filecache.h"
+#include "socket.h"
+#include "transfer.h"
+
+size_t file_cache_budget = 0;
+admit_policy file_cache_admit = admit_policy::ALWAYS;
+
+//
+// class file_cache
+// LRU list of entries, most recent first, with an index by path.
+// Paths missed once are remembered in a bounded set for the SECOND
+// policy.
+//
+
+struct file_identity {
+   uint64_t device {};
+   uint64_t inode {};
+   int64_t mtime_sec {};
+   uint32_t mtime_nsec {};
+   uint64_t size {};
+   bool operator== (const file_identity&) const = default;
+};
+
+class file_cache {
+   private:
+      static constexpr size_t MAX_SEEN = 0x1000;
+      struct entry {
+         string path;
+         file_identity identity;
+         shared_ptr<const string> contents;
+      };
+      mutex lock;
+      list<entry> lru;
+      unordered_map<string,list<entry>::iterator> index;
+      unordered_set<string> seen;
+      file_cache_stats stats;
+      void erase (list<entry>::iterator itor);
+      void evict();
+   public:
+      shared_ptr<const string> lookup (const char* filename);
+      shared_ptr<const string> admit (const char* filename,
+                                      int file_fd);
+      void forget (const char* filename);
+      file_cache_stats get_stats();
+};
+
+static file_cache hot_files;
+
+static bool get_identity (int dir_fd, const char* filename, int flags,
+                          file_identity& identity) {
+   struct statx status;
+   int rc = statx (dir_fd, filename, flags,
+                   STATX_TYPE | STATX_INO | STATX_MTIME | STATX_SIZE,
+                   &status);
+   if (rc < 0 or not S_ISREG (status.stx_mode)) return false;
+   identity.device = makedev (status.stx_dev_major,
+                              status.stx_dev_minor);
+   identity.inode = status.stx_ino;
+   identity.mtime_sec = status.stx_mtime.tv_sec;
+   identity.mtime_nsec = status.stx_mtime.tv_nsec;
+   identity.size = status.stx_size;
+   return true;
+}
+
+void file_cache::erase (list<entry>::iterator itor) {
+   stats.bytes -= itor->contents->size();
+   --stats.files;
+   index.erase (itor->path);
+   lru.erase (itor);
+}
+
+void file_cache::evict() {
+   while (stats.bytes > file_cache_budget and not lru.empty()) {
+      DEBUGF ('c', "evict " << lru.back().path);
+      erase (prev (lru.end()));
+      ++stats.evicted;
+   }
+}
+
+shared_ptr<const string> file_cache::lookup (const char* filename) {
+   file_identity identity;
+   bool found = get_identity (AT_FDCWD, filename, 0, identity);
+   lock_guard<mutex> guard (lock);
+   auto itor = index.find (filename);
+   if (itor != index.end()) {
+      if (found and itor->second->identity == identity) {
+         lru.splice (lru.begin(), lru, itor->second);
+         ++stats.hits;
+         DEBUGF ('c', "hit " << filename << ", " << stats.hits
+                 << " hits " << stats.misses << " misses");
+         return lru.front().contents;
+      }
+      erase (itor->second);
+   }
+   ++stats.misses;
+   DEBUGF ('c', "miss " << filename << ", " << stats.hits
+           << " hits " << stats.misses << " misses");
+   return nullptr;
+}
+
+shared_ptr<const string> file_cache::admit (const char* filename,
+                                            int file_fd) {
+   file_identity identity;
+   if (not get_identity (file_fd, "", AT_EMPTY_PATH, identity)) {
+      return nullptr;
+   }
+   if (identity.size > file_cache_budget / 8) return nullptr;
+   {
+      lock_guard<mutex> guard (lock);
+      if (file_cache_admit == admit_policy::SECOND
+      and seen.erase (filename) == 0) {
+         if (seen.size() >= MAX_SEEN) seen.clear();
+         seen.insert (filename);
+         return nullptr;
+      }
+   }
+   auto contents = make_shared<string> (identity.size, '\0');
+   for (size_t have = 0; have < identity.size; ) {
+      ssize_t nbytes = ::pread (file_fd, contents->data() + have,
+                                identity.size - have, have);
+      if (nbytes < 0 and errno == EINTR) continue;
+      if (nbytes <= 0) return nullptr; // truncated or unreadable
+      have += nbytes;
+   }
+   lock_guard<mutex> guard (lock);
+   auto itor = index.find (filename);
+   if (itor != index.end()) erase (itor->second);
+   lru.push_front ({filename, identity, contents});
+   index[filename] = lru.begin();
+   stats.bytes += contents->size();
+   ++stats.files;
+   ++stats.admitted;
+   DEBUGF ('c', "admit " << filename << " " << contents->size());
+   evict();
+   return contents;
+}
+
+void file_cache::forget (const char* filename) {
+   lock_guard<mutex> guard (lock);
+   auto itor = index.find (filename);
+   if (itor != index.end()) erase (itor->second);
+}
+
+file_cache_stats file_cache::get_stats() {
+   lock_guard<mutex> guard (lock);
+   return stats;
+}
+
+
+shared_ptr<const string> cache_lookup (const char* filename) {
+   if (file_cache_budget == 0) return nullptr;
+   return hot_files.lookup (filename);
+}
+
+shared_ptr<const string> cache_admit (const char* filename,
+                                      int file_fd) {
+   if (file_cache_budget == 0) return nullptr;
+   return hot_files.admit (filename, file_fd);
+}
+
+void cache_forget (const char* filename) {
+   if (file_cache_budget == 0) return;
+   hot_files.forget (filename);
+}
+
+file_cache_stats cache_stats() {
+   return hot_files.get_stats();
+}
+
+size_t get_cache_budget (const string& budget_arg) {
+   uint64_t size = 0;
+   if (not parse_size (budget_arg, size)) {
+      throw socket_error (budget_arg + ": invalid cache budget");
+   }
+   return size;
+}
+
+admit_policy get_admit_policy (const string& policy_arg) {
+   if (policy_arg == "always") return admit_policy::ALWAYS;
+   if (policy_arg == "second") return admit_policy::SECOND;
+   throw socket_error (policy_arg + ": invalid admission policy");
+}
+
@@ -0,0 +1,64 @@
+// $Id: filecache.h,v 1.1 2026-10-16 16:10:42-07 - - $
+
+//
+// hot-file cache
+// Whole contents of frequently fetched small files, kept in memory
+// by cxid so a GET that hits needs one statx and no open or read.
+// An entry is keyed by the path in the request and is only used
+// while the file's device, inode, mtime and size still match.  The
+// cache holds at most file_cache_budget bytes and evicts the least
+// recently used files first.  Each server process has its own, so
+// cxid leaves it off in fork mode, whose processes each serve only
+// one connection.
+//
+
+#ifndef FILECACHE_H
+#define FILECACHE_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+using namespace std;
+
+// Bytes of file contents to keep.  0 turns the cache off.
+extern size_t file_cache_budget;
+
+// Which missed files are read into the cache.  ALWAYS admits any
+// file that fits; SECOND waits until a file is missed a second time,
+// so a one-off scan of many files does not flush the hot ones.
+// Files over an eighth of the budget are never admitted.
+enum class admit_policy { ALWAYS, SECOND };
+extern admit_policy file_cache_admit;
+
+struct file_cache_stats {
+   uint64_t hits {0};
+   uint64_t misses {0};
+   uint64_t admitted {0};
+   uint64_t evicted {0};
+   size_t files {0};
+   size_t bytes {0};
+};
+
+// The contents of filename if the cache has a current copy,
+// otherwise nullptr.  Counts a hit or a miss.
+shared_ptr<const string> cache_lookup (const char* filename);
+
+// After a miss, offer the file just opened as file_fd.  If the
+// policy admits it, reads it into the cache and returns the contents
+// to send; otherwise returns nullptr and the caller sends the file.
+shared_ptr<const string> cache_admit (const char* filename,
+                                      int file_fd);
+
+// Drop filename after changing or removing it.
+void cache_forget (const char* filename);
+
+file_cache_stats cache_stats();
+
+// Parse a budget such as 65536, 512K, 64M or 1G.
+size_t get_cache_budget (const string& budget_arg);
+
+// Parse an admission policy: always or second.
+admit_policy get_admit_policy (const string& policy_arg);
+
+#endif
+
@@ -0,0 +1,266 @@
+// $Id: listing.cpp,v 1.1 2026-10-16 11:02:17-07 - - $
+
+#include <cerrno>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "debug.h"
+#include "listing.h"
+
+bool listing_cache = true;
+
+static constexpr size_t DIRENT_BUFFER_SIZE = 0x8000;
+
+listing::listing (ls_format format_):
+         dir (".", O_RDONLY | O_DIRECTORY), format (format_),
+         buffer (make_unique<char[]> (DIRENT_BUFFER_SIZE)) {
+   if (not dir.is_open()) error = errno;
+}
+
+bool listing::next_entry (ls_record& record) {
+   for (;;) {
+      if (buffer_offset >= buffer_size) {
+         ssize_t nbytes = getdents64 (dir.get(), buffer.get(),
+                                      DIRENT_BUFFER_SIZE);
+         if (nbytes < 0) {
+            if (errno == EINTR) continue;
+            error = errno;
+            return false;
+         }
+         if (nbytes == 0) return false;
+         buffer_size = nbytes;
+         buffer_offset = 0;
+      }
+      auto entry = reinterpret_cast<const dirent64*> (buffer.get()
+                                                      + buffer_offset);
+      buffer_offset += entry->d_reclen;
+      if (entry->d_name[0] == '.') continue;
+      struct statx status;
+      int rc = statx (dir.get(), entry->d_name, AT_SYMLINK_NOFOLLOW,
+                      STATX_TYPE | STATX_MODE | STATX_SIZE
+                      | STATX_MTIME, &status);
+      if (rc < 0) continue; // removed since it was read
+      record.size = status.stx_size;
+      record.mtime = status.stx_mtime.tv_sec;
+      record.mode = status.stx_mode;
+      record.name = entry->d_name;
+      return true;
+   }
+}
+
+static void append_entry (string& chunk, ls_format format,
+                          const ls_record& record) {
+   if (format == ls_format::BINARY) {
+      pack_ls_record (chunk, record);
+   }else {
+      chunk.append (format_ls_record (record));
+      chunk.push_back ('\n');
+   }
+}
+
+bool listing::next_chunk (string& chunk, size_t max_size) {
+   ls_record record;
+   while (chunk.size() < max_size) {
+      if (error != 0 or not next_entry (record)) return false;
+      append_entry (chunk, format, record);
+   }
+   return true;
+}
+
+
+//
+// class ls_cache
+// The entries of the working directory by name, and a snapshot of
+// the reply in each format.  Entries are patched from inotify events
+// before each use, and snapshots are rebuilt from the entries when
+// something changed, so the directory is only scanned again if
+// inotify loses track of it.  A process forked after the cache was
+// filled starts over, as it cannot share the inotify queue.
+//
+
+class ls_cache {
+   private:
+      static constexpr uint32_t WATCH_MASK = IN_CREATE | IN_DELETE
+            | IN_MOVED_FROM | IN_MOVED_TO | IN_MODIFY | IN_CLOSE_WRITE
+            | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF;
+      mutex lock;
+      pid_t owner {0};
+      int inotify_fd {-1};
+      bool valid {false};
+      map<string,ls_record> entries;
+      shared_ptr<const ls_snapshot> snapshots[2];
+      void reset();
+      int rescan();
+      void read_events();
+      void patch (const string& name);
+      shared_ptr<const ls_snapshot> build (ls_format format);
+   public:
+      ~ls_cache() { reset(); }
+      shared_ptr<const ls_snapshot> get (ls_format format, int& error);
+      void touch (const string& name);
+};
+
+static ls_cache the_cache;
+
+void ls_cache::reset() {
+   if (inotify_fd >= 0) ::close (inotify_fd);
+   inotify_fd = -1;
+   owner = getpid();
+   valid = false;
+   entries.clear();
+   for (auto& snapshot: snapshots) snapshot.reset();
+}
+
+int ls_cache::rescan() {
+   reset();
+   inotify_fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+   if (inotify_fd >= 0
+   and inotify_add_watch (inotify_fd, ".", WATCH_MASK) < 0) {
+      ::close (inotify_fd);
+      inotify_fd = -1;
+   }
+   if (inotify_fd < 0) {
+      DEBUGF ('l', "inotify: " << strerror (errno));
+   }
+   listing dir (ls_format::TEXT);
+   ls_record record;
+   while (dir.next_entry (record)) entries[record.name] = record;
+   if (dir.get_error() != 0) {
+      entries.clear();
+      return dir.get_error();
+   }
+   valid = inotify_fd >= 0; // otherwise nothing will keep it current
+   return 0;
+}
+
+void ls_cache::read_events() {
+   alignas (inotify_event) char buffer[0x1000];
+   for (;;) {
+      ssize_t nbytes = ::read (inotify_fd, buffer, sizeof buffer);
+      if (nbytes < 0) {
+         if (errno == EINTR) continue;
+         if (errno != EAGAIN) valid = false;
+         break;
+      }
+      for (ssize_t offset = 0; offset < nbytes; ) {
+         auto event = reinterpret_cast<const inotify_event*>
+                      (buffer + offset);
+         offset += sizeof (inotify_event) + event->len;
+         if (event->mask & (IN_Q_OVERFLOW | IN_IGNORED
+                            | IN_DELETE_SELF | IN_MOVE_SELF)) {
+            valid = false;
+         }else if (event->len > 0) {
+            patch (event->name);
+         }
+      }
+   }
+}
+
+void ls_cache::patch (const string& name) {
+   if (name.empty() or name[0] == '.') return;
+   if (name.find ('/') != string::npos) return;
+   struct statx status;
+   int rc = statx (AT_FDCWD, name.c_str(), AT_SYMLINK_NOFOLLOW,
+                   STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_MTIME,
+                   &status);
+   if (rc < 0) {
+      entries.erase (name);
+   }else {
+      ls_record& record = entries[name];
+      record.size = status.stx_size;
+      record.mtime = status.stx_mtime.tv_sec;
+      record.mode = status.stx_mode;
+      record.name = name;
+   }
+   for (auto& snapshot: snapshots) snapshot.reset();
+}
+
+shared_ptr<const ls_snapshot> ls_cache::build (ls_format format) {
+   auto snapshot = make_shared<ls_snapshot>();
+   string& frames = snapshot->frames;
+   cxi_header header;
+   header.command = cxi_command::LSOUT;
+   char wire_header[MAX_HEADER_WIRE];
+   size_t header_size = pack_header (wire_header, header, nullptr, 0);
+   auto itor = entries.cbegin();
+   while (itor != entries.cend()) {
+      size_t start = frames.size();
+      frames.append (header_size, '\0');
+      size_t payload = frames.size();
+      for (; itor != entries.cend(); ++itor) {
+         if (frames.size() - payload >= transfer_chunk_size) break;
+         append_entry (frames, format, itor->second);
+      }
+      size_t nbytes = frames.size() - payload;
+      pack_header (wire_header, header, nullptr, nbytes);
+      frames.replace (start, header_size, wire_header, header_size);
+      snapshot->chunks.emplace_back (payload, nbytes);
+   }
+   pack_header (wire_header, header, nullptr, 0);
+   frames.append (wire_header, header_size);
+   return snapshot;
+}
+
+shared_ptr<const ls_snapshot> ls_cache::get (ls_format format,
+                                             int& error) {
+   lock_guard<mutex> guard (lock);
+   if (owner != getpid()) reset();
+   if (inotify_fd >= 0) read_events();
+   if (not valid) {
+      error = rescan();
+      if (error != 0) return nullptr;
+   }
+   auto& snapshot = snapshots[format == ls_format::BINARY];
+   if (snapshot == nullptr) snapshot = build (format);
+   return snapshot;
+}
+
+void ls_cache::touch (const string& name) {
+   lock_guard<mutex> guard (lock);
+   if (valid and owner == getpid()) patch (name);
+}
+
+shared_ptr<const ls_snapshot> cached_listing (ls_format format,
+                                              int& error) {
+   return the_cache.get (format, error);
+}
+
+void touch_listing (const string& name) {
+   if (listing_cache) the_cache.touch (name);
+}
+
+vector<string> batch_names (const string& pattern,
+                            const string& names) {
+   vector<string> result;
+   if (pattern.empty()) {
+      size_t begin = 0;
+      while (begin < names.size()) {
+         size_t end = names.find ('\n', begin);
+         if (end == string::npos) end = names.size();
+         if (end > begin) {
+            result.emplace_back (names, begin, end - begin);
+         }
+         begin = end + 1;
+      }
+      return result;
+   }
+   glob_t matches {};
+   if (glob (pattern.c_str(), 0, nullptr, &matches) == 0) {
+      result.assign (matches.gl_pathv,
+                     matches.gl_pathv + matches.gl_pathc);
+   }
+   globfree (&matches);
+   return result;
+}
@@ -0,0 +1,79 @@
+// $Id: listing.h,v 1.1 2026-10-16 11:02:17-07 - - $
+
+//
+// directory listing
+// produces the LSOUT payload for the server's working directory
+//
+
+#ifndef LISTING_H
+#define LISTING_H
+
+#include <memory>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "protocol.h"
+#include "transfer.h"
+
+//
+// class listing
+// Reads the working directory a buffer at a time with getdents64,
+// stats each entry with statx and formats the entries into LSOUT
+// chunks, so a large directory is never held in memory at once.
+// Entries come in directory order.  Names starting with a dot are
+// left out, as ls does.
+//
+
+class listing {
+   private:
+      open_file dir;
+      ls_format format;
+      int error {0};
+      unique_ptr<char[]> buffer;
+      size_t buffer_size {0};
+      size_t buffer_offset {0};
+   public:
+      explicit listing (ls_format format);
+      int get_error() const { return error; } // 0 or errno
+
+      // The next entry, or false once the directory is done.
+      bool next_entry (ls_record& record);
+
+      // Append whole entries to chunk until it holds at least
+      // max_size bytes.  Returns false once the directory is done.
+      bool next_chunk (string& chunk, size_t max_size);
+};
+
+// When set, each process keeps the listing of its working directory
+// in memory, kept current with inotify and by touch_listing, so a
+// repeated LS is one send of ready-made LSOUT frames.  The cached
+// listing is sorted by name.  cxid leaves it off in fork mode, whose
+// processes each serve only one connection.
+extern bool listing_cache;
+
+//
+// struct ls_snapshot
+// a complete LSOUT reply, ready to send
+//
+
+struct ls_snapshot {
+   string frames;  // the untagged reply, ending with an empty LSOUT
+   vector<pair<size_t,size_t>> chunks; // offset and size of payloads
+};
+
+// The cached listing in the given format.  Returns nullptr and sets
+// error if the directory cannot be read.
+shared_ptr<const ls_snapshot> cached_listing (ls_format format,
+                                              int& error);
+
+// Bring the cached entry for name up to date after changing it.
+void touch_listing (const string& name);
+
+// Files named by a batch request: those matching pattern, sorted, if
+// pattern is not empty, otherwise the non-empty lines of names.
+vector<string> batch_names (const string& pattern,
+                            const string& names);
+
+#endif
+
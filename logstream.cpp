@@ -0,0 +1,162 @@
+// $Id: logstream.cpp,v 1.1 2026-10-17 02:41:09-07 - - $
+
+#include <algorithm>
+#include <new>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <pthread.h>
+#include <signal.h>
+
+#include "logstream.h"
+
+// Every logstream, so that the fork handlers can reach them.
+static vector<logstream*>& all_logstreams() {
+   static vector<logstream*> logs;
+   return logs;
+}
+
+logstream::logstream (ostream& out, const string& execname):
+           out_ (out), execname_ (execname), pid_ (getpid()) {
+   set_prefix();
+   static once_flag handlers;
+   call_once (handlers, []() {
+      pthread_atfork (before_fork, after_fork_parent, after_fork_child);
+   });
+   all_logstreams().push_back (this);
+}
+
+logstream::~logstream() {
+   stop_drain();
+   auto& logs = all_logstreams();
+   logs.erase (remove (logs.begin(), logs.end(), this), logs.end());
+}
+
+void logstream::set_prefix() {
+   prefix_ = execname_ + "(" + to_string (pid_) + "): ";
+}
+
+void logstream::buffered (bool on) {
+   if (not on) flush();
+   lock_guard<mutex> guard (lock_);
+   buffered_ = on;
+}
+
+void logstream::write (const string& text) {
+   unique_lock<mutex> guard (lock_);
+   assert (execname_.size() > 0);
+   if (not buffered_) {
+      lock_guard<mutex> writing (out_lock_);
+      out_ << prefix_ << text;
+      out_.flush();
+      return;
+   }
+   drained_.wait (guard, [this]() {
+      return pending_.size() < MAX_PENDING;
+   });
+   if (drain_ == nullptr) {
+      stopping_ = false;
+      start_drain();
+   }
+   bool was_empty = pending_.empty();
+   pending_ += prefix_;
+   pending_ += text;
+   if (was_empty) ready_.notify_one();
+}
+
+// The drain thread starts with every signal blocked, so that no
+// handler ever runs on it while it holds lock_.
+void logstream::start_drain() {
+   sigset_t all_signals;
+   sigset_t saved;
+   sigfillset (&all_signals);
+   pthread_sigmask (SIG_SETMASK, &all_signals, &saved);
+   try {
+      drain_ = make_unique<thread> (&logstream::drain_loop, this);
+   }catch (...) {
+      pthread_sigmask (SIG_SETMASK, &saved, nullptr);
+      throw;
+   }
+   pthread_sigmask (SIG_SETMASK, &saved, nullptr);
+}
+
+// Lines that gather while one batch is being written go out together
+// in the next.  Batches are handed from lock_ to out_lock_ without a
+// gap, so that flush cannot write a later batch before this one.
+void logstream::drain_loop() {
+   unique_lock<mutex> guard (lock_);
+   for (;;) {
+      ready_.wait (guard, [this]() {
+         return stopping_ or not pending_.empty();
+      });
+      if (pending_.empty()) break;
+      string batch;
+      batch.swap (pending_);
+      drained_.notify_all();
+      unique_lock<mutex> writing (out_lock_);
+      guard.unlock();
+      out_.write (batch.data(), batch.size());
+      out_.flush();
+      writing.unlock();
+      guard.lock();
+   }
+}
+
+void logstream::stop_drain() {
+   {
+      lock_guard<mutex> guard (lock_);
+      if (drain_ == nullptr) return;
+      stopping_ = true;
+      ready_.notify_one();
+   }
+   drain_->join();
+   lock_guard<mutex> guard (lock_);
+   drain_.reset();
+}
+
+void logstream::flush() {
+   lock_guard<mutex> guard (lock_);
+   lock_guard<mutex> writing (out_lock_);
+   out_.write (pending_.data(), pending_.size());
+   out_.flush();
+   pending_.clear();
+   drained_.notify_all();
+}
+
+// The forking thread holds both locks across the fork, so the child
+// starts with no line half written and none pending.
+void logstream::before_fork() {
+   for (logstream* log: all_logstreams()) {
+      log->lock_.lock();
+      log->out_lock_.lock();
+      log->out_.write (log->pending_.data(), log->pending_.size());
+      log->out_.flush();
+      log->pending_.clear();
+   }
+}
+
+void logstream::after_fork_parent() {
+   for (logstream* log: all_logstreams()) {
+      log->out_lock_.unlock();
+      log->lock_.unlock();
+   }
+}
+
+// Only the forking thread exists in the child.  The drain thread is
+// left behind, so its handle is dropped rather than joined, and the
+// condition variables are made anew over the old ones, which may
+// still count threads of the parent as waiting, and which therefore
+// cannot be destroyed.  The next line starts another drain.
+void logstream::after_fork_child() {
+   for (logstream* log: all_logstreams()) {
+      log->drain_.release();
+      new (&log->ready_) condition_variable;
+      new (&log->drained_) condition_variable;
+      log->pid_ = getpid();
+      log->set_prefix();
+      log->out_lock_.unlock();
+      log->lock_.unlock();
+   }
+}
+
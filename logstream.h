@@ -1,4 +1,4 @@
-// $Id: logstream.h,v 1.7 2021-12-20 12:58:11-08 - - $
+// $Id: logstream.h,v 1.8 2026-10-17 02:41:09-07 - - $
 
 //
 // class logstream
@@ -7,13 +7,31 @@
 // and a process id.  Template functions must be in header files
 // and the others are trivial.
 //
+// A statement's output is collected in a logstream::line and written
+// in one piece under a mutex when the statement ends, so lines from
+// different threads do not interleave.
+//
+// A buffered logstream only appends the line to a pending buffer,
+// and a drain thread writes whatever has gathered with one write and
+// one flush, so a busy server does not wait on its terminal or log
+// file.  The pending lines are written before a fork, so that the
+// child does not write them again, and when the logstream is
+// destroyed at exit.  The process id in the prefix is looked up once
+// and again after each fork.  A signal handler must not log, since
+// it may interrupt a thread holding the lock.
+//
 
 #ifndef LOGSTREAM_H
 #define LOGSTREAM_H
 
 #include <cassert>
+#include <condition_variable>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 using namespace std;
 
@@ -24,27 +42,107 @@ class logstream {
    private:
       ostream& out_;
       string execname_;
+      pid_t pid_;
+      string prefix_;          // execname(pid):
+      mutex lock_;
+
+      // buffered output
+      static constexpr size_t MAX_PENDING = 1 << 20;
+      bool buffered_ {false};
+      string pending_;
+      condition_variable ready_;   // pending_ has lines, or stopping_
+      condition_variable drained_; // pending_ has room
+      unique_ptr<thread> drain_;   // running in this process
+      bool stopping_ {false};
+      mutex out_lock_;             // held while writing to out_
+
+      void set_prefix();
+      void start_drain();
+      void drain_loop();
+      void stop_drain();
+      static void before_fork();
+      static void after_fork_parent();
+      static void after_fork_child();
    public:
 
       // Constructor may or may not have the execname available.
-      logstream (ostream& out, const string& execname = ""):
-                 out_ (out), execname_ (execname) {
-      }
+      logstream (ostream& out, const string& execname = "");
+      ~logstream();
 
       // First line of main should set execname if logstream is global.
-      void execname (const string& name) { execname_ = name; }
-      string execname() { return execname_; }
+      void execname (const string& name) {
+         lock_guard<mutex> guard (lock_);
+         execname_ = name;
+         set_prefix();
+      }
+      string execname() {
+         lock_guard<mutex> guard (lock_);
+         return execname_;
+      }
+
+      // Whether lines are handed to a drain thread, or written by
+      // the statement that logs them.
+      void buffered (bool on);
+
+      // Write any pending lines now.
+      void flush();
+
+      class line {
+         private:
+            logstream& log_;
+            ostringstream text_;
+         public:
+            template <typename T>
+            line (logstream& log, const T& obj): log_ (log) {
+               text_ << obj;
+            }
+            line (const line&) = delete;
+            line& operator= (const line&) = delete;
+            ~line() { log_.write (text_.str()); }
+            template <typename T>
+            line& operator<< (const T& obj) {
+               text_ << obj;
+               return *this;
+            }
+            line& operator<< (ostream& (*manip) (ostream&)) {
+               manip (text_);
+               return *this;
+            }
+      };
 
       // First call should be the logstream, not cout.
-      // Then forward result to the standard ostream.
+      // The line is written when the statement ends.
       template <typename T>
-      ostream& operator<< (const T& obj) {
-         assert (execname_.size() > 0);
-         out_ << execname_ << "(" << getpid() << "): " << obj;
-         return out_;
+      line operator<< (const T& obj) {
+         return line (*this, obj);
       }
 
+      void write (const string& text);
+
 };
 
+
+// log_level -
+//    How much a LOGF statement says.  Those above LOG_LEVEL, which
+//    is set when building, are discarded by the compiler, so routine
+//    lines on the connection path cost nothing once turned off.
+//    Lines written straight to outlog are always kept.
+// LOGF -
+//    Macro which writes to outlog at a level.
+//    Example:
+//       LOGF (INFO, "accepted " << to_string (socket));
+
+enum class log_level { ERROR, WARNING, INFO, TRACE };
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL INFO
+#endif
+
+#define LOGF(LEVEL,CODE) { \
+           if constexpr (log_level::LEVEL <= log_level::LOG_LEVEL) { \
+              outlog << CODE << endl; \
+           } \
+        }
+
 #endif
 
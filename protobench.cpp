@@ -0,0 +1,226 @@
+// $Id: protobench.cpp,v 1.1 2026-10-17 02:04:51-07 - - $
+// protocol and socket layer microbenchmarks
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+using namespace std;
+
+#include <fcntl.h>
+#include <libgen.h>
+#include <unistd.h>
+
+#include "protocol.h"
+#include "socket.h"
+#include "transfer.h"
+
+string execname;
+
+// Every result is a line of five columns separated by spaces, after
+// a header line, so that runs can be kept and compared with awk or
+// a spreadsheet:  benchmark, size in bytes, rounds, nanoseconds per
+// round, and megabytes per second where a size is moved.
+void print_result (const string& name, size_t size, size_t rounds,
+                   double seconds) {
+   double ns_round = seconds * 1e9 / rounds;
+   double mb_sec = size == 0 ? 0 : size * rounds / seconds / 1e6;
+   cout << left << setw (20) << name << right << setw (10) << size
+        << setw (10) << rounds << fixed << setprecision (1)
+        << setw (12) << ns_round << setw (10) << mb_sec << endl;
+}
+
+double time_rounds (size_t rounds, const function<void()>& round) {
+   auto start = chrono::steady_clock::now();
+   for (size_t count = 0; count < rounds; ++count) round();
+   chrono::duration<double> elapsed = chrono::steady_clock::now()
+                                    - start;
+   return elapsed.count();
+}
+
+// The sender runs in a thread of its own while the caller times the
+// receiver, so that neither waits on a full socket buffer for long.
+double time_stream (size_t rounds, const function<void()>& send,
+                    const function<void()>& recv) {
+   thread sender ([&]() { for (size_t count = 0; count < rounds;
+                                ++count) send(); });
+   double seconds = time_rounds (rounds, recv);
+   sender.join();
+   return seconds;
+}
+
+size_t rounds_for (size_t size, size_t total) {
+   return max<size_t> (total / max<size_t> (size, 1), 8);
+}
+
+
+// Two connected ends of a socketpair.
+void unix_pair (int fds[2]) {
+   if (::socketpair (AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+      throw socket_sys_error ("socketpair");
+   }
+}
+
+// The port a listening socket was given by the kernel.
+in_port_t bound_port (const base_socket& listener) {
+   sockaddr_in address {};
+   socklen_t length = sizeof address;
+   if (::getsockname (listener.get_socket_fd(),
+                      reinterpret_cast<sockaddr*> (&address),
+                      &length) < 0) {
+      throw socket_sys_error ("getsockname");
+   }
+   return ntohs (address.sin_port);
+}
+
+
+void bench_packets (const string& name, base_socket& left,
+                    base_socket& right, char* buffer, size_t total) {
+   for (size_t size = 64; size <= 1 << 20; size *= 4) {
+      size_t rounds = rounds_for (size, total);
+      auto receiver = make_unique<char[]> (size);
+      double seconds = time_stream (rounds,
+            [&]() { send_packet (left, buffer, size); },
+            [&]() { recv_packet (right, receiver.get(), size); });
+      print_result (name, size, rounds, seconds);
+   }
+   // a header each way, as a lock-step request and reply would be
+   constexpr size_t ROUND_TRIPS = 20000;
+   char header[HEADER_SIZE] {};
+   thread echo ([&]() {
+      char reply[HEADER_SIZE];
+      for (size_t count = 0; count < ROUND_TRIPS; ++count) {
+         recv_packet (right, reply, sizeof reply);
+         send_packet (right, reply, sizeof reply);
+      }
+   });
+   double seconds = time_rounds (ROUND_TRIPS, [&]() {
+      send_packet (left, header, sizeof header);
+      recv_packet (left, header, sizeof header);
+   });
+   echo.join();
+   print_result (name + "-rtt", HEADER_SIZE, ROUND_TRIPS, seconds);
+}
+
+// base_socket::recv no longer clears the buffer before each call;
+// this is what doing so would cost, to set beside the packet rows.
+void bench_memset (char* buffer, size_t total) {
+   for (size_t size = 64; size <= 1 << 20; size *= 4) {
+      size_t rounds = rounds_for (size, total);
+      double seconds = time_rounds (rounds, [&]() {
+         memset (buffer, 0, size);
+         asm volatile ("" : : "r" (buffer) : "memory");
+      });
+      print_result ("recv-memset", size, rounds, seconds);
+   }
+}
+
+void bench_headers() {
+   constexpr size_t ROUNDS = 1 << 20;
+   cxi_header header;
+   header.command = cxi_command::PUT;
+   strcpy (header.filename, "protobench.data");
+   cxi_tag tag {12345, CXI_TAG_COMPRESSED};
+   char buffer[MAX_HEADER_WIRE];
+   size_t length = 0;
+   auto pack = [&](const cxi_tag* with_tag, uint64_t nbytes) {
+      return time_rounds (ROUNDS, [&]() {
+         length += pack_header (buffer, header, with_tag, nbytes);
+         asm volatile ("" : : "r" (buffer) : "memory");
+      });
+   };
+   print_result ("header-pack", 0, ROUNDS, pack (nullptr, 4096));
+   print_result ("header-pack-tag", 0, ROUNDS, pack (&tag, 4096));
+   print_result ("header-pack-ext", 0, ROUNDS,
+                 pack (&tag, uint64_t (1) << 33));
+   asm volatile ("" : : "r" (length)); // the lengths are used
+   ostringstream out;
+   double seconds = time_rounds (ROUNDS / 16, [&]() {
+      out.str ("");
+      out << header;
+   });
+   print_result ("header-print", 0, ROUNDS / 16, seconds);
+   seconds = time_rounds (ROUNDS, [&]() {
+      length += to_string (header.command).size();
+   });
+   print_result ("command-string", 0, ROUNDS, seconds);
+}
+
+// send_file and recv_file against file size, over a socketpair so
+// that the socket costs as little as it can.
+void bench_files (const string& dir, char* buffer, size_t total) {
+   string filename = dir + "/.protobench-" + to_string (getpid());
+   open_file file (filename.c_str(), O_RDWR | O_CREAT | O_TRUNC,
+                   0600);
+   if (not file.is_open()) throw socket_sys_error (filename);
+   ::unlink (filename.c_str());
+   for (size_t size = 4096; size <= 1 << 26; size *= 4) {
+      size_t rounds = rounds_for (size, total);
+      int fds[2];
+      unix_pair (fds);
+      accepted_socket left (fds[0]);
+      accepted_socket right (fds[1]);
+      double seconds = time_stream (rounds,
+            [&]() {
+               for (size_t sent = 0; sent < size; sent += 1 << 20) {
+                  send_packet (left, buffer,
+                               min<size_t> (size - sent, 1 << 20));
+               }
+            },
+            [&]() {
+               ::lseek (file.get(), 0, SEEK_SET);
+               int error = recv_file (right, file.get(), size);
+               if (error != 0) throw socket_error (strerror (error));
+            });
+      print_result ("file-recv", size, rounds, seconds);
+      seconds = time_stream (rounds,
+            [&]() {
+               ::lseek (file.get(), 0, SEEK_SET);
+               send_file (left, file.get(), size);
+            },
+            [&]() { discard_payload (right, size); });
+      print_result ("file-send", size, rounds, seconds);
+   }
+}
+
+int main (int argc, char** argv) {
+   execname = basename (argv[0]);
+   size_t total = argc > 1 ? stoul (argv[1]) << 20 : 1 << 28;
+   string dir = argc > 2 ? argv[2] : ".";
+   constexpr size_t MAX_SIZE = 1 << 20;
+   auto buffer = make_unique<char[]> (MAX_SIZE);
+   for (size_t index = 0; index < MAX_SIZE; ++index) {
+      buffer[index] = char (index * 2654435761u >> 24);
+   }
+   try {
+      cout << left << setw (20) << "benchmark" << right
+           << setw (10) << "size" << setw (10) << "rounds"
+           << setw (12) << "ns/round" << setw (10) << "MB/s" << endl;
+      int fds[2];
+      unix_pair (fds);
+      accepted_socket unix_left (fds[0]);
+      accepted_socket unix_right (fds[1]);
+      bench_packets ("packet-socketpair", unix_left, unix_right,
+                     buffer.get(), total);
+      server_socket listener (0);
+      client_socket tcp_left ("127.0.0.1", bound_port (listener));
+      accepted_socket tcp_right;
+      listener.accept (tcp_right);
+      bench_packets ("packet-loopback", tcp_left, tcp_right,
+                     buffer.get(), total);
+      bench_memset (buffer.get(), total);
+      bench_headers();
+      bench_files (dir, buffer.get(), total);
+   }catch (socket_error& error) {
+      cerr << execname << ": " << error.what() << endl;
+      return EXIT_FAILURE;
+   }
+   return EXIT_SUCCESS;
+}
+
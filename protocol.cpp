@@ -1,12 +1,17 @@
 // $Id: protocol.cpp,v 1.17 2021-05-18 01:32:29-07 - - $
 
+#include <cstring>
+#include <ctime>
 #include <iomanip>
 #include <iostream>
 #include <limits>
+#include <sstream>
 #include <string>
 #include <unordered_map>
 using namespace std;
 
+#include <sys/stat.h>
+
 #include "protocol.h"
 
 string to_string (cxi_command command) {
@@ -22,6 +27,21 @@ string to_string (cxi_command command) {
       case cxi_command::LSOUT  : return "LSOUT"  ;
       case cxi_command::ACK    : return "ACK"    ;
       case cxi_command::NAK    : return "NAK"    ;
+      case cxi_command::HELLO  : return "HELLO"  ;
+      case cxi_command::MGET   : return "MGET"   ;
+      case cxi_command::MPUT   : return "MPUT"   ;
+      case cxi_command::MRM    : return "MRM"    ;
+      case cxi_command::END    : return "END"    ;
+      case cxi_command::DPUT   : return "DPUT"   ;
+      case cxi_command::SIGS   : return "SIGS"   ;
+      case cxi_command::DELTA  : return "DELTA"  ;
+      case cxi_command::GETRANGE: return "GETRANGE";
+      case cxi_command::PUTAT  : return "PUTAT"  ;
+      case cxi_command::SIZE   : return "SIZE"   ;
+      case cxi_command::SUM    : return "SUM"    ;
+      case cxi_command::HAVE   : return "HAVE"   ;
+      case cxi_command::STATS  : return "STATS"  ;
+      case cxi_command::TRACE  : return "TRACE"  ;
       default                  : return "????"   ;
    };
 }
@@ -31,25 +51,158 @@ void send_packet (base_socket& socket,
                   const void* buffer, size_t bufsize) {
    const char* bufptr = static_cast<const char*> (buffer);
    ssize_t ntosend = bufsize;
-   do {
+   while (ntosend > 0) {
       ssize_t nbytes = socket.send (bufptr, ntosend);
       if (nbytes < 0) throw socket_sys_error (to_string (socket));
       bufptr += nbytes;
       ntosend -= nbytes;
-   }while (ntosend > 0);
+   }
 }
 
 void recv_packet (base_socket& socket, void* buffer, size_t bufsize) {
    char* bufptr = static_cast<char*> (buffer);
    ssize_t ntorecv = bufsize;
-   do {
+   while (ntorecv > 0) {
       ssize_t nbytes = socket.recv (bufptr, ntorecv);
       if (nbytes < 0) throw socket_sys_error (to_string (socket));
       if (nbytes == 0) throw socket_error (to_string (socket)
                                            + " is closed");
       bufptr += nbytes;
       ntorecv -= nbytes;
-   }while (ntorecv > 0);
+   }
+}
+
+size_t pack_header (char* buffer, cxi_header& header,
+                    const cxi_tag* tag, uint64_t nbytes) {
+   bool extended = nbytes >= NBYTES_EXTENDED;
+   header.nbytes = htonl (extended ? NBYTES_EXTENDED : nbytes);
+   memcpy (buffer, &header, sizeof header);
+   size_t length = sizeof header;
+   if (tag != nullptr) {
+      uint32_t wire_tag[2] {htonl (tag->request_id),
+                            htonl (tag->flags)};
+      memcpy (buffer + length, wire_tag, sizeof wire_tag);
+      length += sizeof wire_tag;
+   }
+   if (extended) {
+      uint32_t wire_size[2] {htonl (nbytes >> 32), htonl (nbytes)};
+      memcpy (buffer + length, wire_size, sizeof wire_size);
+      length += sizeof wire_size;
+   }
+   return length;
+}
+
+void cxi_channel::send_header (cxi_header& header, uint64_t nbytes) {
+   char buffer[MAX_HEADER_WIRE];
+   size_t length = pack_header (buffer, header,
+                                tagged() ? &send_tag : nullptr, nbytes);
+   send_packet (socket, buffer, length);
+   if (header.command == cxi_command::NAK) ++naks_sent;
+}
+
+void cxi_channel::recv_header (cxi_header& header) {
+   recv_packet (socket, &header, sizeof header);
+   if (not tagged()) return;
+   uint32_t wire_tag[2];
+   recv_packet (socket, wire_tag, sizeof wire_tag);
+   recv_tag.request_id = ntohl (wire_tag[0]);
+   recv_tag.flags = ntohl (wire_tag[1]);
+}
+
+uint64_t cxi_channel::recv_payload_size (const cxi_header& header) {
+   uint32_t nbytes = ntohl (header.nbytes);
+   if (nbytes != NBYTES_EXTENDED) return nbytes;
+   uint32_t wire_size[2];
+   recv_packet (socket, wire_size, sizeof wire_size);
+   return uint64_t (ntohl (wire_size[0])) << 32 | ntohl (wire_size[1]);
+}
+
+void pack_range (char* buffer, uint64_t offset, uint64_t extent) {
+   uint32_t words[4] {htonl (offset >> 32), htonl (offset),
+                      htonl (extent >> 32), htonl (extent)};
+   memcpy (buffer, words, sizeof words);
+}
+
+void unpack_range (const char* buffer, uint64_t& offset,
+                   uint64_t& extent) {
+   uint32_t words[4];
+   memcpy (words, buffer, sizeof words);
+   offset = uint64_t (ntohl (words[0])) << 32 | ntohl (words[1]);
+   extent = uint64_t (ntohl (words[2])) << 32 | ntohl (words[3]);
+}
+
+
+void pack_ls_record (string& output, const ls_record& record) {
+   uint32_t fixed[5] {
+      htonl (record.size >> 32), htonl (record.size),
+      htonl (uint64_t (record.mtime) >> 32),
+      htonl (record.mtime), htonl (record.mode),
+   };
+   uint16_t name_size = htons (record.name.size());
+   output.append (reinterpret_cast<const char*> (fixed), sizeof fixed);
+   output.append (reinterpret_cast<const char*> (&name_size),
+                  sizeof name_size);
+   output.append (record.name);
+}
+
+bool unpack_ls_record (const string& input, size_t& offset,
+                       ls_record& record) {
+   if (input.size() - offset < LS_RECORD_FIXED) return false;
+   uint32_t fixed[5];
+   uint16_t name_size;
+   memcpy (fixed, input.data() + offset, sizeof fixed);
+   memcpy (&name_size, input.data() + offset + sizeof fixed,
+           sizeof name_size);
+   name_size = ntohs (name_size);
+   if (input.size() - offset - LS_RECORD_FIXED < name_size) {
+      return false;
+   }
+   record.size = uint64_t (ntohl (fixed[0])) << 32 | ntohl (fixed[1]);
+   record.mtime = int64_t (uint64_t (ntohl (fixed[2])) << 32
+                           | ntohl (fixed[3]));
+   record.mode = ntohl (fixed[4]);
+   record.name.assign (input, offset + LS_RECORD_FIXED, name_size);
+   offset += LS_RECORD_FIXED + name_size;
+   return true;
+}
+
+// Mode in the form ls -l shows it, e.g. -rw-r--r--.
+static string mode_string (uint32_t mode) {
+   string result = "?---------";
+   switch (mode & S_IFMT) {
+      case S_IFREG:  result[0] = '-'; break;
+      case S_IFDIR:  result[0] = 'd'; break;
+      case S_IFLNK:  result[0] = 'l'; break;
+      case S_IFCHR:  result[0] = 'c'; break;
+      case S_IFBLK:  result[0] = 'b'; break;
+      case S_IFIFO:  result[0] = 'p'; break;
+      case S_IFSOCK: result[0] = 's'; break;
+   }
+   static const char rwx[] = "rwxrwxrwx";
+   for (int bit = 0; bit < 9; ++bit) {
+      if (mode & (0400 >> bit)) result[bit + 1] = rwx[bit];
+   }
+   if (mode & S_ISUID) result[3] = mode & S_IXUSR ? 's' : 'S';
+   if (mode & S_ISGID) result[6] = mode & S_IXGRP ? 's' : 'S';
+   if (mode & S_ISVTX) result[9] = mode & S_IXOTH ? 't' : 'T';
+   return result;
+}
+
+string format_ls_record (const ls_record& record) {
+   // like ls, show the year instead of the time if not recent
+   constexpr time_t SIX_MONTHS = 183 * 24 * 60 * 60;
+   time_t mtime = record.mtime;
+   time_t now = time (nullptr);
+   bool recent = mtime <= now and now - mtime < SIX_MONTHS;
+   struct tm local {};
+   localtime_r (&mtime, &local);
+   char when[32];
+   strftime (when, sizeof when, recent ? "%b %e %H:%M" : "%b %e  %Y",
+             &local);
+   ostringstream line;
+   line << mode_string (record.mode) << " " << setw (10) << record.size
+        << " " << when << " " << record.name;
+   return line.str();
 }
 
 
@@ -4,12 +4,15 @@
 #define PROTOCOL_H
 
 #include <cstdint>
+#include <string>
 using namespace std;
 
 #include "socket.h"
 
 enum class cxi_command : uint8_t {
    ERROR = 0, EXIT, GET, HELP, LS, PUT, RM, FILEOUT, LSOUT, ACK, NAK,
+   HELLO, MGET, MPUT, MRM, END, DPUT, SIGS, DELTA,
+   GETRANGE, PUTAT, SIZE, SUM, HAVE, STATS, TRACE,
 };
 
 constexpr size_t FILENAME_SIZE = 59;
@@ -23,11 +26,189 @@ struct cxi_header {
 
 static_assert (sizeof (cxi_header) == HEADER_SIZE);
 
+// A payload of 4 GiB or more is announced with nbytes set to
+// NBYTES_EXTENDED and the real size following the header as a
+// 64-bit integer in network byte order.
+constexpr uint32_t NBYTES_EXTENDED = 0xFFFFFFFF;
+
+// Batch requests.  MGET and MRM name their files either with a glob
+// pattern in filename, or with a payload of newline-separated names
+// of at most MAX_BATCH_NAMES bytes.  MPUT is followed by a PUT header
+// and payload for each file, then END.  The server answers a batch
+// with one frame per file, each header naming its file: FILEOUT and
+// the contents, ACK, or NAK with the errno.  An END whose nbytes is
+// the number of files closes the reply.
+constexpr size_t MAX_BATCH_NAMES = 0x100000;
+
+// Delta transfer, DPUT, SIGS and DELTA, is described in delta.h.
+// Its payloads carry their own SHA-256 rather than a CRC32C trailer.
+constexpr size_t MAX_SIGNATURES_SIZE = 0x10000000;
+
+// Ranged transfers.  GETRANGE and PUTAT begin their payload with a
+// range prefix of two 64-bit numbers in network byte order.  For
+// GETRANGE they are the offset and length, RANGE_TO_END meaning the
+// rest of the file; the payload is just the prefix, and the reply is
+// FILEOUT with however much of the range the file holds.  For PUTAT
+// they are the offset and PUTAT flags, and the data to write there
+// follows; nbytes counts the prefix too.  APPEND writes at the end
+// of the file instead of the offset, and TRUNCATE cuts the file off
+// after the data.  SIZE is answered with ACK whose nbytes, extended
+// if need be, is the size of the file, and SUM with ACK whose payload
+// is the CRC32C of the whole file, SUM_SIZE bytes in network byte
+// order, so that a file sent in pieces can be checked once it is all
+// there.
+constexpr size_t RANGE_PREFIX_SIZE = 16;
+constexpr size_t SUM_SIZE = 4;
+constexpr uint64_t RANGE_TO_END = UINT64_MAX;
+constexpr uint64_t PUTAT_APPEND = 0x1;
+constexpr uint64_t PUTAT_TRUNCATE = 0x2;
+
+void pack_range (char* buffer, uint64_t offset, uint64_t extent);
+void unpack_range (const char* buffer, uint64_t& offset,
+                   uint64_t& extent);
+
+// A client lists the features it wants in the nbytes of a HELLO.
+// The server answers ACK with the subset it grants, and both ends
+// use the new framing from the next header on.  COMPRESS needs TAGS,
+// as it is asked for request by request in the tag's flags.  With
+// CRC32C every PUT and FILEOUT payload is followed by a checksum
+// trailer (see transfer.h), and the server only grants it with TAGS.
+// DEDUP is granted by a server with a content-addressed store, which
+// then answers HAVE (see store.h).
+constexpr uint32_t CXI_FEATURE_TAGS = 0x1;
+constexpr uint32_t CXI_FEATURE_COMPRESS = 0x2;
+constexpr uint32_t CXI_FEATURE_CRC32C = 0x4;
+constexpr uint32_t CXI_FEATURE_DEDUP = 0x8;
+#ifdef HAVE_ZLIB
+constexpr uint32_t CXI_FEATURES = CXI_FEATURE_TAGS
+                                | CXI_FEATURE_COMPRESS
+                                | CXI_FEATURE_CRC32C
+                                | CXI_FEATURE_DEDUP;
+#else
+constexpr uint32_t CXI_FEATURES = CXI_FEATURE_TAGS
+                                | CXI_FEATURE_CRC32C
+                                | CXI_FEATURE_DEDUP;
+#endif
+
+// Tag flags.  COMPRESSED on a PUT, or on a FILEOUT, means its
+// payload is sent as compressed frames (see compress.h).  On a GET
+// or MGET it asks for the reply to be sent that way.
+constexpr uint32_t CXI_TAG_COMPRESSED = 0x1;
+
+//
+// struct cxi_tag
+// Once CXI_FEATURE_TAGS is granted, every header in either direction
+// is followed by a tag, in network byte order on the wire.  Each
+// header of a reply carries the tag of its request, so a client may
+// keep many requests in flight on one connection and match replies
+// by request_id.
+//
+
+struct cxi_tag {
+   uint32_t request_id {};
+   uint32_t flags {};
+};
+
+static_assert (sizeof (cxi_tag) == 8);
+
+// Largest header as sent: header, tag and extended size.
+constexpr size_t MAX_HEADER_WIRE = HEADER_SIZE + sizeof (cxi_tag)
+                                 + 2 * sizeof (uint32_t);
+
 void send_packet (base_socket& socket,
                   const void* buffer, size_t bufsize);
 
 void recv_packet (base_socket& socket, void* buffer, size_t bufsize);
 
+// Lay out the header, the tag unless it is null, and the extended
+// size if nbytes needs one.  Sets header.nbytes.  Returns the length.
+size_t pack_header (char* buffer, cxi_header& header,
+                    const cxi_tag* tag, uint64_t nbytes);
+
+//
+// class cxi_channel
+// a connected socket and the features negotiated on it
+//
+
+class cxi_channel {
+   public:
+      base_socket& socket;
+      uint32_t features {0};
+      cxi_tag send_tag;  // sent after each header
+      cxi_tag recv_tag;  // came after the last header received
+      uint64_t naks_sent {0};
+      explicit cxi_channel (base_socket& socket_): socket (socket_) {}
+      bool tagged() const { return features & CXI_FEATURE_TAGS; }
+
+      // Whether the payload of the last header received, or of the
+      // next header sent, is compressed.
+      bool recv_compressed() const {
+         return features & CXI_FEATURE_COMPRESS
+            and recv_tag.flags & CXI_TAG_COMPRESSED;
+      }
+      bool send_compressed() const {
+         return features & CXI_FEATURE_COMPRESS
+            and send_tag.flags & CXI_TAG_COMPRESSED;
+      }
+
+      // Whether file payloads carry a checksum trailer.
+      bool checksummed() const {
+         return features & CXI_FEATURE_CRC32C;
+      }
+
+      // Sets header.nbytes to nbytes and sends header and tag.
+      // Counts the NAKs among them in naks_sent.
+      void send_header (cxi_header& header, uint64_t nbytes);
+
+      // Receives a header and its tag into recv_tag.
+      void recv_header (cxi_header& header);
+
+      // Size of the payload announced by a header just received.
+      uint64_t recv_payload_size (const cxi_header& header);
+};
+
+// The nbytes of an LS request selects the format of the listing.
+// The reply is a series of LSOUT frames, each holding whole entries,
+// ended by an LSOUT with no payload, or by NAK if the directory could
+// not be read to the end.  TEXT is a line per entry.
+// BINARY is a record per entry, laid out by pack_ls_record, for the
+// client to filter and render.
+enum class ls_format : uint32_t { TEXT, BINARY };
+
+struct ls_record {
+   uint64_t size {};
+   int64_t mtime {};  // seconds since the epoch
+   uint32_t mode {};  // st_mode
+   string name;
+};
+
+// size, mtime, mode and the length of the name, in network byte
+// order, then the name itself.
+constexpr size_t LS_RECORD_FIXED = 8 + 8 + 4 + 2;
+
+void pack_ls_record (string& output, const ls_record& record);
+
+// Unpack the record at offset and step past it.  Returns false if
+// no whole record is left.
+bool unpack_ls_record (const string& input, size_t& offset,
+                       ls_record& record);
+
+// One line of a listing: mode, size, mtime and name.
+string format_ls_record (const ls_record& record);
+
+// The nbytes of a STATS request selects the format of the server's
+// statistics, which come back as the payload of a STATS.  TEXT is a
+// summary to read.  METRICS is one line per value, in the Prometheus
+// text format, to be scraped.
+enum class stats_format : uint32_t { TEXT, METRICS };
+
+// TRACE is answered with a TRACE whose filename is cxid-trace.<pid>
+// and whose payload is a dump of that server process's trace (see
+// trace.h), or with NAK if it is not tracing.  cxi names the file it
+// saves from the pid in the dump, not from the reply's filename.
+
+string to_string (cxi_command command);
+
 ostream& operator<< (ostream& out, const cxi_header& header);
 
 in_port_t get_cxi_server_port (const string& port_arg);
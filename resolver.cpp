@@ -0,0 +1,183 @@
+// $Id: resolver.cpp,v 1.1 2026-10-17 04:02:33-07 - - $
+
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+using namespace std;
+
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "resolver.h"
+#include "socket.h"
+
+bool reverse_lookup = true;
+bool background_lookup = true;
+
+using clock_type = chrono::steady_clock;
+
+//
+// struct name_cache
+// answers and when they expire, and the reverse lookups running in
+// the background.  Once full, expired answers are swept out before
+// another is added.
+//
+
+struct name_cache {
+   static constexpr size_t SWEEP_SIZE = 4096;
+   struct forward_entry {
+      host_addresses answer;
+      clock_type::time_point expires;
+   };
+   struct reverse_entry {
+      string name;
+      clock_type::time_point expires;
+   };
+   mutex lock;
+   unordered_map<string,forward_entry> forward;
+   unordered_map<in_addr_t,reverse_entry> reverse;
+   unordered_set<in_addr_t> pending;
+   template <typename map_type>
+   static void sweep (map_type& map, clock_type::time_point now);
+};
+
+template <typename map_type>
+void name_cache::sweep (map_type& map, clock_type::time_point now) {
+   if (map.size() < SWEEP_SIZE) return;
+   for (auto itor = map.begin(); itor != map.end();) {
+      if (itor->second.expires <= now) itor = map.erase (itor);
+                                  else ++itor;
+   }
+}
+
+static void before_fork();
+static void after_fork_parent();
+static void after_fork_child();
+
+// Never destroyed, since a background lookup may still be running
+// when the process exits.
+static name_cache& cache() {
+   static name_cache* instance = []() {
+      pthread_atfork (before_fork, after_fork_parent, after_fork_child);
+      return new name_cache();
+   }();
+   return *instance;
+}
+
+static void before_fork() {
+   cache().lock.lock();
+}
+
+static void after_fork_parent() {
+   cache().lock.unlock();
+}
+
+// The lookups of the parent do not run in the child.
+static void after_fork_child() {
+   cache().pending.clear();
+   cache().lock.unlock();
+}
+
+
+host_addresses resolve_name (const string& hostname) {
+   name_cache& names = cache();
+   auto now = clock_type::now();
+   {
+      lock_guard<mutex> guard (names.lock);
+      auto found = names.forward.find (hostname);
+      if (found != names.forward.end()
+      and found->second.expires > now) return found->second.answer;
+   }
+   addrinfo hints {};
+   hints.ai_family = AF_INET;
+   hints.ai_socktype = SOCK_STREAM;
+   hints.ai_flags = AI_CANONNAME;
+   addrinfo* result = nullptr;
+   int rc = ::getaddrinfo (hostname.c_str(), nullptr, &hints, &result);
+   if (rc != 0) {
+      throw socket_error ("getaddrinfo(" + hostname + "): "
+                          + (rc == EAI_SYSTEM ? strerror (errno)
+                                              : gai_strerror (rc)));
+   }
+   host_addresses answer;
+   answer.canonical = result->ai_canonname != nullptr
+                    ? result->ai_canonname : hostname;
+   for (addrinfo* info = result; info != nullptr;
+        info = info->ai_next) {
+      auto addr = reinterpret_cast<sockaddr_in*> (info->ai_addr);
+      answer.addresses.push_back (addr->sin_addr);
+   }
+   ::freeaddrinfo (result);
+   lock_guard<mutex> guard (names.lock);
+   name_cache::sweep (names.forward, now);
+   names.forward[hostname] = {answer, now + NAME_TTL};
+   return answer;
+}
+
+// Look the address up and keep the answer, whatever it is.
+static string lookup_addr (const in_addr& ipv4_addr) {
+   sockaddr_in addr {};
+   addr.sin_family = AF_INET;
+   addr.sin_addr = ipv4_addr;
+   char host[NI_MAXHOST];
+   int rc = ::getnameinfo (reinterpret_cast<sockaddr*> (&addr),
+                           sizeof addr, host, sizeof host, nullptr, 0,
+                           NI_NAMEREQD);
+   string name = rc == 0 ? host : to_string (ipv4_addr);
+   auto now = clock_type::now();
+   name_cache& names = cache();
+   lock_guard<mutex> guard (names.lock);
+   name_cache::sweep (names.reverse, now);
+   names.reverse[ipv4_addr.s_addr] = {name,
+                   now + (rc == 0 ? NAME_TTL : NEGATIVE_TTL)};
+   names.pending.erase (ipv4_addr.s_addr);
+   return name;
+}
+
+// The cached name, or an empty string.  Called with the lock held.
+static string cached_addr (name_cache& names,
+                           const in_addr& ipv4_addr) {
+   auto found = names.reverse.find (ipv4_addr.s_addr);
+   if (found == names.reverse.end()
+   or found->second.expires <= clock_type::now()) return "";
+   return found->second.name;
+}
+
+string resolve_addr (const in_addr& ipv4_addr) {
+   if (not reverse_lookup) return to_string (ipv4_addr);
+   {
+      name_cache& names = cache();
+      lock_guard<mutex> guard (names.lock);
+      string name = cached_addr (names, ipv4_addr);
+      if (not name.empty()) return name;
+   }
+   return lookup_addr (ipv4_addr);
+}
+
+// A lookup already running for the address is not started again,
+// and none is started if too many are running; a later call tries
+// again.
+string peek_addr (const in_addr& ipv4_addr) {
+   if (not reverse_lookup) return to_string (ipv4_addr);
+   name_cache& names = cache();
+   lock_guard<mutex> guard (names.lock);
+   string name = cached_addr (names, ipv4_addr);
+   if (not name.empty()) return name;
+   if (background_lookup
+   and names.pending.size() < MAX_BACKGROUND_LOOKUPS
+   and names.pending.insert (ipv4_addr.s_addr).second) {
+      try {
+         thread (lookup_addr, ipv4_addr).detach();
+      }catch (system_error&) { // no thread to be had
+         names.pending.erase (ipv4_addr.s_addr);
+      }
+   }
+   return to_string (ipv4_addr);
+}
+
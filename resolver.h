@@ -0,0 +1,61 @@
+// $Id: resolver.h,v 1.1 2026-10-17 04:02:33-07 - - $
+
+//
+// host name resolution
+// Lookups go through getaddrinfo and getnameinfo, which are
+// reentrant, and answers are kept for NAME_TTL, or for NEGATIVE_TTL
+// when an address has no name, so that a slow resolver is paid once
+// per host rather than once per connection.  The resolver does not
+// say how long its answers may be kept, so the times are fixed.
+//
+// Naming a connected peer must not wait on the resolver at all.
+// peek_addr answers from the cache, and otherwise gives the numeric
+// form at once and starts a lookup in the background, so the name
+// appears from the next connection on.  With reverse_lookup off,
+// addresses are never looked up.
+//
+// The cache is per process, and a forked child gets a copy without
+// the lookups still running.  A child that lives for one connection
+// turns background_lookup off, since its lookup would die with it:
+// peek_addr then only answers from the cache, and the parent looks
+// the address up for the children to come.
+//
+
+#ifndef RESOLVER_H
+#define RESOLVER_H
+
+#include <chrono>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <netinet/in.h>
+
+constexpr chrono::seconds NAME_TTL {300};
+constexpr chrono::seconds NEGATIVE_TTL {30};
+
+// Lookups of names in the background at once, at most.
+constexpr size_t MAX_BACKGROUND_LOOKUPS = 4;
+
+extern bool reverse_lookup;
+extern bool background_lookup;
+
+struct host_addresses {
+   string canonical;
+   vector<in_addr> addresses;
+};
+
+// IPv4 addresses of a host name or dotted address.  May wait on the
+// resolver.  Throws socket_error if the name does not resolve.
+host_addresses resolve_name (const string& hostname);
+
+// Name of an address, or its numeric form if it has none.  May wait
+// on the resolver.
+string resolve_addr (const in_addr& ipv4_addr);
+
+// Name of an address if it is cached, or else its numeric form.
+// Never waits.
+string peek_addr (const in_addr& ipv4_addr);
+
+#endif
+
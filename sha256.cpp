@@ -0,0 +1,153 @@
+// $Id: sha256.cpp,v 1.1 2026-10-16 21:41:03-07 - - $
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+using namespace std;
+
+#include <unistd.h>
+
+#include "sha256.h"
+
+static constexpr uint32_t ROUND_CONSTANTS[64] {
+   0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+   0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+   0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+   0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+   0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+   0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+   0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+   0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+   0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+   0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+   0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+   0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+   0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+   0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+   0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+   0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static constexpr uint32_t INITIAL_STATE[8] {
+   0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+   0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+static inline uint32_t rotr (uint32_t word, int count) {
+   return (word >> count) | (word << (32 - count));
+}
+
+void sha256::reset() {
+   memcpy (state, INITIAL_STATE, sizeof state);
+   block_used = 0;
+   total = 0;
+}
+
+void sha256::compress (const uint8_t* input) {
+   uint32_t schedule[64];
+   for (int index = 0; index < 16; ++index) {
+      const uint8_t* bytes = input + 4 * index;
+      schedule[index] = uint32_t (bytes[0]) << 24
+                      | uint32_t (bytes[1]) << 16
+                      | uint32_t (bytes[2]) << 8 | bytes[3];
+   }
+   for (int index = 16; index < 64; ++index) {
+      uint32_t w15 = schedule[index - 15];
+      uint32_t w2 = schedule[index - 2];
+      uint32_t s0 = rotr (w15, 7) ^ rotr (w15, 18) ^ (w15 >> 3);
+      uint32_t s1 = rotr (w2, 17) ^ rotr (w2, 19) ^ (w2 >> 10);
+      schedule[index] = schedule[index - 16] + s0
+                      + schedule[index - 7] + s1;
+   }
+   uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+   uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+   for (int index = 0; index < 64; ++index) {
+      uint32_t s1 = rotr (e, 6) ^ rotr (e, 11) ^ rotr (e, 25);
+      uint32_t choice = (e & f) ^ (~e & g);
+      uint32_t temp1 = h + s1 + choice + ROUND_CONSTANTS[index]
+                     + schedule[index];
+      uint32_t s0 = rotr (a, 2) ^ rotr (a, 13) ^ rotr (a, 22);
+      uint32_t majority = (a & b) ^ (a & c) ^ (b & c);
+      uint32_t temp2 = s0 + majority;
+      h = g; g = f; f = e; e = d + temp1;
+      d = c; c = b; b = a; a = temp1 + temp2;
+   }
+   state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+   state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+void sha256::update (const void* data, size_t size) {
+   auto input = static_cast<const uint8_t*> (data);
+   total += size;
+   if (block_used > 0) {
+      size_t count = min (size, sizeof block - block_used);
+      memcpy (block + block_used, input, count);
+      block_used += count;
+      input += count;
+      size -= count;
+      if (block_used < sizeof block) return;
+      compress (block);
+      block_used = 0;
+   }
+   for (; size >= sizeof block; input += sizeof block,
+                                size -= sizeof block) {
+      compress (input);
+   }
+   memcpy (block, input, size);
+   block_used = size;
+}
+
+sha256_digest sha256::digest() {
+   uint64_t bits = total * 8;
+   static const uint8_t padding[64] {0x80};
+   size_t pad_size = block_used < 56 ? 56 - block_used
+                                     : 120 - block_used;
+   update (padding, pad_size);
+   uint8_t length[8];
+   for (int index = 0; index < 8; ++index) {
+      length[index] = bits >> (56 - 8 * index);
+   }
+   update (length, sizeof length);
+   sha256_digest result;
+   for (int index = 0; index < 32; ++index) {
+      result[index] = state[index / 4] >> (24 - 8 * (index % 4));
+   }
+   return result;
+}
+
+sha256_digest sha256_of (const void* data, size_t size) {
+   sha256 hash;
+   hash.update (data, size);
+   return hash.digest();
+}
+
+int file_sha256 (int file_fd, sha256_digest& digest) {
+   constexpr size_t READ_SIZE = 0x100000;
+   auto buffer = make_unique<uint8_t[]> (READ_SIZE);
+   sha256 hash;
+   for (off_t offset = 0;;) {
+      ssize_t nread = ::pread (file_fd, buffer.get(), READ_SIZE,
+                               offset);
+      if (nread < 0) {
+         if (errno == EINTR) continue;
+         return errno;
+      }
+      if (nread == 0) break;
+      hash.update (buffer.get(), nread);
+      offset += nread;
+   }
+   digest = hash.digest();
+   return 0;
+}
+
+string to_string (const sha256_digest& digest) {
+   static const char hex_digits[] = "0123456789abcdef";
+   string result;
+   for (uint8_t byte: digest) {
+      result.push_back (hex_digits[byte >> 4]);
+      result.push_back (hex_digits[byte & 0xF]);
+   }
+   return result;
+}
+
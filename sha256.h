@@ -0,0 +1,45 @@
+// $Id: sha256.h,v 1.1 2026-10-16 21:41:03-07 - - $
+
+//
+// class sha256
+// SHA-256 (FIPS 180-4) over data given in any number of pieces.
+// digest() pads and finishes the hash, after which the object must
+// be reset before it is used again.
+//
+
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+using namespace std;
+
+using sha256_digest = array<uint8_t,32>;
+
+class sha256 {
+   private:
+      uint32_t state[8];
+      uint8_t block[64];
+      size_t block_used;
+      uint64_t total;
+      void compress (const uint8_t* input);
+   public:
+      sha256() { reset(); }
+      void reset();
+      void update (const void* data, size_t size);
+      sha256_digest digest();
+};
+
+sha256_digest sha256_of (const void* data, size_t size);
+
+// Hash the whole of a file, without moving its offset.  Returns 0
+// or the errno of a failed read.
+int file_sha256 (int file_fd, sha256_digest& digest);
+
+// Lower-case hex, as sha256sum prints it.
+string to_string (const sha256_digest& digest);
+
+#endif
+
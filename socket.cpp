@@ -10,6 +10,7 @@ using namespace std;
 #include <fcntl.h>
 #include <limits.h>
 
+#include "resolver.h"
 #include "socket.h"
 
 base_socket::base_socket() {
@@ -27,13 +28,17 @@ void base_socket::close() {
    socket_fd = CLOSED_FD;
 }
 
-void base_socket::create() {
+void base_socket::create (bool reuse_port) {
    socket_fd = ::socket (AF_INET, SOCK_STREAM, 0);
    if (socket_fd < 0) throw socket_sys_error ("socket");
    int on = 1;
    int status = ::setsockopt (socket_fd, SOL_SOCKET, SO_REUSEADDR,
                               &on, sizeof on);
    if (status < 0) throw socket_sys_error ("setsockopt");
+   if (not reuse_port) return;
+   status = ::setsockopt (socket_fd, SOL_SOCKET, SO_REUSEPORT,
+                          &on, sizeof on);
+   if (status < 0) throw socket_sys_error ("setsockopt SO_REUSEPORT");
 }
 
 void base_socket::bind (const in_port_t port) {
@@ -61,26 +66,34 @@ void base_socket::accept (base_socket& socket) const {
    if (socket.socket_fd < 0) throw socket_sys_error ("accept");
 }
 
+// send and recv return -1 instead of throwing when a non-blocking
+// socket would block, and errno is left as EAGAIN.
+
+static bool would_block() {
+   return errno == EAGAIN or errno == EWOULDBLOCK;
+}
+
 ssize_t base_socket::send (const void* buffer, size_t bufsize) {
-   int nbytes = ::send (socket_fd, buffer, bufsize, MSG_NOSIGNAL);
-   if (nbytes < 0) throw socket_sys_error ("send");
+   ssize_t nbytes = ::send (socket_fd, buffer, bufsize, MSG_NOSIGNAL);
+   if (nbytes < 0 and not would_block()) {
+      throw socket_sys_error ("send");
+   }
    return nbytes;
 }
 
 ssize_t base_socket::recv (void* buffer, size_t bufsize) {
-   memset (buffer, 0, bufsize);
    ssize_t nbytes = ::recv (socket_fd, buffer, bufsize, 0);
-   if (nbytes < 0) throw socket_sys_error ("recv");
+   if (nbytes < 0 and not would_block()) {
+      throw socket_sys_error ("recv");
+   }
    return nbytes;
 }
 
 void base_socket::connect (const string host, const in_port_t port) {
-   struct hostent *hostp = ::gethostbyname (host.c_str());
-   if (hostp == NULL) throw socket_h_error ("gethostbyname("
-                            + host + ")");
+   hostinfo info (host);
    socket_addr.sin_family = AF_INET;
    socket_addr.sin_port = htons (port);
-   socket_addr.sin_addr = *reinterpret_cast<in_addr*> (hostp->h_addr);
+   socket_addr.sin_addr = info.addresses[0];
    int status = ::connect (socket_fd,
             reinterpret_cast<sockaddr*> (&socket_addr),
             sizeof (socket_addr));
@@ -95,7 +108,9 @@ void base_socket::set_socket_fd (int fd) {
    if (rc < 0) throw socket_sys_error ("set_socket_fd("
                      + to_string (fd) + "): getpeername");
    socket_fd = fd;
-   if (socket_addr.sin_family != AF_INET)
+   // AF_UNIX is let through for one end of a socketpair
+   if (socket_addr.sin_family != AF_INET
+   and socket_addr.sin_family != AF_UNIX)
       throw socket_error ("address not AF_INET");
 }
 
@@ -114,8 +129,8 @@ client_socket::client_socket (string host, in_port_t port) {
    base_socket::connect (host, port);
 }
 
-server_socket::server_socket (in_port_t port) {
-   base_socket::create();
+server_socket::server_socket (in_port_t port, bool reuse_port) {
+   base_socket::create (reuse_port);
    base_socket::bind (port);
    base_socket::listen();
 }
@@ -133,53 +148,29 @@ string to_string (const in_addr& ipv4_addr) {
 }
 
 string to_string (const base_socket& sock) {
-   hostinfo info (sock.socket_addr.sin_addr);
-   return info.hostname + " (" + to_string (info.addresses[0])
-          + ") port " + to_string (ntohs (sock.socket_addr.sin_port));
-}
-
-
-string init_hostname (hostent* host) {
-   if (host == nullptr) throw socket_h_error ("gethostbyname");
-   return host->h_name;
-}
-
-vector<string> init_aliases (hostent* host) {
-   if (host == nullptr) throw socket_h_error ("gethostbyname");
-   vector<string> init_aliases;
-   for (char** alias = host->h_aliases; *alias != nullptr; ++alias) {
-      init_aliases.push_back (*alias);
+   if (sock.socket_addr.sin_family == AF_UNIX) {
+      return "local socket " + to_string (sock.socket_fd);
    }
-   return init_aliases;
-}
-
-vector<in_addr> init_addresses (hostent* host) {
-   vector<in_addr> init_addresses;
-   if (host == nullptr) throw socket_h_error ("gethostbyname");
-   for (in_addr** addr =
-                 reinterpret_cast<in_addr**> (host->h_addr_list);
-        *addr != nullptr; ++addr) {
-      init_addresses.push_back (**addr);
-   }
-   return init_addresses;
-}
-
-hostinfo::hostinfo (hostent* host):
-   hostname (init_hostname (host)),
-   aliases (init_aliases (host)),
-   addresses (init_addresses (host)) {
+   // named from the cache, so that naming a peer never waits
+   const in_addr& addr = sock.socket_addr.sin_addr;
+   return peek_addr (addr) + " (" + to_string (addr) + ") port "
+          + to_string (ntohs (sock.socket_addr.sin_port));
 }
 
+
 hostinfo::hostinfo(): hostinfo (localhost()) {
 }
 
 hostinfo::hostinfo (const string& hostname_):
-          hostinfo (::gethostbyname (hostname_.c_str())) {
+          hostinfo (resolve_name (hostname_)) {
+}
+
+hostinfo::hostinfo (const host_addresses& answer):
+          hostname (answer.canonical), addresses (answer.addresses) {
 }
 
 hostinfo::hostinfo (const in_addr& ipv4_addr):
-          hostinfo (::gethostbyaddr (&ipv4_addr, sizeof ipv4_addr,
-                                     AF_INET)) {
+          hostname (resolve_addr (ipv4_addr)), addresses {ipv4_addr} {
 }
 
 string localhost() {
@@ -35,7 +35,7 @@ class base_socket {
       ~base_socket();
 
       // server_socket initialization
-      void create();
+      void create (bool reuse_port = false);
       void bind (const in_port_t port);
       void listen() const;
       void accept (base_socket&) const;
@@ -52,6 +52,7 @@ class base_socket {
       ssize_t send (const void* buffer, size_t bufsize);
       ssize_t recv (void* buffer, size_t bufsize);
       void set_non_blocking (const bool);
+      int get_socket_fd() const { return socket_fd; }
       friend string to_string (const base_socket& sock);
 };
 
@@ -84,7 +85,7 @@ class client_socket: public base_socket {
 
 class server_socket: public base_socket {
    public:
-      server_socket (in_port_t port);
+      server_socket (in_port_t port, bool reuse_port = false);
       void accept (accepted_socket& sock) {
          base_socket::accept (sock);
       }
@@ -131,15 +132,20 @@ class socket_h_error: public socket_error {
 //
 // class hostinfo
 // information about a host given hostname or IPv4 address
+// Lookups go through the resolver (see resolver.h), which is
+// reentrant and caches its answers, so a hostinfo may be constructed
+// by several threads at once.
 //
 
+struct host_addresses;
+
 class hostinfo {
+   private:
+      hostinfo (const host_addresses&);
    public:
       const string hostname;
-      const vector<string> aliases;
       const vector<in_addr> addresses;
       hostinfo (); // localhost
-      hostinfo (hostent*);
       hostinfo (const string& hostname);
       hostinfo (const in_addr& ipv4_addr);
       friend string to_string (const hostinfo&);
@@ -0,0 +1,253 @@
+// $Id: stats.cpp,v 1.1 2026-10-17 00:31:44-07 - - $
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+using namespace std;
+
+#include <linux/tcp.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include "socket.h"
+#include "stats.h"
+
+//
+// class latency_histogram
+// Bucket index from a value: below SUB_COUNT the value itself;
+// otherwise the power of two above SUB_BITS, times SUB_HALF, plus
+// the top SUB_BITS bits of the value.
+//
+
+class latency_histogram {
+   private:
+      static constexpr int SUB_BITS = 5;
+      static constexpr uint64_t SUB_COUNT = 1 << SUB_BITS;
+      static constexpr uint64_t SUB_HALF = SUB_COUNT / 2;
+      static constexpr int MAX_BITS = 37; // over a day in usec
+      static constexpr size_t BUCKETS = (MAX_BITS - SUB_BITS + 1)
+                                      * SUB_HALF + SUB_HALF;
+      atomic<uint64_t> counts[BUCKETS];
+      atomic<uint64_t> total;
+      atomic<uint64_t> max_usec;
+      static size_t index_of (uint64_t usec);
+      static uint64_t highest_in (size_t index);
+   public:
+      void record (uint64_t usec);
+      uint64_t count() const { return total; }
+      uint64_t maximum() const { return max_usec; }
+      // Highest value in the bucket holding the given fraction of
+      // the counts, or 0 if there are none.
+      uint64_t percentile (double fraction) const;
+};
+
+size_t latency_histogram::index_of (uint64_t usec) {
+   if (usec < SUB_COUNT) return usec;
+   int shift = bit_width (usec) - SUB_BITS;
+   size_t index = shift * SUB_HALF + (usec >> shift);
+   return min (index, BUCKETS - 1);
+}
+
+uint64_t latency_histogram::highest_in (size_t index) {
+   if (index < SUB_COUNT) return index;
+   int shift = index / SUB_HALF - 1;
+   uint64_t lowest = (index % SUB_HALF + SUB_HALF) << shift;
+   return lowest + (uint64_t (1) << shift) - 1;
+}
+
+void latency_histogram::record (uint64_t usec) {
+   counts[index_of (usec)].fetch_add (1, memory_order_relaxed);
+   total.fetch_add (1, memory_order_relaxed);
+   uint64_t seen = max_usec.load (memory_order_relaxed);
+   while (usec > seen
+          and not max_usec.compare_exchange_weak (seen, usec)) {}
+}
+
+uint64_t latency_histogram::percentile (double fraction) const {
+   uint64_t count = total.load (memory_order_relaxed);
+   if (count == 0) return 0;
+   uint64_t rank = max<uint64_t> (1, fraction * count + 0.5);
+   uint64_t seen = 0;
+   for (size_t index = 0; index < BUCKETS; ++index) {
+      seen += counts[index].load (memory_order_relaxed);
+      if (seen >= rank) return min (highest_in (index), maximum());
+   }
+   return maximum();
+}
+
+
+//
+// struct server_stats
+// everything that is counted, in one shared mapping
+//
+
+constexpr size_t COMMANDS = 32;
+static_assert (size_t (cxi_command::TRACE) < COMMANDS);
+
+const cxi_command timed_commands[] {
+   cxi_command::PUT, cxi_command::GET, cxi_command::LS,
+   cxi_command::RM,
+};
+
+struct server_stats {
+   int64_t start_sec;
+   atomic<uint64_t> requests[COMMANDS];
+   atomic<uint64_t> errors[COMMANDS];
+   atomic<uint64_t> bytes_in;
+   atomic<uint64_t> bytes_out;
+   atomic<int64_t> sessions_active;
+   atomic<uint64_t> sessions;
+   atomic<uint64_t> cache_hits;
+   atomic<uint64_t> cache_misses;
+   latency_histogram latency[size (timed_commands)];
+};
+
+static server_stats* stats = nullptr;
+
+static int64_t steady_sec() {
+   using namespace chrono;
+   return duration_cast<seconds> (steady_clock::now()
+                                  .time_since_epoch()).count();
+}
+
+void stats_init() {
+   void* memory = ::mmap (nullptr, sizeof (server_stats),
+                          PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+   if (memory == MAP_FAILED) throw socket_sys_error ("mmap");
+   stats = new (memory) server_stats {};
+   stats->start_sec = steady_sec();
+}
+
+static int timed_index (cxi_command command) {
+   for (size_t index = 0; index < size (timed_commands); ++index) {
+      if (timed_commands[index] == command) return index;
+   }
+   return -1;
+}
+
+void stats_request (cxi_command command, uint64_t usec, bool failed) {
+   if (stats == nullptr) return;
+   size_t slot = min (size_t (command), COMMANDS - 1);
+   stats->requests[slot].fetch_add (1, memory_order_relaxed);
+   if (failed) stats->errors[slot].fetch_add (1, memory_order_relaxed);
+   int timed = timed_index (command);
+   if (timed >= 0) stats->latency[timed].record (usec);
+}
+
+void stats_session_begin() {
+   if (stats == nullptr) return;
+   stats->sessions.fetch_add (1, memory_order_relaxed);
+   stats->sessions_active.fetch_add (1, memory_order_relaxed);
+}
+
+void stats_session_end() {
+   if (stats == nullptr) return;
+   stats->sessions_active.fetch_sub (1, memory_order_relaxed);
+}
+
+void stats_cache (bool hit) {
+   if (stats == nullptr) return;
+   (hit ? stats->cache_hits : stats->cache_misses)
+         .fetch_add (1, memory_order_relaxed);
+}
+
+void byte_meter::update (int socket_fd) {
+   if (stats == nullptr) return;
+   tcp_info info {};
+   socklen_t length = sizeof info;
+   if (::getsockopt (socket_fd, IPPROTO_TCP, TCP_INFO, &info,
+                     &length) < 0) return;
+   if (info.tcpi_bytes_received > bytes_in) {
+      stats->bytes_in.fetch_add (info.tcpi_bytes_received - bytes_in,
+                                 memory_order_relaxed);
+      bytes_in = info.tcpi_bytes_received;
+   }
+   if (info.tcpi_bytes_acked > bytes_out) {
+      stats->bytes_out.fetch_add (info.tcpi_bytes_acked - bytes_out,
+                                  memory_order_relaxed);
+      bytes_out = info.tcpi_bytes_acked;
+   }
+}
+
+
+static const pair<const char*,double> quantiles[] {
+   {"0.5", 0.5}, {"0.9", 0.9}, {"0.99", 0.99}, {"0.999", 0.999},
+};
+
+static void text_report (ostream& out) {
+   uint64_t requests = 0;
+   uint64_t errors = 0;
+   for (size_t slot = 0; slot < COMMANDS; ++slot) {
+      requests += stats->requests[slot];
+      errors += stats->errors[slot];
+   }
+   out << "uptime   " << steady_sec() - stats->start_sec << " s\n"
+       << "sessions " << stats->sessions_active << " active, "
+       << stats->sessions << " total\n"
+       << "requests " << requests << ", " << errors << " failed\n"
+       << "bytes    " << stats->bytes_in << " in, "
+       << stats->bytes_out << " out\n"
+       << "cache    " << stats->cache_hits << " hits, "
+       << stats->cache_misses << " misses\n"
+       << "latency usec       count    p50    p90    p99   p999"
+       << "    max\n";
+   for (size_t index = 0; index < size (timed_commands); ++index) {
+      const latency_histogram& histogram = stats->latency[index];
+      out << "   " << left << setw (6)
+          << to_string (timed_commands[index]) << right
+          << setw (12) << histogram.count();
+      for (const auto& quantile: quantiles) {
+         out << setw (7) << histogram.percentile (quantile.second);
+      }
+      out << setw (7) << histogram.maximum() << "\n";
+   }
+}
+
+static void metrics_report (ostream& out) {
+   out << "cxid_uptime_seconds "
+       << steady_sec() - stats->start_sec << "\n"
+       << "cxid_sessions_active " << stats->sessions_active << "\n"
+       << "cxid_sessions_total " << stats->sessions << "\n"
+       << "cxid_bytes_in_total " << stats->bytes_in << "\n"
+       << "cxid_bytes_out_total " << stats->bytes_out << "\n"
+       << "cxid_cache_hits_total " << stats->cache_hits << "\n"
+       << "cxid_cache_misses_total " << stats->cache_misses << "\n";
+   for (size_t slot = 0; slot < COMMANDS; ++slot) {
+      if (stats->requests[slot] == 0) continue;
+      string label = "{command=\""
+                   + to_string (cxi_command (slot)) + "\"}";
+      out << "cxid_requests_total" << label << " "
+          << stats->requests[slot] << "\n"
+          << "cxid_errors_total" << label << " "
+          << stats->errors[slot] << "\n";
+   }
+   for (size_t index = 0; index < size (timed_commands); ++index) {
+      const latency_histogram& histogram = stats->latency[index];
+      string command = to_string (timed_commands[index]);
+      for (const auto& quantile: quantiles) {
+         out << "cxid_latency_usec{command=\"" << command
+             << "\",quantile=\"" << quantile.first << "\"} "
+             << histogram.percentile (quantile.second) << "\n";
+      }
+      out << "cxid_latency_usec_max{command=\"" << command << "\"} "
+          << histogram.maximum() << "\n"
+          << "cxid_latency_usec_count{command=\"" << command << "\"} "
+          << histogram.count() << "\n";
+   }
+}
+
+string stats_report (stats_format format) {
+   if (stats == nullptr) return "no statistics\n";
+   ostringstream out;
+   if (format == stats_format::METRICS) metrics_report (out);
+                                   else text_report (out);
+   return out.str();
+}
+
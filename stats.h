@@ -0,0 +1,55 @@
+// $Id: stats.h,v 1.1 2026-10-17 00:31:44-07 - - $
+
+//
+// server statistics
+// Counters and per-command latency histograms kept by cxid in
+// shared memory, so that every process forked after stats_init adds
+// to the same totals, and reported in answer to STATS (see
+// protocol.h).
+//
+// Latencies are in microseconds, from the request header to the
+// last byte of the reply, in log-linear buckets as HDR histograms
+// keep them: exact below 32, then 16 buckets to each power of two,
+// so a percentile is within about 6% of the true value.  Bytes in
+// and out are taken from TCP_INFO, so they count payloads sent with
+// sendfile or splice as well as those copied.
+//
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <cstdint>
+#include <string>
+using namespace std;
+
+#include "protocol.h"
+
+// Map the shared counters.  Call before forking server processes.
+// Throws socket_sys_error.
+void stats_init();
+
+// One request, how long it took, and whether it failed.
+void stats_request (cxi_command command, uint64_t usec, bool failed);
+
+void stats_session_begin();
+void stats_session_end();
+
+// A GET answered from the hot-file cache, or one that missed it.
+void stats_cache (bool hit);
+
+//
+// struct byte_meter
+// bytes a socket had moved when its counts were last added in
+//
+
+struct byte_meter {
+   uint64_t bytes_in {0};
+   uint64_t bytes_out {0};
+   // Add what the socket has moved since the last call.
+   void update (int socket_fd);
+};
+
+string stats_report (stats_format format);
+
+#endif
+
@@ -0,0 +1,169 @@
+// $Id: store.cpp,v 1.1 2026-10-16 23:14:52-07 - - $
+
+#include <cerrno>
+#include <iostream>
+#include <memory>
+#include <string>
+using namespace std;
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "debug.h"
+#include "socket.h"
+#include "store.h"
+#include "transfer.h"
+
+string store_dir;
+
+// Copies are spread over 256 subdirectories by the first byte of
+// their hash, as git does, so no one directory grows too large.
+static string copy_dir (const string& hex) {
+   return store_dir + "/" + hex.substr (0, 2);
+}
+
+static string copy_path (const sha256_digest& digest) {
+   string hex = to_string (digest);
+   return copy_dir (hex) + "/" + hex;
+}
+
+static size_t sweep_dir (const string& dir) {
+   size_t removed = 0;
+   DIR* handle = ::opendir (dir.c_str());
+   if (handle == nullptr) return 0;
+   while (dirent* entry = ::readdir (handle)) {
+      if (entry->d_name[0] == '.') continue;
+      string path = dir + "/" + entry->d_name;
+      struct stat stat_buf;
+      if (::lstat (path.c_str(), &stat_buf) < 0) continue;
+      if (S_ISREG (stat_buf.st_mode) and stat_buf.st_nlink == 1
+      and ::unlink (path.c_str()) == 0) ++removed;
+   }
+   ::closedir (handle);
+   return removed;
+}
+
+size_t store_open (const string& dir_arg) {
+   store_dir = dir_arg;
+   while (store_dir.size() > 1 and store_dir.back() == '/') {
+      store_dir.pop_back();
+   }
+   if (::mkdir (store_dir.c_str(), 0777) < 0 and errno != EEXIST) {
+      throw socket_sys_error ("mkdir " + store_dir);
+   }
+   size_t removed = 0;
+   DIR* handle = ::opendir (store_dir.c_str());
+   if (handle == nullptr) throw socket_sys_error (store_dir);
+   while (dirent* entry = ::readdir (handle)) {
+      if (entry->d_name[0] == '.') continue;
+      removed += sweep_dir (store_dir + "/" + entry->d_name);
+   }
+   ::closedir (handle);
+   return removed;
+}
+
+// Rename temp over filename, or remove it if that fails.
+static int replace (const string& filename, const string& temp) {
+   if (::rename (temp.c_str(), filename.c_str()) == 0) return 0;
+   int error = errno;
+   ::unlink (temp.c_str());
+   return error;
+}
+
+int store_commit (const string& filename, const string& temp) {
+   if (not store_enabled()) return replace (filename, temp);
+   sha256_digest digest;
+   open_file file (temp.c_str(), O_RDONLY);
+   int error = file.is_open() ? 0 : errno;
+   if (error == 0) error = file_sha256 (file.get(), digest);
+   file.close();
+   if (error != 0) {
+      ::unlink (temp.c_str());
+      return error;
+   }
+   string hex = to_string (digest);
+   string dir = copy_dir (hex);
+   string copy = dir + "/" + hex;
+   if (::mkdir (dir.c_str(), 0777) < 0 and errno != EEXIST) {
+      DEBUGF ('a', dir << ": " << strerror (errno));
+      return replace (filename, temp);
+   }
+   if (::link (temp.c_str(), copy.c_str()) == 0) {
+      DEBUGF ('a', filename << ": stored " << hex);
+      return replace (filename, temp);
+   }
+   if (errno != EEXIST) {
+      // e.g. EXDEV, the store is on another file system
+      DEBUGF ('a', copy << ": " << strerror (errno));
+      return replace (filename, temp);
+   }
+   DEBUGF ('a', filename << ": already stored " << hex);
+   ::unlink (temp.c_str());
+   return store_link (filename, digest);
+}
+
+// A link beside filename is renamed over it, so that filename
+// changes from one file to the other with nothing in between.
+int store_link (const string& filename, const sha256_digest& digest) {
+   if (not store_enabled()) return EOPNOTSUPP;
+   string temp = temp_name (filename);
+   if (::link (copy_path (digest).c_str(), temp.c_str()) < 0) {
+      return errno;
+   }
+   return replace (filename, temp);
+}
+
+// Any regular file with more than one link is copied, since it may
+// be a name for a copy in the store.  The stripes of one PUTAT
+// transfer come on several connections at once, so the copy is made
+// under a lock on the shared inode, and whoever gets the lock after
+// the name has moved to a detached inode finds nothing left to do.
+// Without the lock each would copy, and ranges written to a copy
+// that another replaced would be lost.
+int store_detach (const string& filename) {
+   if (not store_enabled()) return 0;
+   open_file source (filename.c_str(), O_RDONLY);
+   if (not source.is_open()) return errno == ENOENT ? 0 : errno;
+   struct stat stat_buf;
+   if (::fstat (source.get(), &stat_buf) < 0) return errno;
+   if (not S_ISREG (stat_buf.st_mode) or stat_buf.st_nlink < 2) {
+      return 0;
+   }
+   while (::flock (source.get(), LOCK_EX) < 0) {
+      if (errno != EINTR) return errno;
+   }
+   struct stat name_buf;
+   if (::stat (filename.c_str(), &name_buf) < 0) {
+      return errno == ENOENT ? 0 : errno;
+   }
+   if (name_buf.st_dev != stat_buf.st_dev
+   or name_buf.st_ino != stat_buf.st_ino) return 0;
+   string temp = temp_name (filename);
+   open_file target (temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                     stat_buf.st_mode & 07777);
+   if (not target.is_open()) return errno;
+   auto buffer = make_unique<char[]> (transfer_chunk_size);
+   int error = 0;
+   while (error == 0) {
+      ssize_t nread = ::read (source.get(), buffer.get(),
+                              transfer_chunk_size);
+      if (nread < 0) {
+         if (errno != EINTR) error = errno;
+         continue;
+      }
+      if (nread == 0) break;
+      error = write_all (target.get(), buffer.get(), nread);
+   }
+   int close_error = target.close();
+   if (error == 0) error = close_error;
+   if (error != 0) {
+      ::unlink (temp.c_str());
+      return error;
+   }
+   DEBUGF ('a', filename << ": detached from the store");
+   return replace (filename, temp);
+}
+
@@ -0,0 +1,58 @@
+// $Id: store.h,v 1.1 2026-10-16 23:14:52-07 - - $
+
+//
+// content-addressed store
+// With a store directory, cxid keeps one copy of each distinct file
+// content, named by its SHA-256, and every name in the working
+// directory is a hard link to the copy it holds.  Names map to
+// hashes through their inodes, so GET, LS, RM and the rest work on
+// names as before, while identical uploads share their blocks.  A
+// client may offer a hash with HAVE before a PUT and skip the
+// payload if the store already has it.
+//
+//    client: HAVE filename, payload the SHA-256 of the file
+//    server: ACK, filename now names that copy, or NAK with ENOENT
+//
+// The store must be on the same file system as the working
+// directory.  Where a copy cannot be linked, files are kept as
+// plain files.  Writes that change a file in place first give it an
+// inode of its own, since every name sharing a copy would see them.
+// A copy that no name links to any more is swept at startup.
+//
+
+#ifndef STORE_H
+#define STORE_H
+
+#include <string>
+using namespace std;
+
+#include "sha256.h"
+
+// Directory of the store, or empty for none.
+extern string store_dir;
+
+inline bool store_enabled() { return not store_dir.empty(); }
+
+// Create the store directory if need be, and sweep it.  Returns the
+// number of copies removed.  Throws socket_sys_error.
+size_t store_open (const string& dir_arg);
+
+// Put a file just written as temp in place as filename.  With a
+// store, temp joins it, or is dropped for the copy already there,
+// and filename is linked to the copy; without one, temp is renamed
+// over filename.  Returns 0 or errno.  Temp is gone either way.
+int store_commit (const string& filename, const string& temp);
+
+// Link filename to the copy with the digest.  Returns 0, ENOENT if
+// the store has no such copy, EOPNOTSUPP if there is no store, or
+// errno.
+int store_link (const string& filename, const sha256_digest& digest);
+
+// Give filename an inode of its own if it may share one with the
+// store, before it is written in place.  Returns 0 or errno.  A
+// missing file, or no store, is left alone.  Concurrent calls for
+// one name copy it once.
+int store_detach (const string& filename);
+
+#endif
+
@@ -0,0 +1,88 @@
+// $Id: threadpool.cpp,v 1.1 2026-10-16 13:40:05-07 - - $
+
+#include <utility>
+using namespace std;
+
+#include "threadpool.h"
+
+thread_local thread_pool* thread_pool::current_pool {nullptr};
+thread_local size_t thread_pool::current_index {0};
+
+thread_pool::thread_pool (size_t nthreads) {
+   if (nthreads == 0) nthreads = 1;
+   for (size_t index = 0; index < nthreads; ++index) {
+      deques.push_back (make_unique<task_deque>());
+   }
+   for (size_t index = 0; index < nthreads; ++index) {
+      workers.emplace_back (&thread_pool::run_worker, this, index);
+   }
+}
+
+thread_pool::~thread_pool() {
+   {
+      lock_guard<mutex> guard (idle_lock);
+      stopping = true;
+   }
+   idle_cond.notify_all();
+   for (auto& worker: workers) worker.join();
+}
+
+// pending is counted before the task is visible, so a worker that
+// has taken a task never sees pending at zero.
+void thread_pool::submit (task next) {
+   size_t index = current_pool == this ? current_index
+                : next_deque++ % deques.size();
+   {
+      lock_guard<mutex> guard (idle_lock);
+      ++pending;
+   }
+   {
+      lock_guard<mutex> guard (deques[index]->lock);
+      deques[index]->tasks.push_back (move (next));
+   }
+   idle_cond.notify_one();
+}
+
+bool thread_pool::take (size_t index, task& next) {
+   {
+      task_deque& own = *deques[index];
+      lock_guard<mutex> guard (own.lock);
+      if (not own.tasks.empty()) {
+         next = move (own.tasks.back());
+         own.tasks.pop_back();
+         return true;
+      }
+   }
+   for (size_t offset = 1; offset < deques.size(); ++offset) {
+      task_deque& victim = *deques[(index + offset) % deques.size()];
+      lock_guard<mutex> guard (victim.lock);
+      if (not victim.tasks.empty()) {
+         next = move (victim.tasks.front());
+         victim.tasks.pop_front();
+         return true;
+      }
+   }
+   return false;
+}
+
+void thread_pool::run_worker (size_t index) {
+   current_pool = this;
+   current_index = index;
+   for (;;) {
+      task next;
+      if (take (index, next)) {
+         {
+            lock_guard<mutex> guard (idle_lock);
+            --pending;
+         }
+         next();
+         continue;
+      }
+      unique_lock<mutex> guard (idle_lock);
+      idle_cond.wait (guard, [this] {
+         return pending > 0 or stopping;
+      });
+      if (stopping and pending == 0) return;
+   }
+}
+
@@ -0,0 +1,55 @@
+// $Id: threadpool.h,v 1.1 2026-10-16 13:40:05-07 - - $
+
+//
+// class thread_pool
+// A fixed set of worker threads, each with its own task deque.  A
+// worker takes its newest task first and, when its own deque is
+// empty, steals the oldest task from another worker.  Tasks
+// submitted from outside the pool are dealt round-robin; tasks
+// submitted by a worker go on that worker's own deque.  A task that
+// throws ends the process, so tasks catch their own exceptions.
+//
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+using namespace std;
+
+class thread_pool {
+   public:
+      using task = function<void()>;
+   private:
+      struct task_deque {
+         mutex lock;
+         deque<task> tasks;
+      };
+      vector<unique_ptr<task_deque>> deques;
+      vector<thread> workers;
+      mutex idle_lock;
+      condition_variable idle_cond;
+      size_t pending {0};
+      bool stopping {false};
+      atomic<size_t> next_deque {0};
+      static thread_local thread_pool* current_pool;
+      static thread_local size_t current_index;
+      void run_worker (size_t index);
+      bool take (size_t index, task& next);
+   public:
+      explicit thread_pool (size_t nthreads);
+      thread_pool (const thread_pool&) = delete;
+      thread_pool& operator= (const thread_pool&) = delete;
+      ~thread_pool(); // finishes queued tasks, then joins
+      void submit (task next);
+      size_t size() const { return workers.size(); }
+};
+
+#endif
+
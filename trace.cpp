@@ -0,0 +1,227 @@
+// $Id: trace.cpp,v 1.1 2026-10-17 03:20:17-07 - - $
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#if defined (__x86_64__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+#include "socket.h"
+#include "trace.h"
+
+bool trace_enabled = false;
+
+static unique_ptr<trace_event[]> ring;
+static size_t ring_mask = 0;
+static atomic<uint64_t> ring_next {0};
+static uint64_t base_ticks = 0;
+static uint64_t base_ns = 0;
+
+string to_string (trace_point point) {
+   switch (point) {
+      case trace_point::REQUEST      : return "request"     ;
+      case trace_point::RECV_HEADER  : return "recv header" ;
+      case trace_point::FILE_OPEN    : return "file open"   ;
+      case trace_point::SEND_PAYLOAD : return "send payload";
+      case trace_point::RECV_PAYLOAD : return "recv payload";
+      case trace_point::SYNC         : return "sync"        ;
+      default                        : return "????"        ;
+   };
+}
+
+static uint64_t monotonic_ns() {
+   timespec now;
+   clock_gettime (CLOCK_MONOTONIC, &now);
+   return uint64_t (now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+// The TSC only counts time if it runs at one rate whatever the
+// power state, which CPUID reports as invariant.
+#if defined (__x86_64__)
+static bool invariant_tsc() {
+   unsigned eax, ebx, ecx, edx;
+   if (not __get_cpuid (0x80000007, &eax, &ebx, &ecx, &edx)) {
+      return false;
+   }
+   return edx & (1 << 8);
+}
+
+static const bool use_tsc = invariant_tsc();
+
+uint64_t trace_clock() {
+   return use_tsc ? __rdtsc() : monotonic_ns();
+}
+#else
+uint64_t trace_clock() {
+   return monotonic_ns();
+}
+#endif
+
+// Thread ids are looked up once per thread, and again in the child
+// of a fork, whose only thread is the one that forked.
+static thread_local uint32_t thread_id = 0;
+
+static void forget_thread_id() {
+   thread_id = 0;
+}
+
+void trace_init (size_t events) {
+   size_t size = 1;
+   while (size < events) size <<= 1;
+   ring = make_unique<trace_event[]> (size);
+   ring_mask = size - 1;
+   base_ticks = trace_clock();
+   base_ns = monotonic_ns();
+   pthread_atfork (nullptr, nullptr, forget_thread_id);
+   trace_enabled = true;
+}
+
+// Writers claim slots with one atomic add and fill them in without a
+// lock, so a dump taken while a slot is being filled may hold a torn
+// event, which a trace viewer shows as an odd span.
+void trace_record (trace_point point, uint64_t start, uint64_t arg,
+                   cxi_command command) {
+   if (not trace_enabled) return;
+   if (thread_id == 0) thread_id = ::gettid();
+   uint64_t slot = ring_next.fetch_add (1, memory_order_relaxed);
+   ring[slot & ring_mask] = {start, trace_clock() - start, arg,
+                             thread_id, point, command, 0};
+}
+
+// The dump header, and the ring as up to two runs of events.
+struct dump_parts {
+   trace_dump_header header;
+   const trace_event* first;
+   size_t first_count;
+   const trace_event* second;
+   size_t second_count;
+};
+
+static dump_parts dump_snapshot() {
+   dump_parts parts {};
+   memcpy (parts.header.magic, TRACE_MAGIC, sizeof TRACE_MAGIC);
+   parts.header.version = TRACE_VERSION;
+   parts.header.pid = ::getpid();
+   parts.header.base_ticks = base_ticks;
+   parts.header.base_ns = base_ns;
+   parts.header.dump_ticks = trace_clock();
+   parts.header.dump_ns = monotonic_ns();
+   if (not trace_enabled) return parts;
+   uint64_t next = ring_next.load (memory_order_relaxed);
+   uint64_t count = min<uint64_t> (next, ring_mask + 1);
+   size_t oldest = (next - count) & ring_mask;
+   parts.header.events = count;
+   parts.first = &ring[oldest];
+   parts.first_count = min<uint64_t> (count, ring_mask + 1 - oldest);
+   parts.second = &ring[0];
+   parts.second_count = count - parts.first_count;
+   return parts;
+}
+
+string trace_dump() {
+   dump_parts parts = dump_snapshot();
+   string dump (reinterpret_cast<const char*> (&parts.header),
+                sizeof parts.header);
+   dump.append (reinterpret_cast<const char*> (parts.first),
+                parts.first_count * sizeof (trace_event));
+   dump.append (reinterpret_cast<const char*> (parts.second),
+                parts.second_count * sizeof (trace_event));
+   return dump;
+}
+
+static int write_whole (int file_fd, const void* buffer, size_t size) {
+   const char* bytes = static_cast<const char*> (buffer);
+   while (size > 0) {
+      ssize_t nbytes = ::write (file_fd, bytes, size);
+      if (nbytes < 0) {
+         if (errno == EINTR) continue;
+         return errno;
+      }
+      bytes += nbytes;
+      size -= nbytes;
+   }
+   return 0;
+}
+
+// Only async-signal-safe calls from here on: no allocation, and the
+// name is put together by hand.
+int trace_dump_file (const char* prefix) {
+   int saved_errno = errno;
+   char filename[256];
+   size_t length = strnlen (prefix, sizeof filename - 16);
+   memcpy (filename, prefix, length);
+   filename[length++] = '.';
+   char digits[16];
+   size_t ndigits = 0;
+   for (pid_t pid = ::getpid(); pid > 0 or ndigits == 0; pid /= 10) {
+      digits[ndigits++] = '0' + pid % 10;
+   }
+   while (ndigits > 0) filename[length++] = digits[--ndigits];
+   filename[length] = '\0';
+   dump_parts parts = dump_snapshot();
+   int file_fd = ::open (filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+   int error = file_fd < 0 ? errno : 0;
+   if (error == 0) {
+      error = write_whole (file_fd, &parts.header, sizeof parts.header);
+   }
+   if (error == 0) {
+      error = write_whole (file_fd, parts.first,
+                           parts.first_count * sizeof (trace_event));
+   }
+   if (error == 0) {
+      error = write_whole (file_fd, parts.second,
+                           parts.second_count * sizeof (trace_event));
+   }
+   if (file_fd >= 0 and ::close (file_fd) < 0 and error == 0) {
+      error = errno;
+   }
+   errno = saved_errno;
+   return error;
+}
+
+bool trace_parse (const string& dump, trace_dump_header& header,
+                  vector<trace_event>& events) {
+   if (dump.size() < sizeof header) return false;
+   memcpy (&header, dump.data(), sizeof header);
+   // the count is checked before it is multiplied, which could wrap
+   size_t room = (dump.size() - sizeof header) / sizeof (trace_event);
+   if (memcmp (header.magic, TRACE_MAGIC, sizeof TRACE_MAGIC) != 0
+   or header.version != TRACE_VERSION or header.events > room
+   or dump.size() != sizeof header
+                     + header.events * sizeof (trace_event)) {
+      return false;
+   }
+   events.resize (header.events);
+   memcpy (events.data(), dump.data() + sizeof header,
+           header.events * sizeof (trace_event));
+   return true;
+}
+
+size_t get_trace_events (const string& events_arg) {
+   constexpr unsigned long MAX_TRACE_EVENTS = 1 << 26;
+   auto error = socket_error (events_arg + ": invalid trace size");
+   try {
+      size_t end = 0;
+      unsigned long events = stoul (events_arg, &end);
+      if (end != events_arg.size() or events == 0
+      or events > MAX_TRACE_EVENTS) throw error;
+      return events;
+   }catch (invalid_argument&) { // thrown by stoul
+      throw error;
+   }catch (out_of_range&) { // thrown by stoul
+      throw error;
+   }
+}
+
@@ -0,0 +1,122 @@
+// $Id: trace.h,v 1.1 2026-10-17 03:20:17-07 - - $
+
+//
+// request tracing
+// Spans in the life of a request are recorded as fixed-size binary
+// events in a ring in memory, cheaply enough to leave on in
+// production: a span costs two clock reads and a store, and when
+// tracing is off, a test of trace_enabled.  Once the ring is full
+// the oldest events are overwritten.
+//
+// Time is kept in ticks of the TSC where the processor keeps it
+// invariant, or else in nanoseconds of CLOCK_MONOTONIC.  A dump
+// pairs the tick count with CLOCK_MONOTONIC when tracing began and
+// again when it was dumped, so ticks convert to times that line up
+// across the processes of a server.
+//
+// A dump is a trace_dump_header and its events, oldest first, in
+// host byte order.  cxid writes one for each process that gets
+// SIGUSR2 to cxid-trace.<pid> in its directory, and sends one in
+// reply to TRACE.  cxitrace converts dumps to the Chrome trace JSON
+// that chrome://tracing and Perfetto open.
+//
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "protocol.h"
+
+enum class trace_point : uint16_t {
+   REQUEST, RECV_HEADER, FILE_OPEN, SEND_PAYLOAD, RECV_PAYLOAD, SYNC,
+};
+
+string to_string (trace_point point);
+
+// A span: when it started and how long it took, in ticks, with the
+// command of its request if known, and a value such as a byte count.
+struct trace_event {
+   uint64_t start;
+   uint64_t ticks;
+   uint64_t arg;
+   uint32_t tid;
+   trace_point point;
+   cxi_command command;
+   uint8_t unused;
+};
+
+static_assert (sizeof (trace_event) == 32);
+
+constexpr char TRACE_MAGIC[8] {'C', 'X', 'I', 'T', 'R', 'A', 'C', 'E'};
+constexpr uint32_t TRACE_VERSION = 1;
+
+struct trace_dump_header {
+   char magic[8];
+   uint32_t version;
+   uint32_t pid;
+   uint64_t base_ticks;
+   uint64_t base_ns;
+   uint64_t dump_ticks;
+   uint64_t dump_ns;
+   uint64_t events;
+};
+
+extern bool trace_enabled;
+
+// Allocate a ring of at least events and start tracing.  Call before
+// forking server processes, each of which then keeps its own.
+void trace_init (size_t events);
+
+uint64_t trace_clock();
+
+// The clock if tracing, or 0.
+inline uint64_t trace_now() {
+   return trace_enabled ? trace_clock() : 0;
+}
+
+// Record a span that began at start and ends now.
+void trace_record (trace_point point, uint64_t start, uint64_t arg = 0,
+                   cxi_command command = cxi_command::ERROR);
+
+//
+// class trace_span
+// records a span from its construction to the end of its scope
+//
+
+class trace_span {
+   private:
+      trace_point point;
+      uint64_t start;
+   public:
+      uint64_t arg {0};
+      cxi_command command {cxi_command::ERROR};
+      explicit trace_span (trace_point point_, uint64_t arg_ = 0):
+               point (point_), start (trace_now()), arg (arg_) {}
+      trace_span (const trace_span&) = delete;
+      trace_span& operator= (const trace_span&) = delete;
+      ~trace_span() {
+         if (trace_enabled) trace_record (point, start, arg, command);
+      }
+};
+
+// A dump of this process's ring.
+string trace_dump();
+
+// Write a dump to prefix.<pid>.  Safe to call from a signal handler.
+// Returns 0 or errno.
+int trace_dump_file (const char* prefix);
+
+// Split a dump into its header and events.  Returns false if it is
+// not a whole dump.
+bool trace_parse (const string& dump, trace_dump_header& header,
+                  vector<trace_event>& events);
+
+// Parse a ring size argument.
+size_t get_trace_events (const string& events_arg);
+
+#endif
+
@@ -0,0 +1,634 @@
+// $Id: transfer.cpp,v 1.1 2026-10-16 09:12:40-07 - - $
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "crc32c.h"
+#include "debug.h"
+#include "protocol.h"
+#include "transfer.h"
+#include "uring.h"
+
+size_t transfer_chunk_size = DEFAULT_CHUNK_SIZE;
+bool transfer_sendfile = false;
+recv_mode transfer_recv_mode = recv_mode::COPY;
+bool transfer_io_uring = false;
+
+open_file::open_file (const char* filename, int flags, mode_t mode):
+           file_fd (::open (filename, flags | O_CLOEXEC, mode)) {
+}
+
+open_file::~open_file() {
+   if (file_fd != CLOSED_FD) ::close (file_fd);
+}
+
+int open_file::close() {
+   int status = ::close (file_fd);
+   file_fd = CLOSED_FD;
+   return status < 0 ? errno : 0;
+}
+
+// Threads of one process each get their own name.
+string temp_name (const string& filename) {
+   static atomic<unsigned> serial {0};
+   size_t slash = filename.rfind ('/');
+   size_t base = slash == string::npos ? 0 : slash + 1;
+   return filename.substr (0, base) + "." + filename.substr (base)
+        + ".cxid-" + to_string (getpid()) + "-" + to_string (++serial);
+}
+
+uint64_t file_size (int file_fd) {
+   struct stat stat_buf;
+   int status = ::fstat (file_fd, &stat_buf);
+   if (status < 0) throw socket_sys_error ("fstat");
+   if (not S_ISREG (stat_buf.st_mode)) {
+      errno = EISDIR;
+      throw socket_sys_error ("fstat");
+   }
+   return stat_buf.st_size;
+}
+
+static size_t next_chunk (uint64_t remaining) {
+   return min<uint64_t> (remaining, transfer_chunk_size);
+}
+
+// Returns the number of bytes not sent because sendfile is not
+// supported for this file and socket.
+static uint64_t sendfile_payload (base_socket& socket, int file_fd,
+                                  uint64_t nbytes) {
+   constexpr size_t MAX_SENDFILE = 0x40000000;
+   while (nbytes > 0) {
+      ssize_t nsent = ::sendfile (socket.get_socket_fd(), file_fd,
+                                  nullptr, min<uint64_t> (nbytes,
+                                  MAX_SENDFILE));
+      if (nsent < 0) {
+         switch (errno) {
+            case EINTR: continue;
+            case EINVAL: case ENOSYS: case EOPNOTSUPP:
+               DEBUGF ('t', "sendfile: " << strerror (errno));
+               return nbytes;
+            default: throw socket_sys_error ("sendfile");
+         }
+      }
+      if (nsent == 0) throw socket_error ("send_file: file truncated");
+      nbytes -= nsent;
+   }
+   return 0;
+}
+
+
+//
+// io_uring transfers
+// Each batch is a single chain of up to URING_BATCH file reads and
+// socket sends, or socket receives and file writes, all sharing one
+// chunk buffer.  IOSQE_IO_LINK makes the kernel run the chain in
+// order, so a batch costs one io_uring_enter instead of a system
+// call per step.  A short or failed step breaks the chain, and the
+// rest of the transfer goes through the copy path from the last
+// byte known to be done; that path also reports the real error.
+//
+
+#ifdef HAVE_IO_URING
+
+constexpr unsigned URING_BATCH = 8;
+
+static int pwrite_all (int file_fd, const char* buffer, size_t bufsize,
+                       off_t offset) {
+   while (bufsize > 0) {
+      ssize_t nwritten = ::pwrite (file_fd, buffer, bufsize, offset);
+      if (nwritten < 0) {
+         if (errno == EINTR) continue;
+         return errno;
+      }
+      buffer += nwritten;
+      bufsize -= nwritten;
+      offset += nwritten;
+   }
+   return 0;
+}
+
+// One ring per thread, made again in a child after fork.
+static uring* session_ring() {
+   thread_local unique_ptr<uring> ring;
+   thread_local pid_t ring_pid {0};
+   pid_t pid = getpid();
+   if (ring_pid != pid) {
+      ring_pid = pid;
+      ring.reset();
+      try {
+         ring = make_unique<uring> (2 * URING_BATCH);
+      }catch (socket_sys_error& error) {
+         DEBUGF ('t', error.what());
+      }
+   }
+   return ring.get();
+}
+
+static void prep_rw (io_uring_sqe* sqe, uint8_t opcode, int fd,
+                     char* buffer, size_t size, uint64_t user_data) {
+   sqe->opcode = opcode;
+   sqe->fd = fd;
+   sqe->addr = reinterpret_cast<uint64_t> (buffer);
+   sqe->len = size;
+   sqe->flags = IOSQE_IO_LINK;
+   sqe->user_data = user_data;
+}
+
+static void run_chain (uring& ring, io_uring_sqe* last,
+                       int32_t* results, unsigned nsteps) {
+   last->flags &= ~ IOSQE_IO_LINK;
+   ring.submit_and_wait (nsteps);
+   uint64_t user_data;
+   int32_t result;
+   for (unsigned ndone = 0; ndone < nsteps
+        and ring.next_cqe (user_data, result); ++ndone) {
+      results[user_data] = result;
+   }
+}
+
+// Returns the number of bytes left for the copy path.
+static uint64_t uring_send_file (base_socket& socket, int file_fd,
+                                 uint64_t nbytes) {
+   uring* ring = session_ring();
+   off_t offset = ::lseek (file_fd, 0, SEEK_CUR);
+   if (ring == nullptr or offset < 0) return nbytes;
+   auto chunk = make_unique<char[]> (next_chunk (nbytes));
+   while (nbytes > 0) {
+      int32_t sizes[URING_BATCH];
+      int32_t results[2 * URING_BATCH];
+      unsigned npairs = 0;
+      uint64_t queued = 0;
+      io_uring_sqe* last = nullptr;
+      for (; npairs < URING_BATCH and queued < nbytes; ++npairs) {
+         sizes[npairs] = next_chunk (nbytes - queued);
+         io_uring_sqe* read = ring->get_sqe();
+         prep_rw (read, IORING_OP_READ, file_fd, chunk.get(),
+                  sizes[npairs], 2 * npairs);
+         read->off = offset + queued;
+         last = ring->get_sqe();
+         prep_rw (last, IORING_OP_SEND, socket.get_socket_fd(),
+                  chunk.get(), sizes[npairs], 2 * npairs + 1);
+         last->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+         queued += sizes[npairs];
+      }
+      run_chain (*ring, last, results, 2 * npairs);
+      for (unsigned pair = 0; pair < npairs; ++pair) {
+         int32_t nsent = results[2 * pair + 1];
+         if (nsent > 0) {
+            offset += nsent;
+            nbytes -= nsent;
+         }
+         if (results[2 * pair] != sizes[pair] or nsent != sizes[pair]) {
+            DEBUGF ('t', "uring_send_file: read " << results[2 * pair]
+                    << " send " << nsent << " of " << sizes[pair]);
+            ::lseek (file_fd, offset, SEEK_SET);
+            return nbytes;
+         }
+      }
+   }
+   ::lseek (file_fd, offset, SEEK_SET);
+   return 0;
+}
+
+// Returns the number of bytes left for the copy path.  Sets error
+// if a write fails, in which case the rest must be discarded.
+static uint64_t uring_recv_file (base_socket& socket, int file_fd,
+                                 uint64_t nbytes, int& error) {
+   uring* ring = session_ring();
+   off_t offset = ::lseek (file_fd, 0, SEEK_CUR);
+   if (ring == nullptr or offset < 0) return nbytes;
+   auto chunk = make_unique<char[]> (next_chunk (nbytes));
+   while (nbytes > 0) {
+      int32_t sizes[URING_BATCH];
+      int32_t results[2 * URING_BATCH];
+      unsigned npairs = 0;
+      uint64_t queued = 0;
+      io_uring_sqe* last = nullptr;
+      for (; npairs < URING_BATCH and queued < nbytes; ++npairs) {
+         sizes[npairs] = next_chunk (nbytes - queued);
+         io_uring_sqe* recv = ring->get_sqe();
+         prep_rw (recv, IORING_OP_RECV, socket.get_socket_fd(),
+                  chunk.get(), sizes[npairs], 2 * npairs);
+         recv->msg_flags = MSG_WAITALL;
+         last = ring->get_sqe();
+         prep_rw (last, IORING_OP_WRITE, file_fd, chunk.get(),
+                  sizes[npairs], 2 * npairs + 1);
+         last->off = offset + queued;
+         queued += sizes[npairs];
+      }
+      run_chain (*ring, last, results, 2 * npairs);
+      for (unsigned pair = 0; pair < npairs; ++pair) {
+         int32_t nrecv = results[2 * pair];
+         int32_t nwritten = results[2 * pair + 1];
+         if (nrecv == 0) {
+            throw socket_error (to_string (socket) + " is closed");
+         }
+         if (nrecv < 0) {
+            errno = -nrecv;
+            throw socket_sys_error ("recv");
+         }
+         nbytes -= nrecv;
+         if (nwritten < 0 and nwritten != -ECANCELED) {
+            error = -nwritten;
+         }else if (nwritten < nrecv) {
+            // short write, or cancelled by a short receive
+            int32_t done = max (nwritten, 0);
+            error = pwrite_all (file_fd, chunk.get() + done,
+                                nrecv - done, offset + done);
+         }
+         offset += nrecv;
+         if (nrecv != sizes[pair] or nwritten != sizes[pair]) {
+            DEBUGF ('t', "uring_recv_file: recv " << nrecv
+                    << " write " << nwritten << " of " << sizes[pair]);
+            ::lseek (file_fd, offset, SEEK_SET);
+            return nbytes;
+         }
+      }
+   }
+   ::lseek (file_fd, offset, SEEK_SET);
+   return 0;
+}
+
+#else
+
+static uint64_t uring_send_file (base_socket&, int, uint64_t nbytes) {
+   return nbytes;
+}
+
+static uint64_t uring_recv_file (base_socket&, int, uint64_t nbytes,
+                                 int&) {
+   return nbytes;
+}
+
+#endif
+
+
+void send_file (base_socket& socket, int file_fd, uint64_t nbytes) {
+   if (transfer_sendfile) {
+      nbytes = sendfile_payload (socket, file_fd, nbytes);
+      if (nbytes == 0) return;
+   }
+   if (transfer_io_uring) {
+      nbytes = uring_send_file (socket, file_fd, nbytes);
+      if (nbytes == 0) return;
+   }
+   auto chunk = make_unique<char[]> (next_chunk (nbytes));
+   while (nbytes > 0) {
+      ssize_t nread = ::read (file_fd, chunk.get(),
+                              next_chunk (nbytes));
+      if (nread < 0) {
+         if (errno == EINTR) continue;
+         throw socket_sys_error ("send_file: read");
+      }
+      if (nread == 0) throw socket_error ("send_file: file truncated");
+      send_packet (socket, chunk.get(), nread);
+      nbytes -= nread;
+   }
+}
+
+
+int write_all (int file_fd, const char* buffer, size_t bufsize) {
+   while (bufsize > 0) {
+      ssize_t nwritten = ::write (file_fd, buffer, bufsize);
+      if (nwritten < 0) {
+         if (errno == EINTR) continue;
+         return errno;
+      }
+      buffer += nwritten;
+      bufsize -= nwritten;
+   }
+   return 0;
+}
+
+static int recv_file_copy (base_socket& socket, int file_fd,
+                           uint64_t nbytes) {
+   auto chunk = make_unique<char[]> (next_chunk (nbytes));
+   int error = 0;
+   while (nbytes > 0) {
+      size_t chunk_size = next_chunk (nbytes);
+      recv_packet (socket, chunk.get(), chunk_size);
+      if (error == 0) {
+         error = write_all (file_fd, chunk.get(), chunk_size);
+      }
+      nbytes -= chunk_size;
+   }
+   return error;
+}
+
+//
+// struct splice_pipe
+// the pipe that carries spliced pages from the socket to the file
+//
+
+struct splice_pipe {
+   int read_fd {-1};
+   int write_fd {-1};
+   bool file_splice {true}; // false once the file refuses splice
+   splice_pipe() {
+      int pipe_fd[2];
+      if (::pipe2 (pipe_fd, O_CLOEXEC) < 0) return;
+      read_fd = pipe_fd[0];
+      write_fd = pipe_fd[1];
+      ::fcntl (write_fd, F_SETPIPE_SZ, transfer_chunk_size);
+   }
+   ~splice_pipe() {
+      if (read_fd >= 0) ::close (read_fd);
+      if (write_fd >= 0) ::close (write_fd);
+   }
+   bool is_open() const { return read_fd >= 0; }
+};
+
+// Move count bytes out of the pipe into the file.  If the file does
+// not accept splice, or a write has already failed, the bytes are
+// read out of the pipe instead, so the pipe is always emptied.
+static void drain_pipe (splice_pipe& pipe, int file_fd, size_t count,
+                        int& error) {
+   while (count > 0 and error == 0 and pipe.file_splice) {
+      ssize_t nmoved = ::splice (pipe.read_fd, nullptr,
+                                 file_fd, nullptr, count,
+                                 SPLICE_F_MOVE);
+      if (nmoved < 0) {
+         if (errno == EINTR) continue;
+         if (errno == EINVAL) pipe.file_splice = false;
+                         else error = errno;
+         break;
+      }
+      count -= nmoved;
+   }
+   char buffer[0x1000];
+   while (count > 0) {
+      ssize_t nread = ::read (pipe.read_fd, buffer,
+                              min (count, sizeof buffer));
+      if (nread < 0) {
+         if (errno == EINTR) continue;
+         throw socket_sys_error ("drain_pipe: read");
+      }
+      if (error == 0) error = write_all (file_fd, buffer, nread);
+      count -= nread;
+   }
+}
+
+// Returns false without consuming anything if the socket cannot be
+// spliced, otherwise receives the whole payload.
+static bool recv_file_splice (base_socket& socket, int file_fd,
+                              uint64_t nbytes, int& error) {
+   splice_pipe pipe;
+   if (not pipe.is_open()) return false;
+   bool first_splice = true;
+   while (nbytes > 0) {
+      ssize_t nspliced = ::splice (socket.get_socket_fd(), nullptr,
+                                   pipe.write_fd, nullptr,
+                                   next_chunk (nbytes),
+                                   SPLICE_F_MOVE | SPLICE_F_MORE);
+      if (nspliced < 0) {
+         if (errno == EINTR) continue;
+         if (first_splice and (errno == EINVAL or errno == ENOSYS)) {
+            DEBUGF ('t', "splice: " << strerror (errno));
+            return false;
+         }
+         throw socket_sys_error ("splice");
+      }
+      if (nspliced == 0) {
+         throw socket_error (to_string (socket) + " is closed");
+      }
+      first_splice = false;
+      drain_pipe (pipe, file_fd, nspliced, error);
+      nbytes -= nspliced;
+   }
+   return true;
+}
+
+// Receives the payload straight into a window onto the file.  The
+// blocks are reserved with fallocate first, because a store into a
+// hole that cannot be allocated raises SIGBUS instead of returning
+// ENOSPC.  Returns the number of bytes left for the copy path if the
+// file cannot be mapped.
+static uint64_t recv_file_mmap (base_socket& socket, int file_fd,
+                                uint64_t nbytes, int& error) {
+   constexpr uint64_t MMAP_WINDOW = 0x1000000;
+   off_t offset = ::lseek (file_fd, 0, SEEK_CUR);
+   if (offset < 0) return nbytes;
+   if (::fallocate (file_fd, 0, offset, nbytes) < 0) {
+      if (errno == EOPNOTSUPP or errno == ENOSYS) return nbytes;
+      error = errno;
+      discard_payload (socket, nbytes);
+      return 0;
+   }
+   const uint64_t page_mask = ::sysconf (_SC_PAGESIZE) - 1;
+   const off_t end = offset + nbytes;
+   while (offset < end) {
+      off_t map_offset = offset & ~ page_mask;
+      size_t map_size = min<uint64_t> (end - map_offset, MMAP_WINDOW);
+      void* map = ::mmap (nullptr, map_size, PROT_WRITE, MAP_SHARED,
+                          file_fd, map_offset);
+      if (map == MAP_FAILED) {
+         DEBUGF ('t', "mmap: " << strerror (errno));
+         ::lseek (file_fd, offset, SEEK_SET);
+         return end - offset;
+      }
+      size_t skip = offset - map_offset;
+      try {
+         recv_packet (socket, static_cast<char*> (map) + skip,
+                      map_size - skip);
+      }catch (...) {
+         ::munmap (map, map_size);
+         throw;
+      }
+      ::munmap (map, map_size);
+      offset += map_size - skip;
+   }
+   ::lseek (file_fd, end, SEEK_SET);
+   return 0;
+}
+
+int recv_file (base_socket& socket, int file_fd, uint64_t nbytes) {
+   int error = 0;
+   switch (transfer_recv_mode) {
+      case recv_mode::SPLICE:
+         if (recv_file_splice (socket, file_fd, nbytes, error)) {
+            nbytes = 0;
+         }
+         break;
+      case recv_mode::MMAP:
+         nbytes = recv_file_mmap (socket, file_fd, nbytes, error);
+         break;
+      case recv_mode::COPY:
+         if (transfer_io_uring) {
+            nbytes = uring_recv_file (socket, file_fd, nbytes, error);
+         }
+         break;
+   }
+   if (nbytes > 0) {
+      if (error != 0) discard_payload (socket, nbytes);
+                 else error = recv_file_copy (socket, file_fd, nbytes);
+   }
+   DEBUGF ('t', "recv_file: error " << error);
+   return error;
+}
+
+void discard_payload (base_socket& socket, uint64_t nbytes) {
+   auto chunk = make_unique<char[]> (next_chunk (nbytes));
+   while (nbytes > 0) {
+      size_t chunk_size = next_chunk (nbytes);
+      recv_packet (socket, chunk.get(), chunk_size);
+      nbytes -= chunk_size;
+   }
+}
+
+
+static void add_crc_chunk (payload_crc& crc, const char* chunk,
+                           size_t size) {
+   uint32_t chunk_crc = crc32c (0, chunk, size);
+   crc.whole = crc32c_combine (crc.whole, chunk_crc, size);
+   crc.chunks.push_back (chunk_crc);
+}
+
+payload_crc buffer_crc (const char* buffer, size_t size) {
+   payload_crc crc;
+   crc.chunks.reserve ((size + CRC_CHUNK_SIZE - 1) / CRC_CHUNK_SIZE);
+   for (size_t offset = 0; offset < size; offset += CRC_CHUNK_SIZE) {
+      add_crc_chunk (crc, buffer + offset,
+                     min (size - offset, CRC_CHUNK_SIZE));
+   }
+   return crc;
+}
+
+payload_crc file_crc (int file_fd, uint64_t offset, uint64_t nbytes) {
+   // read several pieces at a time to keep the system calls down
+   constexpr size_t READ_SIZE = 16 * CRC_CHUNK_SIZE;
+   payload_crc crc;
+   crc.chunks.reserve ((nbytes + CRC_CHUNK_SIZE - 1) / CRC_CHUNK_SIZE);
+   auto buffer = make_unique<char[]> (min<uint64_t> (nbytes,
+                                                     READ_SIZE));
+   while (nbytes > 0) {
+      ssize_t nread = ::pread (file_fd, buffer.get(),
+                               min<uint64_t> (nbytes, READ_SIZE),
+                               offset);
+      if (nread < 0) {
+         if (errno == EINTR) continue;
+         throw socket_sys_error ("pread");
+      }
+      if (nread == 0) {
+         errno = EIO;
+         throw socket_sys_error ("pread: file truncated");
+      }
+      for (ssize_t done = 0; done < nread; done += CRC_CHUNK_SIZE) {
+         add_crc_chunk (crc, buffer.get() + done,
+                        min<size_t> (nread - done, CRC_CHUNK_SIZE));
+      }
+      offset += nread;
+      nbytes -= nread;
+   }
+   return crc;
+}
+
+void send_crc (base_socket& socket, const payload_crc& crc) {
+   vector<uint32_t> trailer;
+   trailer.reserve (crc.chunks.size() + 1);
+   trailer.push_back (htonl (crc.whole));
+   for (uint32_t chunk_crc: crc.chunks) {
+      trailer.push_back (htonl (chunk_crc));
+   }
+   send_packet (socket, trailer.data(),
+                trailer.size() * sizeof (uint32_t));
+}
+
+// The piece count comes from a size the peer announced, so the
+// trailer is read a batch of pieces at a time, and memory grows only
+// with what has actually arrived.
+payload_crc recv_crc (base_socket& socket, uint64_t nbytes) {
+   constexpr uint64_t BATCH_PIECES = 1024;
+   payload_crc crc;
+   recv_packet (socket, &crc.whole, sizeof crc.whole);
+   crc.whole = ntohl (crc.whole);
+   uint64_t pieces = nbytes / CRC_CHUNK_SIZE
+                   + (nbytes % CRC_CHUNK_SIZE != 0);
+   while (crc.chunks.size() < pieces) {
+      size_t begin = crc.chunks.size();
+      size_t count = min (pieces - begin, BATCH_PIECES);
+      crc.chunks.resize (begin + count);
+      recv_packet (socket, crc.chunks.data() + begin,
+                   count * sizeof (uint32_t));
+   }
+   for (uint32_t& chunk_crc: crc.chunks) chunk_crc = ntohl (chunk_crc);
+   return crc;
+}
+
+int64_t crc_mismatch (const payload_crc& sent,
+                      const payload_crc& received) {
+   size_t count = min (sent.chunks.size(), received.chunks.size());
+   for (size_t index = 0; index < count; ++index) {
+      if (sent.chunks[index] != received.chunks[index]) return index;
+   }
+   if (sent.chunks.size() != received.chunks.size()
+   or sent.whole != received.whole) return count;
+   return -1;
+}
+
+int verify_file_crc (const payload_crc& sent, int file_fd,
+                     uint64_t offset, uint64_t nbytes) {
+   try {
+      int64_t index = crc_mismatch (sent,
+                                    file_crc (file_fd, offset, nbytes));
+      if (index < 0) return 0;
+      DEBUGF ('t', "checksum mismatch in chunk " << index);
+      return EBADMSG;
+   }catch (socket_sys_error& error) {
+      return error.sys_errno;
+   }
+}
+
+
+// stoull would take leading space and a minus sign, so the number
+// must start with a digit.
+bool parse_size (const string& size_arg, uint64_t& size) {
+   if (size_arg.empty() or not isdigit (uint8_t (size_arg[0]))) {
+      return false;
+   }
+   size_t suffix_pos = 0;
+   try {
+      size = stoull (size_arg, &suffix_pos);
+   }catch (out_of_range&) { // thrown by stoull
+      return false;
+   }
+   string suffix = size_arg.substr (suffix_pos);
+   int shift = 0;
+   if (suffix == "K" or suffix == "k") shift = 10;
+   else if (suffix == "M" or suffix == "m") shift = 20;
+   else if (suffix == "G" or suffix == "g") shift = 30;
+   else if (suffix != "") return false;
+   if (size > UINT64_MAX >> shift) return false;
+   size <<= shift;
+   return true;
+}
+
+size_t get_chunk_size (const string& chunk_arg) {
+   uint64_t size = 0;
+   if (not parse_size (chunk_arg, size)
+   or size < MIN_CHUNK_SIZE or size > MAX_CHUNK_SIZE) {
+      throw socket_error (chunk_arg + ": invalid chunk size");
+   }
+   return size;
+}
+
+recv_mode get_recv_mode (const string& mode_arg) {
+   if (mode_arg == "copy") return recv_mode::COPY;
+   if (mode_arg == "splice") return recv_mode::SPLICE;
+   if (mode_arg == "mmap") return recv_mode::MMAP;
+   throw socket_error (mode_arg + ": invalid receive mode");
+}
+
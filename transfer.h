@@ -0,0 +1,135 @@
+// $Id: transfer.h,v 1.1 2026-10-16 09:12:40-07 - - $
+
+//
+// streaming file transfer
+// payloads are moved between a file descriptor and a socket in
+// chunks of at most transfer_chunk_size bytes, so the memory used
+// by a session does not depend on the size of the file.
+//
+
+#ifndef TRANSFER_H
+#define TRANSFER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "socket.h"
+
+constexpr size_t DEFAULT_CHUNK_SIZE = 0x10000;
+constexpr size_t MIN_CHUNK_SIZE = 0x200;
+constexpr size_t MAX_CHUNK_SIZE = 0x4000000;
+
+extern size_t transfer_chunk_size;
+
+// When set, send_file hands the payload to the kernel with sendfile(2)
+// instead of copying it through a user-space chunk.  If the file or
+// socket does not support sendfile, the copy path is used instead.
+extern bool transfer_sendfile;
+
+// How recv_file moves a payload from the socket into the file.
+// COPY receives each chunk into a user-space buffer and writes it.
+// SPLICE moves pages from the socket to the file through a pipe.
+// MMAP reserves the file's blocks with fallocate and receives
+// straight into a shared mapping of the target.  Either of the
+// zero-copy modes falls back to COPY where the kernel or the file
+// system does not support it.
+enum class recv_mode { COPY, SPLICE, MMAP };
+extern recv_mode transfer_recv_mode;
+
+// When set, the copy paths of send_file and recv_file submit their
+// file and socket operations to io_uring in linked batches.  Has no
+// effect unless built with HAVE_IO_URING, or if the kernel refuses
+// to set up a ring.
+extern bool transfer_io_uring;
+
+//
+// class open_file
+// owns a file descriptor and closes it when it goes out of scope
+//
+
+class open_file {
+   private:
+      static constexpr int CLOSED_FD = -1;
+      int file_fd {CLOSED_FD};
+   public:
+      open_file (const char* filename, int flags, mode_t mode = 0666);
+      open_file (const open_file&) = delete;
+      open_file& operator= (const open_file&) = delete;
+      ~open_file();
+      bool is_open() const { return file_fd != CLOSED_FD; }
+      int get() const { return file_fd; }
+      int close(); // returns 0 or errno
+};
+
+// A hidden name beside filename, unique to this process and call,
+// for a file that is renamed over it once it is complete.  ls does
+// not show dotfiles.
+string temp_name (const string& filename);
+
+// Size of a regular file, or throws socket_sys_error.
+uint64_t file_size (int file_fd);
+
+// Write the whole buffer.  Returns 0 or errno.
+int write_all (int file_fd, const char* buffer, size_t bufsize);
+
+// Send exactly nbytes from the file's current offset.
+void send_file (base_socket& socket, int file_fd, uint64_t nbytes);
+
+// Receive exactly nbytes into the file.  The whole payload is always
+// consumed from the socket, even if writing fails, so the connection
+// stays in step.  Returns 0 or the errno of the first failed write.
+int recv_file (base_socket& socket, int file_fd, uint64_t nbytes);
+
+// Receive and throw away nbytes of payload.
+void discard_payload (base_socket& socket, uint64_t nbytes);
+
+//
+// struct payload_crc
+// CRC32C of a whole payload and of each CRC_CHUNK_SIZE piece of it,
+// the last of which may be short.  When both ends have agreed on
+// CXI_FEATURE_CRC32C, each file payload is followed by a trailer
+// holding the whole checksum and then the piece checksums, as
+// 32-bit words in network byte order.  The piece size is fixed by
+// the protocol rather than the transfer chunk size, which each end
+// chooses for itself.
+//
+
+constexpr size_t CRC_CHUNK_SIZE = 0x10000;
+
+struct payload_crc {
+   uint32_t whole {0};
+   vector<uint32_t> chunks;
+};
+
+payload_crc buffer_crc (const char* buffer, size_t size);
+
+// Checksum nbytes of the file from offset, without moving the file
+// offset.  Throws socket_sys_error if the file cannot be read.
+payload_crc file_crc (int file_fd, uint64_t offset, uint64_t nbytes);
+
+void send_crc (base_socket& socket, const payload_crc& crc);
+payload_crc recv_crc (base_socket& socket, uint64_t nbytes);
+
+// Index of the first piece that differs, or -1 if they agree.
+int64_t crc_mismatch (const payload_crc& sent,
+                      const payload_crc& received);
+
+// Check a file just received against the trailer that came with it.
+// Returns 0, EBADMSG if they differ, or errno if it cannot be read.
+int verify_file_crc (const payload_crc& sent, int file_fd,
+                     uint64_t offset, uint64_t nbytes);
+
+// Parse a size such as 4096, 64K, 1M or 2G into size.  Returns false
+// if it is not one, or if it does not fit in 64 bits.
+bool parse_size (const string& size_arg, uint64_t& size);
+
+// Parse a chunk size argument such as 4096, 64K or 1M.
+size_t get_chunk_size (const string& chunk_arg);
+
+// Parse a receive mode argument: copy, splice or mmap.
+recv_mode get_recv_mode (const string& mode_arg);
+
+#endif
+
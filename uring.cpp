@@ -0,0 +1,136 @@
+// $Id: uring.cpp,v 1.1 2026-10-16 15:05:51-07 - - $
+
+#include <cerrno>
+#include <cstring>
+using namespace std;
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "socket.h"
+#include "uring.h"
+
+#ifdef HAVE_IO_URING
+
+static char* offset_ptr (void* base, uint32_t offset) {
+   return static_cast<char*> (base) + offset;
+}
+
+uring::uring (unsigned entries) {
+   io_uring_params params;
+   memset (&params, 0, sizeof params);
+   ring_fd = ::syscall (__NR_io_uring_setup, entries, &params);
+   if (ring_fd < 0) throw socket_sys_error ("io_uring_setup");
+   sq_ring_size = params.sq_off.array
+                + params.sq_entries * sizeof (unsigned);
+   cq_ring_size = params.cq_off.cqes
+                + params.cq_entries * sizeof (io_uring_cqe);
+   sqes_size = params.sq_entries * sizeof (io_uring_sqe);
+   sq_ring = ::mmap (nullptr, sq_ring_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, ring_fd,
+                     IORING_OFF_SQ_RING);
+   cq_ring = ::mmap (nullptr, cq_ring_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, ring_fd,
+                     IORING_OFF_CQ_RING);
+   void* sqe_map = ::mmap (nullptr, sqes_size, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, ring_fd,
+                           IORING_OFF_SQES);
+   if (sq_ring == MAP_FAILED or cq_ring == MAP_FAILED
+   or sqe_map == MAP_FAILED) {
+      int error = errno;
+      if (sq_ring != MAP_FAILED) ::munmap (sq_ring, sq_ring_size);
+      if (cq_ring != MAP_FAILED) ::munmap (cq_ring, cq_ring_size);
+      if (sqe_map != MAP_FAILED) ::munmap (sqe_map, sqes_size);
+      ::close (ring_fd);
+      errno = error;
+      throw socket_sys_error ("io_uring mmap");
+   }
+   sqes = static_cast<io_uring_sqe*> (sqe_map);
+   sq_head = reinterpret_cast<unsigned*> (
+             offset_ptr (sq_ring, params.sq_off.head));
+   sq_tail = reinterpret_cast<unsigned*> (
+             offset_ptr (sq_ring, params.sq_off.tail));
+   sq_mask = reinterpret_cast<unsigned*> (
+             offset_ptr (sq_ring, params.sq_off.ring_mask));
+   sq_array = reinterpret_cast<unsigned*> (
+              offset_ptr (sq_ring, params.sq_off.array));
+   cq_head = reinterpret_cast<unsigned*> (
+             offset_ptr (cq_ring, params.cq_off.head));
+   cq_tail = reinterpret_cast<unsigned*> (
+             offset_ptr (cq_ring, params.cq_off.tail));
+   cq_mask = reinterpret_cast<unsigned*> (
+             offset_ptr (cq_ring, params.cq_off.ring_mask));
+   cqes = reinterpret_cast<io_uring_cqe*> (
+          offset_ptr (cq_ring, params.cq_off.cqes));
+   sq_entries = params.sq_entries;
+}
+
+uring::~uring() {
+   ::munmap (sqes, sqes_size);
+   ::munmap (cq_ring, cq_ring_size);
+   ::munmap (sq_ring, sq_ring_size);
+   ::close (ring_fd);
+}
+
+io_uring_sqe* uring::get_sqe() {
+   unsigned head = __atomic_load_n (sq_head, __ATOMIC_ACQUIRE);
+   unsigned tail = *sq_tail + queued;
+   if (tail - head >= sq_entries) return nullptr;
+   unsigned index = tail & *sq_mask;
+   sq_array[index] = index;
+   ++queued;
+   io_uring_sqe* sqe = &sqes[index];
+   memset (sqe, 0, sizeof *sqe);
+   return sqe;
+}
+
+void uring::submit_and_wait (unsigned wait_nr) {
+   __atomic_store_n (sq_tail, *sq_tail + queued, __ATOMIC_RELEASE);
+   unsigned to_submit = queued;
+   queued = 0;
+   for (;;) {
+      int rc = ::syscall (__NR_io_uring_enter, ring_fd, to_submit,
+                          wait_nr, IORING_ENTER_GETEVENTS, nullptr, 0);
+      if (rc >= 0) return;
+      if (errno != EINTR) throw socket_sys_error ("io_uring_enter");
+      // entries the kernel consumed before the signal are not resent
+      unsigned head = __atomic_load_n (sq_head, __ATOMIC_ACQUIRE);
+      to_submit = *sq_tail - head;
+   }
+}
+
+bool uring::next_cqe (uint64_t& user_data, int32_t& result) {
+   unsigned head = *cq_head;
+   unsigned tail = __atomic_load_n (cq_tail, __ATOMIC_ACQUIRE);
+   if (head == tail) return false;
+   const io_uring_cqe& cqe = cqes[head & *cq_mask];
+   user_data = cqe.user_data;
+   result = cqe.res;
+   __atomic_store_n (cq_head, head + 1, __ATOMIC_RELEASE);
+   return true;
+}
+
+#else
+
+uring::uring (unsigned) {
+   errno = ENOSYS;
+   throw socket_sys_error ("io_uring");
+}
+
+uring::~uring() {
+}
+
+io_uring_sqe* uring::get_sqe() {
+   return nullptr;
+}
+
+void uring::submit_and_wait (unsigned) {
+}
+
+bool uring::next_cqe (uint64_t&, int32_t&) {
+   return false;
+}
+
+#endif
+
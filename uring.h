@@ -0,0 +1,62 @@
+// $Id: uring.h,v 1.1 2026-10-16 15:05:51-07 - - $
+
+//
+// class uring
+// A minimal io_uring instance driven through the raw system calls,
+// since liburing is not assumed to be installed.  Requests are
+// queued with get_sqe, handed to the kernel together by
+// submit_and_wait, and their results collected with next_cqe.
+// Built only when HAVE_IO_URING is defined; otherwise the
+// constructor always fails and callers use ordinary system calls.
+//
+
+#ifndef URING_H
+#define URING_H
+
+#include <cstdint>
+using namespace std;
+
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#else
+struct io_uring_sqe;
+struct io_uring_cqe;
+#endif
+
+class uring {
+   private:
+      int ring_fd {-1};
+      void* sq_ring {nullptr};
+      size_t sq_ring_size {0};
+      void* cq_ring {nullptr};
+      size_t cq_ring_size {0};
+      io_uring_sqe* sqes {nullptr};
+      size_t sqes_size {0};
+      unsigned* sq_head {nullptr};
+      unsigned* sq_tail {nullptr};
+      unsigned* sq_mask {nullptr};
+      unsigned* sq_array {nullptr};
+      unsigned* cq_head {nullptr};
+      unsigned* cq_tail {nullptr};
+      unsigned* cq_mask {nullptr};
+      io_uring_cqe* cqes {nullptr};
+      unsigned sq_entries {0};
+      unsigned queued {0};
+   public:
+      explicit uring (unsigned entries); // throws socket_sys_error
+      uring (const uring&) = delete;
+      uring& operator= (const uring&) = delete;
+      ~uring();
+
+      // A zeroed submission entry, or nullptr if the queue is full.
+      io_uring_sqe* get_sqe();
+
+      // Submit everything queued and wait for wait_nr completions.
+      void submit_and_wait (unsigned wait_nr);
+
+      // Copy out the next completion.  False if there is none.
+      bool next_cqe (uint64_t& user_data, int32_t& result);
+};
+
+#endif
+